@@ -0,0 +1,207 @@
+/*
+ *  Synopsis:
+ *	Convert a column of RFC3339 timestamps to epoch nano seconds.
+ *  Usage:
+ *	RFC3339-epoch <access.log >epoch.log
+ *	RFC3339-epoch --field 3 --delimiter , <in.csv >out.csv
+ *  Description:
+ *	Copy standard input to standard output, replacing one delimited field
+ *	of each line, an RFC3339 timestamp like
+ *
+ *		2023-11-14T22:13:20.123456789+00:00
+ *
+ *	with the signed nano seconds since the unix epoch
+ *
+ *		1700000000123456789
+ *
+ *	All other bytes are copied unchanged.  Fields are counted from 1 and
+ *	default to field 1, tab delimited.  Offsets other than Z or +00:00
+ *	are converted to UTC.
+ *
+ *	Input is read in 1MB blocks and output written in 64KB blocks, so
+ *	the filter runs at line rate, instead of forking "date -d" per line.
+ *  Exit Status:
+ *	0	all timestamps converted
+ *	1	malformed timestamp or missing field, line number on stderr
+ *	2	unexpected error
+ *  Note:
+ *	Add option --skip-bad to copy malformed lines unchanged.
+ */
+#include <sys/errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jmscott/libjmscott.h"
+
+extern int	errno;
+
+char *jmscott_progname = "RFC3339-epoch";
+static char *usage = "RFC3339-epoch [--field <n>] [--delimiter <char>]";
+
+#define EXIT_OK		0
+#define EXIT_BAD	1
+#define EXIT_FAULT	2
+
+#define IN_SIZE		(1024 * 1024)
+#define OUT_SIZE	(64 * 1024)
+
+static char		in[IN_SIZE];
+static char		out[OUT_SIZE];
+static size_t		out_len = 0;
+static unsigned long long	line_no = 0;
+
+static void
+die(char *msg)
+{
+	jmscott_die(EXIT_FAULT, msg);
+}
+
+static void
+die2(char *msg1, char *msg2)
+{
+	jmscott_die2(EXIT_FAULT, msg1, msg2);
+}
+
+static void	flush();
+
+/*
+ *  Malformed line, so flush the lines already converted and exit 1.
+ */
+static void
+die_line(char *msg1, char *msg2)
+{
+	char num[32] = "line #";
+
+	flush();
+	*jmscott_ulltoa(line_no, num + 6) = 0;
+	if (msg2)
+		jmscott_die3(EXIT_BAD, num, msg1, msg2);
+	jmscott_die2(EXIT_BAD, num, msg1);
+}
+
+static void
+flush()
+{
+	if (out_len > 0 && jmscott_write_all(1, out, out_len) < 0)
+		die2("write(stdout) failed", strerror(errno));
+	out_len = 0;
+}
+
+static void
+put(const char *src, size_t n)
+{
+	if (out_len + n > sizeof out) {
+		flush();
+		if (n > sizeof out) {
+			if (jmscott_write_all(1, (void *)src, n) < 0)
+				die2("write(stdout) failed", strerror(errno));
+			return;
+		}
+	}
+	memcpy(out + out_len, src, n);
+	out_len += n;
+}
+
+/*
+ *  Convert the timestamp field of one line, excluding the new line.
+ */
+static void
+convert(const char *line, size_t len, int field, char delim)
+{
+	const char *f = line, *end = line + len;
+	int i;
+
+	line_no++;
+	for (i = 1;  i < field;  i++) {
+		f = memchr(f, delim, end - f);
+		if (!f)
+			die_line("missing field", (char *)0);
+		f++;
+	}
+	const char *f_end = memchr(f, delim, end - f);
+	if (!f_end)
+		f_end = end;
+
+	long long ns;
+	size_t nparsed;
+	char *err = jmscott_RFC3339_parse(f, f_end - f, &ns, &nparsed);
+	if (err)
+		die_line("RFC3339_parse() failed", err);
+	if (nparsed != (size_t)(f_end - f))
+		die_line("trailing chars after timestamp", (char *)0);
+
+	char digits[21];
+
+	put(line, f - line);
+	put(digits, jmscott_lltoa(ns, digits) - digits);
+	put(f_end, end - f_end);
+}
+
+int
+main(int argc, char **argv)
+{
+	int i, field = 0;
+	char delim = 0;
+	size_t have = 0;
+	ssize_t nr;
+
+	errno = 0;
+	for (i = 1;  i < argc;  i++) {
+		if (strcmp("--field", argv[i]) == 0) {
+			unsigned long long ull;
+			char *err;
+
+			if (++i == argc)
+				die("option --field: missing number");
+			if (field)
+				die("option --field: given more than once");
+			if ((err = jmscott_a2ui63(argv[i], &ull)))
+				die2("option --field", err);
+			if (ull == 0 || ull > 65535)
+				die("option --field: not in [1, 65535]");
+			field = (int)ull;
+		} else if (strcmp("--delimiter", argv[i]) == 0) {
+			if (++i == argc)
+				die("option --delimiter: missing char");
+			if (delim)
+				die("option --delimiter: given more than once");
+			if (strlen(argv[i]) != 1)
+				die("option --delimiter: not a single char");
+			delim = argv[i][0];
+			if (delim == '\n')
+				die("option --delimiter: can not be new line");
+		} else
+			jmscott_die3(
+				EXIT_FAULT,
+				"unknown option",
+				argv[i],
+				usage
+			);
+	}
+	if (!field)
+		field = 1;
+	if (!delim)
+		delim = '\t';
+
+	while ((nr = jmscott_read(0, in + have, sizeof in - have)) > 0) {
+		char *p = in, *end = in + have + nr, *nl;
+
+		while ((nl = memchr(p, '\n', end - p))) {
+			convert(p, nl - p, field, delim);
+			put("\n", 1);
+			p = nl + 1;
+		}
+		have = end - p;
+		if (have == sizeof in)
+			die("line > 1MB");
+		memmove(in, p, have);
+	}
+	if (nr < 0)
+		die2("read(stdin) failed", strerror(errno));
+
+	//  final line with no new line
+	if (have > 0)
+		convert(in, have, field, delim);
+	flush();
+	_exit(EXIT_OK);
+}
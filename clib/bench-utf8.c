@@ -0,0 +1,173 @@
+/*
+ *  Synopsis:
+ *	Benchmark utf8 validation kernels against the scalar state machine.
+ *  Usage:
+ *	$ cc -O2 bench-utf8.c -L. -ljmscott
+ *	$ ./a.out /usr/share/dict/words
+ *	$ ./a.out			#  generated mix of 1 to 4 byte chars
+ *  Description:
+ *	Validate the file, or 64MB of generated text, several times with each
+ *	kernel the cpu supports, reporting the best GB/sec.  Each kernel is
+ *	then run on random corruptions of the first 1MB of text, insisting
+ *	the offset of the first invalid sequence matches the state machine.
+ */
+#include <sys/errno.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libjmscott.h"
+
+extern int	errno;
+
+char *jmscott_progname = "bench-utf8";
+
+#define GEN_SIZE	(64 * 1024 * 1024)
+#define CHUNK_SIZE	(1024 * 1024)
+#define ROUNDS		5
+#define NCORRUPT	2000
+#define CORRUPT_SIZE	(1024 * 1024)
+
+static void
+die(char *msg)
+{
+	jmscott_die(1, msg);
+}
+
+static void
+die2(char *msg1, char *msg2)
+{
+	jmscott_die2(1, msg1, msg2);
+}
+
+static unsigned char *
+generate(size_t size)
+{
+	static const char *chars[] = {
+		"a", "b", " ", "\n", "z", "0",
+		"\xc3\xa9", "\xd0\x96",
+		"\xe2\x82\xac", "\xe6\x97\xa5",
+		"\xf0\x9f\x98\x80"
+	};
+	unsigned char *buf = malloc(size), *p = buf;
+
+	if (!buf)
+		die("malloc(generate) failed");
+	while (p + 4 < buf + size) {
+		const char *c = chars[random() % 11];
+		size_t len = strlen(c);
+
+		memcpy(p, c, len);
+		p += len;
+	}
+	memset(p, 'x', buf + size - p);
+	return buf;
+}
+
+/*
+ *  Validate in chunks, to exercise sequences split across writes.
+ */
+static int
+validate(int simd, unsigned char *buf, size_t size, size_t chunk,
+	 unsigned long long *bad_offset)
+{
+	struct jmscott_utf8 u;
+	size_t off;
+
+	jmscott_utf8_init(&u);
+	u.simd = simd;
+	for (off = 0;  off < size;  off += chunk) {
+		size_t len = size - off < chunk ? size - off : chunk;
+
+		if (!jmscott_utf8_write(&u, buf + off, len))
+			break;
+	}
+	if (jmscott_utf8_close(&u))
+		return 1;
+	*bad_offset = u.bad_offset;
+	return 0;
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned char *buf;
+	size_t size;
+	int simd, best = jmscott_utf8_simd(), i, ok;
+	unsigned long long bad_offset, scalar_offset;
+
+	srandom(1);
+	if (argc == 2) {
+		int fd = open(argv[1], O_RDONLY);
+		struct stat st;
+
+		if (fd < 0 || fstat(fd, &st) < 0)
+			die2(argv[1], strerror(errno));
+		size = st.st_size;
+		buf = mmap((void *)0, size, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE, fd, 0);
+		if (buf == MAP_FAILED)
+			die2("mmap() failed", strerror(errno));
+	} else {
+		size = GEN_SIZE;
+		buf = generate(size);
+	}
+	ok = validate(JMSCOTT_UTF8_SCALAR, buf, size, CHUNK_SIZE, &bad_offset);
+	printf("%zu bytes, %s\n", size, ok ? "well formed" : "invalid");
+	fflush(stdout);
+
+	for (simd = JMSCOTT_UTF8_SCALAR;  simd <= best;  simd++) {
+		double t, min = 1e9;
+		int r;
+
+		for (r = 0;  r < ROUNDS;  r++) {
+			t = now();
+			if (validate(simd, buf, size, CHUNK_SIZE, &bad_offset) != ok)
+				die2("kernel disagrees with scalar",
+						jmscott_utf8_simd_name(simd));
+			t = now() - t;
+			if (t < min)
+				min = t;
+		}
+		printf("%8s: %6.2f GB/sec\n", jmscott_utf8_simd_name(simd),
+							size / min / 1e9);
+	}
+	if (!ok)
+		return 0;
+
+	//  corrupt a byte, validate in odd sized chunks, compare offsets
+
+	if (size > CORRUPT_SIZE)
+		size = CORRUPT_SIZE;
+	for (i = 0;  i < NCORRUPT;  i++) {
+		size_t at = random() % size, chunk = 1 + random() % 100000;
+		unsigned char was = buf[at];
+
+		buf[at] = random();
+		ok = validate(JMSCOTT_UTF8_SCALAR, buf, size, chunk,
+							&scalar_offset);
+		for (simd = JMSCOTT_UTF8_SSE4;  simd <= best;  simd++) {
+			if (validate(simd, buf, size, chunk, &bad_offset) != ok)
+				die2("corrupt: kernel disagrees with scalar",
+						jmscott_utf8_simd_name(simd));
+			if (!ok && bad_offset != scalar_offset)
+				die2("corrupt: bad offset differs from scalar",
+						jmscott_utf8_simd_name(simd));
+		}
+		buf[at] = was;
+	}
+	printf("%d corruptions agree\n", NCORRUPT);
+	return 0;
+}
@@ -17,68 +17,100 @@
  *	being used.  What happens if stdio buffers not flushed, etc?
  */
 
+#include <sys/errno.h>
 #include <unistd.h>
 #include <string.h>
-#include <stdio.h>
 
 #include "jmscott/libjmscott.h"
 
+extern int	errno;
 extern char	*jmscott_progname;
 
 int jmscott_panic_exit_status = 70;	//  EX_SOFTWARE;
 
-void
-jmscott_die(int status, char *msg1)
+/*
+ *  Write "prog: ERROR: msg1: msg2: ...\n" to stderr in a single write().
+ *  An overlong message is truncated, but always ends with a new line.
+ */
+static void
+error_msgs(char **msgs, int nmsg)
 {
-	char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
+	char buf[JMSCOTT_ATOMIC_WRITE_SIZE];
+	struct jmscott_strbuf msg;
+	int i;
 
-        static char ERROR[] = "ERROR: ";
-        static char colon[] = ": ";
-        static char nl[] = "\n";
+	//  reserve a byte for the trailing new line
+	jmscott_strbuf_init(&msg, buf, sizeof buf - 1);
 
-        msg[0] = 0;
 	if (jmscott_progname)
-		jmscott_strcat2(msg, sizeof msg, jmscott_progname, colon);
-	jmscott_strcat3(msg, sizeof msg, ERROR, msg1, nl);
+		jmscott_strbuf_append2(&msg, jmscott_progname, ": ");
+	jmscott_strbuf_append(&msg, "ERROR: ");
+	for (i = 0;  i < nmsg;  i++) {
+		if (i > 0)
+			jmscott_strbuf_append(&msg, ": ");
+		jmscott_strbuf_append(&msg, msgs[i]);
+	}
+	buf[msg.len++] = '\n';
+
+	//  buffered log records precede the error message
+	(void)jmscott_log_flush();
 
-        write(2, msg, strlen(msg));
+	write(2, buf, msg.len);
+}
 
-        _exit(status);
+static void
+die_msgs(int status, char **msgs, int nmsg)
+{
+	error_msgs(msgs, nmsg);
+	_exit(status);
+}
+
+/*
+ *  Synopsis:
+ *	Write the error message of jmscott_die3() without exiting.
+ *  Description:
+ *	The message is at most JMSCOTT_ATOMIC_WRITE_SIZE bytes, written in
+ *	one write(), so threads reporting errors concurrently, say for
+ *	unreadable files, need no lock.  errno is preserved.
+ */
+void
+jmscott_stderr3(char *msg1, char *msg2, char *msg3)
+{
+	char *msgs[] = {msg1, msg2, msg3};
+	int e = errno;
+
+	error_msgs(msgs, 3);
+	errno = e;
+}
+
+void
+jmscott_die(int status, char *msg1)
+{
+	die_msgs(status, &msg1, 1);
 }
 
 void
 jmscott_die2(int status, char *msg1, char *msg2)
 {
-        static char colon[] = ": ";
-        char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
+	char *msgs[] = {msg1, msg2};
 
-        msg[0] = 0;
-	jmscott_strcat3(msg, sizeof msg, msg1, colon, msg2);
-        jmscott_die(status, msg);
+	die_msgs(status, msgs, 2);
 }
 
 void
 jmscott_die3(int status, char *msg1, char *msg2, char *msg3)
 {
-        static char colon[] = ": ";
-        char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
+	char *msgs[] = {msg1, msg2, msg3};
 
-        msg[0] = 0;
-	jmscott_strcat3(msg, sizeof msg, msg1, colon, msg2);
-
-        jmscott_die2(status, msg, msg3);
+	die_msgs(status, msgs, 3);
 }
 
 void
 jmscott_die4(int status, char *msg1, char *msg2, char *msg3, char *msg4)
 {
-        static char colon[] = ": ";
-        char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
-
-        msg[0] = 0;
-	jmscott_strcat3(msg, sizeof msg, msg1, colon, msg2);
+	char *msgs[] = {msg1, msg2, msg3, msg4};
 
-        jmscott_die3(status, msg, msg3, msg4);
+	die_msgs(status, msgs, 4);
 }
 
 void
@@ -90,13 +122,9 @@ jmscott_die5(
 	char *msg4,
 	char *msg5
 ){
-        static char colon[] = ": ";
-        char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
-
-        msg[0] = 0;
-	jmscott_strcat3(msg, sizeof msg, msg1, colon, msg2);
+	char *msgs[] = {msg1, msg2, msg3, msg4, msg5};
 
-        jmscott_die4(status, msg, msg3, msg4, msg5);
+	die_msgs(status, msgs, 5);
 }
 
 void
@@ -109,31 +137,25 @@ jmscott_die6(
 	char *msg5,
 	char *msg6
 ) {
-        static char colon[] = ": ";
-        char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
+	char *msgs[] = {msg1, msg2, msg3, msg4, msg5, msg6};
 
-        msg[0] = 0;
-	jmscott_strcat3(msg, sizeof msg, msg1, colon, msg2);
-
-        jmscott_die5(status, msg, msg3, msg4, msg5, msg6);
+	die_msgs(status, msgs, 6);
 }
 
 void
 jmscott_die_argc(int status, int got, int expect, char *usage)
 {
-	char suffix[54] = {0};
-	char msg[JMSCOTT_ATOMIC_WRITE_SIZE] = {0};
-
-	snprintf(suffix, sizeof suffix, "%d, expected %d: ", got, expect);
-
-	msg[0] = 0;
-	jmscott_strcat4(msg, sizeof msg,
-			"wrong number of cli args: got ",
-			suffix,
-			"\nusage: ",
-			usage
-	);
-	jmscott_die(status, msg);
+	char buf[JMSCOTT_ATOMIC_WRITE_SIZE];
+	struct jmscott_strbuf msg;
+
+	jmscott_strbuf_init(&msg, buf, sizeof buf);
+	jmscott_strbuf_append(&msg, "wrong number of cli args: got ");
+	jmscott_strbuf_append_int(&msg, got);
+	jmscott_strbuf_append(&msg, ", expected ");
+	jmscott_strbuf_append_int(&msg, expect);
+	jmscott_strbuf_append2(&msg, ": \nusage: ", usage);
+
+	jmscott_die(status, buf);
 }
 
 void
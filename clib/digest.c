@@ -0,0 +1,449 @@
+/*
+ *  Synopsis:
+ *	Incremental SHA-256 and BLAKE2b-256 digests, for computing udigs.
+ *  Description:
+ *	A struct jmscott_digest is updated with any number of byte chunks,
+ *	then finalized into a udig, like "sha256:<64 hex chars>".  See
+ *	jmscott_udig_{buf,fd,file}() in udig.c for whole blob digests.
+ *
+ *	SHA-256 uses the x86 SHA extensions (SHA-NI), when the cpu has them,
+ *	chosen at run time, falling back to portable C.  BLAKE2b is portable
+ *	C, which is already quick on 64 bit cpus.
+ *
+ *	The udig algorithm names are:
+ *
+ *		sha256		FIPS 180-4 SHA-256
+ *		blake2b		RFC 7693 BLAKE2b, 256 bit digest, unkeyed
+ *  Note:
+ *	Add BLAKE3, which needs the tree mode and simd kernels of the
+ *	reference implementation to be worth the trouble.
+ *
+ *	SHA-NI intrinsics follow Jeffrey Walton's public domain
+ *
+ *		https://github.com/noloader/SHA-Intrinsics
+ */
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define JMSCOTT_DIGEST_X86	1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "jmscott/libjmscott.h"
+
+typedef unsigned int		u32;
+typedef unsigned long long	u64;
+
+static const u32 sha256_K[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const u32 sha256_IV[8] =
+{
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const u64 blake2b_IV[8] =
+{
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+	0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+	0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+static const unsigned char blake2b_sigma[12][16] =
+{
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+	{ 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+	{  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+	{  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+	{  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+	{ 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+	{ 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+	{  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+	{ 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+};
+
+#define ROR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n)	(((x) >> (n)) | ((x) << (64 - (n))))
+
+static u32
+load_be32(const unsigned char *p)
+{
+	return (u32)p[0] << 24 | (u32)p[1] << 16 | (u32)p[2] << 8 | p[3];
+}
+
+static u64
+load_le64(const unsigned char *p)
+{
+	u64 v;
+
+	memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+/*
+ *  Portable SHA-256 compression of "nblock" 64 byte blocks.
+ */
+static void
+sha256_blocks_c(u32 *h, const unsigned char *p, size_t nblock)
+{
+	u32 w[64];
+	int i;
+
+	while (nblock-- > 0) {
+		for (i = 0;  i < 16;  i++)
+			w[i] = load_be32(p + 4 * i);
+		for (;  i < 64;  i++) {
+			u32 s0 = ROR32(w[i-15], 7) ^ ROR32(w[i-15], 18) ^
+					(w[i-15] >> 3);
+			u32 s1 = ROR32(w[i-2], 17) ^ ROR32(w[i-2], 19) ^
+					(w[i-2] >> 10);
+			w[i] = w[i-16] + s0 + w[i-7] + s1;
+		}
+
+		u32 a = h[0], b = h[1], c = h[2], d = h[3];
+		u32 e = h[4], f = h[5], g = h[6], hh = h[7];
+
+		for (i = 0;  i < 64;  i++) {
+			u32 S1 = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
+			u32 ch = (e & f) ^ (~e & g);
+			u32 t1 = hh + S1 + ch + sha256_K[i] + w[i];
+			u32 S0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
+			u32 maj = (a & b) ^ (a & c) ^ (b & c);
+			u32 t2 = S0 + maj;
+
+			hh = g;  g = f;  f = e;  e = d + t1;
+			d = c;  c = b;  b = a;  a = t1 + t2;
+		}
+		h[0] += a;  h[1] += b;  h[2] += c;  h[3] += d;
+		h[4] += e;  h[5] += f;  h[6] += g;  h[7] += hh;
+		p += 64;
+	}
+}
+
+#ifdef JMSCOTT_DIGEST_X86
+
+/*
+ *  Does the cpu have SHA-NI, plus the SSSE3 and SSE4.1 it depends upon?
+ */
+static int
+have_sha_ni()
+{
+	static int sha_ni = -1;
+	unsigned a, b, c, d;
+
+	if (sha_ni != -1)
+		return sha_ni;
+	sha_ni = 0;
+	if (__get_cpuid(1, &a, &b, &c, &d) &&
+	    (c & bit_SSSE3) && (c & bit_SSE4_1) &&
+	    __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 29)))
+		sha_ni = 1;
+	return sha_ni;
+}
+
+/*
+ *  SHA-256 compression via the SHA-NI round and schedule instructions,
+ *  four rounds per step.  State is kept as ABEF/CDGH, as the
+ *  instructions expect.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void
+sha256_blocks_ni(u32 *h, const unsigned char *p, size_t nblock)
+{
+	const __m128i bswap = _mm_set_epi64x(
+				0x0c0d0e0f08090a0bULL,
+				0x0405060700010203ULL
+	);
+	__m128i state0, state1, tmp, msg, w[16];
+	int i;
+
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)h), 0xB1);
+	state1 = _mm_shuffle_epi32(
+			_mm_loadu_si128((const __m128i *)(h + 4)),
+			0x1B
+	);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);		//  ABEF
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);		//  CDGH
+
+	while (nblock-- > 0) {
+		__m128i abef = state0, cdgh = state1;
+
+		for (i = 0;  i < 16;  i++) {
+			if (i < 4)
+				w[i] = _mm_shuffle_epi8(
+					_mm_loadu_si128(
+						(const __m128i *)(p + 16 * i)
+					),
+					bswap
+				);
+			else
+				w[i] = _mm_sha256msg2_epu32(
+					_mm_add_epi32(
+						_mm_sha256msg1_epu32(
+							w[i - 4],
+							w[i - 3]
+						),
+						_mm_alignr_epi8(
+							w[i - 1],
+							w[i - 2],
+							4
+						)
+					),
+					w[i - 1]
+				);
+			msg = _mm_add_epi32(
+				w[i],
+				_mm_loadu_si128(
+					(const __m128i *)(sha256_K + 4 * i)
+				)
+			);
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0E);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+		p += 64;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);			//  FEBA
+	state1 = _mm_shuffle_epi32(state1, 0xB1);		//  DCHG
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);		//  DCBA
+	state1 = _mm_alignr_epi8(state1, tmp, 8);		//  ABEF
+	_mm_storeu_si128((__m128i *)h, state0);
+	_mm_storeu_si128((__m128i *)(h + 4), state1);
+}
+
+#endif	//  JMSCOTT_DIGEST_X86
+
+static void
+sha256_blocks(u32 *h, const unsigned char *p, size_t nblock)
+{
+#ifdef JMSCOTT_DIGEST_X86
+	if (have_sha_ni()) {
+		sha256_blocks_ni(h, p, nblock);
+		return;
+	}
+#endif
+	sha256_blocks_c(h, p, nblock);
+}
+
+/*
+ *  BLAKE2b compression of one 128 byte block.  "t" is total bytes
+ *  digested, including this block, "last" is set for the final block.
+ */
+static void
+blake2b_block(u64 *h, const unsigned char *p, u64 t, int last)
+{
+	u64 m[16], v[16];
+	int i, r;
+
+	for (i = 0;  i < 16;  i++)
+		m[i] = load_le64(p + 8 * i);
+	for (i = 0;  i < 8;  i++) {
+		v[i] = h[i];
+		v[i + 8] = blake2b_IV[i];
+	}
+	v[12] ^= t;
+	if (last)
+		v[14] = ~v[14];
+
+#define G(a, b, c, d, x, y) {						\
+	v[a] = v[a] + v[b] + (x);	v[d] = ROR64(v[d] ^ v[a], 32);	\
+	v[c] = v[c] + v[d];		v[b] = ROR64(v[b] ^ v[c], 24);	\
+	v[a] = v[a] + v[b] + (y);	v[d] = ROR64(v[d] ^ v[a], 16);	\
+	v[c] = v[c] + v[d];		v[b] = ROR64(v[b] ^ v[c], 63);	\
+}
+	for (r = 0;  r < 12;  r++) {
+		const unsigned char *s = blake2b_sigma[r];
+
+		G(0, 4,  8, 12, m[s[ 0]], m[s[ 1]]);
+		G(1, 5,  9, 13, m[s[ 2]], m[s[ 3]]);
+		G(2, 6, 10, 14, m[s[ 4]], m[s[ 5]]);
+		G(3, 7, 11, 15, m[s[ 6]], m[s[ 7]]);
+		G(0, 5, 10, 15, m[s[ 8]], m[s[ 9]]);
+		G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+		G(2, 7,  8, 13, m[s[12]], m[s[13]]);
+		G(3, 4,  9, 14, m[s[14]], m[s[15]]);
+	}
+#undef G
+	for (i = 0;  i < 8;  i++)
+		h[i] ^= v[i] ^ v[i + 8];
+}
+
+/*
+ *  Synopsis:
+ *	Start a digest for the udig algorithm "sha256" or "blake2b".
+ *  Returns:
+ *	(char *)0	digest ready for jmscott_digest_update()
+ *	(char *)	unknown algorithm
+ */
+char *
+jmscott_digest_init(struct jmscott_digest *d, const char *algo)
+{
+	memset(d, 0, sizeof *d);
+	if (strcmp(algo, "sha256") == 0) {
+		d->algo = JMSCOTT_DIGEST_SHA256;
+		memcpy(d->h.sha256, sha256_IV, sizeof sha256_IV);
+	} else if (strcmp(algo, "blake2b") == 0) {
+		d->algo = JMSCOTT_DIGEST_BLAKE2B;
+		memcpy(d->h.blake2b, blake2b_IV, sizeof blake2b_IV);
+
+		//  parameter block: 32 byte digest, no key, fanout/depth 1
+		d->h.blake2b[0] ^= 0x01010000 ^ 32;
+	} else
+		return "unknown digest algorithm";
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Digest the next "len" bytes.
+ */
+void
+jmscott_digest_update(struct jmscott_digest *d, const void *src, size_t len)
+{
+	const unsigned char *p = src;
+
+	if (d->algo == JMSCOTT_DIGEST_SHA256) {
+		d->length += len;
+		if (d->nbuf > 0) {
+			size_t n = 64 - d->nbuf;
+
+			if (n > len)
+				n = len;
+			memcpy(d->block + d->nbuf, p, n);
+			d->nbuf += n;
+			p += n;
+			len -= n;
+			if (d->nbuf < 64)
+				return;
+			sha256_blocks(d->h.sha256, d->block, 1);
+			d->nbuf = 0;
+		}
+		if (len >= 64) {
+			sha256_blocks(d->h.sha256, p, len / 64);
+			p += len & ~(size_t)63;
+			len &= 63;
+		}
+		memcpy(d->block, p, len);
+		d->nbuf = len;
+		return;
+	}
+
+	/*
+	 *  BLAKE2b must hold back the final block, even when full, since the
+	 *  last block is compressed with the final flag.
+	 */
+	while (len > 0) {
+		if (d->nbuf == 128) {
+			d->length += 128;
+			blake2b_block(d->h.blake2b, d->block, d->length, 0);
+			d->nbuf = 0;
+		}
+		if (d->nbuf == 0 && len > 128) {
+			d->length += 128;
+			blake2b_block(d->h.blake2b, p, d->length, 0);
+			p += 128;
+			len -= 128;
+			continue;
+		}
+		size_t n = 128 - d->nbuf;
+		if (n > len)
+			n = len;
+		memcpy(d->block + d->nbuf, p, n);
+		d->nbuf += n;
+		p += n;
+		len -= n;
+	}
+}
+
+/*
+ *  Synopsis:
+ *	Finish the digest, writing the udig "<algo>:<hex digest>".
+ *  Returns:
+ *	(char *)0	udig written and null terminated
+ *	(char *)	udig buffer too small, digest untouched
+ *  Note:
+ *	The digest is consumed.  Call jmscott_digest_init() to reuse.
+ */
+char *
+jmscott_digest_udig(struct jmscott_digest *d, char *udig, size_t udig_size)
+{
+	static const char hex[] = "0123456789abcdef";
+	unsigned char sum[32];
+	const char *algo;
+	int i;
+
+	if (d->algo == JMSCOTT_DIGEST_SHA256)
+		algo = "sha256:";
+	else if (d->algo == JMSCOTT_DIGEST_BLAKE2B)
+		algo = "blake2b:";
+	else
+		return "digest not initialized";
+
+	//  check before padding, so a short buffer leaves the digest intact
+
+	size_t alen = strlen(algo);
+	if (udig_size < alen + 64 + 1)
+		return "udig buffer too small";
+
+	if (d->algo == JMSCOTT_DIGEST_SHA256) {
+		u64 bits = d->length * 8;
+
+		d->block[d->nbuf++] = 0x80;
+		if (d->nbuf > 56) {
+			memset(d->block + d->nbuf, 0, 64 - d->nbuf);
+			sha256_blocks(d->h.sha256, d->block, 1);
+			d->nbuf = 0;
+		}
+		memset(d->block + d->nbuf, 0, 56 - d->nbuf);
+		for (i = 0;  i < 8;  i++)
+			d->block[56 + i] = bits >> (56 - 8 * i);
+		sha256_blocks(d->h.sha256, d->block, 1);
+		for (i = 0;  i < 32;  i++)
+			sum[i] = d->h.sha256[i / 4] >> (24 - 8 * (i % 4));
+	} else {
+		d->length += d->nbuf;
+		memset(d->block + d->nbuf, 0, 128 - d->nbuf);
+		blake2b_block(d->h.blake2b, d->block, d->length, 1);
+		for (i = 0;  i < 32;  i++)
+			sum[i] = d->h.blake2b[i / 8] >> (8 * (i % 8));
+	}
+	memcpy(udig, algo, alen);
+
+	char *u = udig + alen;
+	for (i = 0;  i < 32;  i++) {
+		*u++ = hex[sum[i] >> 4];
+		*u++ = hex[sum[i] & 0x0f];
+	}
+	*u = 0;
+	d->algo = 0;
+	return (char *)0;
+}
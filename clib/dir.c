@@ -2,10 +2,23 @@
  *  Synopsis:
  *	Various helpful functions for posix direcotry manipulation.
  */
+#ifdef __linux__
+#define _GNU_SOURCE		//  statx()
+#endif
+
 #include <sys/errno.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+#include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "jmscott/libjmscott.h"
 
@@ -25,6 +38,11 @@
  *	describing the error in english.  Modes/ownership of existing
  *	directories are not changed.
  *
+ *
+ *	A full path that already exists costs a single mkdirat().  Writers
+ *	creating many paths under the same tree should instead use a
+ *	struct jmscott_dir_cache, which costs no system calls once a
+ *	directory is known.
  *  Note:
  *	Escaped forward and contiguous slashes cause an error, which is a bug.
  */
@@ -51,6 +69,13 @@ jmscott_mkdirat_path(int at_fd, char *child_path, mode_t mode)
 		p[-1] = 0;
 	p = path;
 
+	//  typically the full path exists, so one mkdirat() is enough
+
+	if (jmscott_mkdirat_EEXIST(at_fd, path, mode) == 0)
+		return (char *)0;
+	if (errno != ENOENT)
+		DEFER;
+
 	char *slash;
 
 	while ((slash = strchr(p, '/'))) {
@@ -75,52 +100,1198 @@ jmscott_mkdirat_EEXIST(int at_fd, const char *path, mode_t mode)
 	return 0;
 }
 
-//  Note: rewrite using jmscott_halloc() memory allocator!
+/*
+ *  Directory cache for jmscott_dir_cache_mkdir().
+ *
+ *  An open addressed hash table maps each created path prefix, like "a",
+ *  "a/b" and "a/b/c", to an O_PATH descriptor of the directory, or -1
+ *  when c->max_open descriptors are already held.  Prefixes are stored
+ *  null terminated in the one block c->names, so the slots are only
+ *  offsets.
+ */
+#ifdef O_PATH
+#define DIR_CACHE_OPEN	(O_PATH | O_DIRECTORY | O_CLOEXEC)
+#else
+#define DIR_CACHE_OPEN	(O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+#endif
+
+static unsigned int
+dir_cache_hash(const char *path, size_t len)
+{
+	unsigned int h = 2166136261U;		//  FNV-1a
+
+	while (len-- > 0) {
+		h ^= (unsigned char)*path++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static struct jmscott_dir_cache_slot *
+dir_cache_find(
+	struct jmscott_dir_cache *c,
+	const char *path,
+	size_t len,
+	unsigned int hash
+){
+	unsigned int i = hash & (c->nslot - 1);
+	struct jmscott_dir_cache_slot *sp;
+
+	while ((sp = &c->slots[i])->len > 0) {
+		if (sp->hash == hash && sp->len == len &&
+		    memcmp(c->names + sp->name, path, len) == 0)
+			return sp;
+		i = (i + 1) & (c->nslot - 1);
+	}
+	return (struct jmscott_dir_cache_slot *)0;
+}
+
+/*
+ *  Double the slots when 3/4 full, rehashing from the stored hashes.
+ */
+static char *
+dir_cache_grow(struct jmscott_dir_cache *c)
+{
+	struct jmscott_dir_cache_slot *old = c->slots, *slots;
+	unsigned int i, nslot = c->nslot * 2;
+
+	if (nslot == 0)
+		return "dir cache > 2^31 directories";
+	slots = jmscott_halloc(c->names, nslot * sizeof *slots);
+	if (!slots)
+		return "halloc(slots) failed: out of memory";
+	memset(slots, 0, nslot * sizeof *slots);
+	for (i = 0;  i < c->nslot;  i++) {
+		unsigned int j;
+
+		if (old[i].len == 0)
+			continue;
+		j = old[i].hash & (nslot - 1);
+		while (slots[j].len > 0)
+			j = (j + 1) & (nslot - 1);
+		slots[j] = old[i];
+	}
+	jmscott_halloc_free(old);
+	c->slots = slots;
+	c->nslot = nslot;
+	return (char *)0;
+}
+
+static char *
+dir_cache_add(
+	struct jmscott_dir_cache *c,
+	const char *path,
+	size_t len,
+	unsigned int hash,
+	int fd
+){
+	struct jmscott_dir_cache_slot *sp;
+	unsigned int i;
+	char *err;
+
+	if ((c->count + 1) * 4 > c->nslot * 3 && (err = dir_cache_grow(c)))
+		return err;
+	if (c->names_len + len + 1 > c->names_size) {
+		size_t size = c->names_size;
+		char *names;
+
+		while (c->names_len + len + 1 > size)
+			size *= 2;
+		if (size > 0xFFFFFFFF)
+			return "dir cache names > 4GB";
+		names = jmscott_halloc_resize(c->names, size);
+		if (!names)
+			return "halloc_resize(names) failed: out of memory";
+		c->names = names;
+		c->names_size = size;
+	}
+	i = hash & (c->nslot - 1);
+	while (c->slots[i].len > 0)
+		i = (i + 1) & (c->nslot - 1);
+	sp = &c->slots[i];
+	sp->hash = hash;
+	sp->name = c->names_len;
+	sp->len = len;
+	sp->fd = fd;
+	memcpy(c->names + c->names_len, path, len);
+	c->names[c->names_len + len] = 0;
+	c->names_len += len + 1;
+	c->count++;
+	if (fd >= 0)
+		c->nopen++;
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Start an empty cache of directories created under "at_fd".
+ *  Description:
+ *	Directories are created with "mode".  At most "max_open" O_PATH
+ *	descriptors are held open, 0 for none; choose well below
+ *	RLIMIT_NOFILE.  The cache is a halloc()ed child of "parent".
+ *	Not thread safe; use one cache per thread.
+ *  Returns:
+ *	(char *)0	cache ready
+ *	(char *)	out of memory
+ */
+char *
+jmscott_dir_cache_init(
+	struct jmscott_dir_cache *c,
+	void *parent,
+	int at_fd,
+	mode_t mode,
+	int max_open
+){
+	memset(c, 0, sizeof *c);
+	c->at_fd = at_fd;
+	c->mode = mode;
+	c->max_open = max_open;
+	c->names_size = 4096;
+	c->names = jmscott_halloc(parent, c->names_size);
+	if (!c->names)
+		return "halloc(names) failed: out of memory";
+	c->nslot = 64;
+	c->slots = jmscott_halloc(c->names, c->nslot * sizeof *c->slots);
+	if (!c->slots) {
+		jmscott_halloc_free(c->names);
+		c->names = (char *)0;
+		return "halloc(slots) failed: out of memory";
+	}
+	memset(c->slots, 0, c->nslot * sizeof *c->slots);
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Make all directories in "path", relative to c->at_fd, like mkdir -p.
+ *  Description:
+ *	A path already made through the cache costs no system calls.
+ *	Otherwise, each missing component is made with one mkdirat()
+ *	relative to the longest cached prefix, then opened O_PATH, so
+ *	creating "spool/ab/cd" after "spool/ab" is a mkdirat() of "cd" in
+ *	the open "spool/ab".
+ *
+ *	When "dir_fd" is not null, it is set to the cached descriptor of
+ *	the directory, for openat() of entries, or -1 when no descriptor
+ *	is held, in which case open the full path relative to c->at_fd.
+ *
+ *	Directories removed behind the back of the cache are not noticed;
+ *	call jmscott_dir_cache_clear() after removing any.
+ *  Returns:
+ *	(char *)0	all directories exist
+ *	(char *)	error in english, typically strerror(errno)
+ *  Note:
+ *	Like jmscott_mkdirat_path(), contiguous slashes are rejected.
+ */
+char *
+jmscott_dir_cache_mkdir(
+	struct jmscott_dir_cache *c,
+	const char *path,
+	int *dir_fd
+){
+	struct jmscott_dir_cache_slot *sp = (struct jmscott_dir_cache_slot *)0;
+	size_t len = strlen(path), at;
+	char prefix[JMSCOTT_PATH_MAX + 1];
+	int parent_fd;
+	char *err;
+
+	if (dir_fd)
+		*dir_fd = -1;
+	while (len > 1 && path[len - 1] == '/')
+		len--;
+	if (len == 0)
+		return (char *)0;
+	if (len > JMSCOTT_PATH_MAX)
+		return "directory path too long";
+
+	//  the whole path, then each shorter prefix, until cached
+
+	for (at = len;  at > 0;  ) {
+		sp = dir_cache_find(c, path, at, dir_cache_hash(path, at));
+		if (sp)
+			break;
+		while (--at > 0 && path[at] != '/')
+			;
+	}
+	c->nhit += (at == len);
+	if (at == len) {
+		if (dir_fd)
+			*dir_fd = sp->fd;
+		return (char *)0;
+	}
+	if (memmem(path, len, "//", 2))
+		return "directory path contains contiguous //";
+
+	memcpy(prefix, path, len);
+	prefix[len] = 0;
+	parent_fd = sp ? sp->fd : -1;
+	if (at > 0 || path[0] == '/')
+		at++;
+
+	//  make each missing component, relative to the open parent if any
+
+	while (at < len) {
+		size_t end = at;
+		const char *name;
+		int fd = -1, exists = 0;
+		int mk_fd = parent_fd >= 0 ? parent_fd : c->at_fd;
+
+		while (end < len && prefix[end] != '/')
+			end++;
+		prefix[end] = 0;
+		name = parent_fd >= 0 ? prefix + at : prefix;
+
+		c->nmkdir++;
+		if (jmscott_mkdirat(mk_fd, name, c->mode) < 0) {
+			if (errno != EEXIST)
+				return strerror(errno);
+			exists = 1;
+		}
+
+		//  O_DIRECTORY rejects an existing non directory, else stat
+
+		if (c->nopen < c->max_open) {
+			fd = jmscott_openat(mk_fd, (char *)name, DIR_CACHE_OPEN, 0);
+			if (fd < 0)
+				return strerror(errno);
+		} else if (exists) {
+			struct stat st;
+
+			if (jmscott_fstatat(mk_fd, name, &st, 0))
+				return strerror(errno);
+			if (!S_ISDIR(st.st_mode))
+				return strerror(ENOTDIR);
+		}
+		if ((err = dir_cache_add(
+			c,
+			prefix,
+			end,
+			dir_cache_hash(prefix, end),
+			fd
+		))) {
+			if (fd >= 0)
+				jmscott_close(fd);
+			return err;
+		}
+		parent_fd = fd;
+		if (end < len)
+			prefix[end] = '/';
+		at = end + 1;
+	}
+	if (dir_fd)
+		*dir_fd = parent_fd;
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Open a file, first making the parent directories through the cache.
+ *  Description:
+ *	The file is opened via openat() relative to the cached descriptor of
+ *	the parent directory, so the kernel resolves only the last component.
+ *	A cached parent that has vanished, seen as ENOENT, clears the cache
+ *	and the open is tried once more.
+ *  Returns:
+ *	(char *)0	file open on *fd
+ *	(char *)	error in english, typically strerror(errno)
+ */
+char *
+jmscott_dir_cache_open(
+	struct jmscott_dir_cache *c,
+	const char *path,
+	int oflag,
+	mode_t mode,
+	int *fd
+){
+	char dir[JMSCOTT_PATH_MAX + 1];
+	const char *slash = strrchr(path, '/');
+	int dir_fd, retry = 1;
+	char *err;
+
+	if (!slash || slash == path) {
+		*fd = jmscott_openat(c->at_fd, (char *)path, oflag, mode);
+		return *fd < 0 ? strerror(errno) : (char *)0;
+	}
+	if ((size_t)(slash - path) > JMSCOTT_PATH_MAX)
+		return "directory path too long";
+	memcpy(dir, path, slash - path);
+	dir[slash - path] = 0;
+AGAIN:
+	if ((err = jmscott_dir_cache_mkdir(c, dir, &dir_fd)))
+		return err;
+	if (dir_fd >= 0)
+		*fd = jmscott_openat(dir_fd, (char *)slash + 1, oflag, mode);
+	else
+		*fd = jmscott_openat(c->at_fd, (char *)path, oflag, mode);
+	if (*fd >= 0)
+		return (char *)0;
+	if (errno == ENOENT && retry-- > 0) {
+		jmscott_dir_cache_clear(c);
+		goto AGAIN;
+	}
+	return strerror(errno);
+}
+
+/*
+ *  Synopsis:
+ *	Forget all cached directories, closing the O_PATH descriptors.
+ */
+void
+jmscott_dir_cache_clear(struct jmscott_dir_cache *c)
+{
+	unsigned int i;
+
+	for (i = 0;  i < c->nslot;  i++)
+		if (c->slots[i].len > 0 && c->slots[i].fd >= 0)
+			jmscott_close(c->slots[i].fd);
+	memset(c->slots, 0, c->nslot * sizeof *c->slots);
+	c->count = 0;
+	c->nopen = 0;
+	c->names_len = 0;
+}
+
+/*
+ *  Synopsis:
+ *	Clear the cache and free the memory.
+ */
+void
+jmscott_dir_cache_free(struct jmscott_dir_cache *c)
+{
+	if (!c->names)
+		return;
+	jmscott_dir_cache_clear(c);
+	jmscott_halloc_free(c->names);
+	memset(c, 0, sizeof *c);
+}
+
+#define GETDENTS_SIZE	(256 * 1024)
+
+/*
+ *  Append one entry, doubling the names and entries blocks when full.
+ */
+static char *
+scan_add(
+	struct jmscott_dir_scan *scan,
+	size_t *names_size,
+	size_t *entries_size,
+	size_t *names_len,
+	const char *name,
+	unsigned long long ino,
+	unsigned char type
+){
+	size_t len = strlen(name) + 1;
+
+	if (*names_len + len > *names_size) {
+		size_t size = *names_size;
+		char *names;
+
+		while (*names_len + len > size)
+			size *= 2;
+		if (size > 0xFFFFFFFF)
+			return "dir entry names > 4GB";
+		names = jmscott_halloc_resize(scan->names, size);
+		if (!names)
+			return "halloc_resize(names) failed: out of memory";
+		scan->names = names;
+		*names_size = size;
+	}
+	if ((size_t)scan->count == *entries_size) {
+		struct jmscott_dir_entry *entries;
+
+		if (*entries_size >= 0x3FFFFFFF)
+			return "dir entry count > 2^30";
+		entries = jmscott_halloc_resize(
+				scan->entries,
+				*entries_size * 2 * sizeof *entries
+		);
+		if (!entries)
+			return "halloc_resize(entries) failed: out of memory";
+		scan->entries = entries;
+		*entries_size *= 2;
+	}
+
+	struct jmscott_dir_entry *ep = &scan->entries[scan->count++];
+	ep->ino = ino;
+	ep->name = *names_len;
+	ep->type = type;
+	memcpy(scan->names + *names_len, name, len);
+	*names_len += len;
+	return (char *)0;
+}
+
+/*
+ *  Iterate the entries of an open directory, skipping "." and "..", via
+ *  getdents64() on linux, readdir() elsewhere.
+ */
+struct dir_iter
+{
+#ifdef __linux__
+	int		fd;
+	char		*buf;
+	size_t		size;
+	ssize_t		nr;
+	ssize_t		off;
+#else
+	DIR		*dp;
+#endif
+};
+
+#ifdef __linux__
+
+struct linux_dirent64
+{
+	unsigned long long	d_ino;
+	long long		d_off;
+	unsigned short		d_reclen;
+	unsigned char		d_type;
+	char			d_name[];
+};
+
+#endif
+
+/*
+ *  Start reading directory "fd" from the first entry, through a buffer of
+ *  "size" bytes.  The fd is not closed by dir_iter_close().
+ */
+static char *
+dir_iter_open(struct dir_iter *it, int fd, size_t size)
+{
+	if (jmscott_lseek(fd, (off_t)0, SEEK_SET) < 0)
+		return strerror(errno);
+#ifdef __linux__
+	it->fd = fd;
+	it->size = size;
+	it->nr = it->off = 0;
+	if (!(it->buf = malloc(size)))
+		return "malloc(getdents) failed: out of memory";
+#else
+	int dup_fd = dup(fd);
+
+	(void)size;
+	if (dup_fd < 0)
+		return strerror(errno);
+	if (!(it->dp = fdopendir(dup_fd))) {
+		char *err = strerror(errno);
+
+		close(dup_fd);
+		return err;
+	}
+	rewinddir(it->dp);
+#endif
+	return (char *)0;
+}
+
+/*
+ *  Next entry.  Returns 1 for an entry, 0 at end, -1 for error in errno.
+ */
+static int
+dir_iter_next(
+	struct dir_iter *it,
+	const char **name,
+	unsigned char *type,
+	unsigned long long *ino
+){
+	const char *n;
+
+	for (;;) {
+#ifdef __linux__
+		if (it->off >= it->nr) {
+AGAIN:
+			it->nr = syscall(SYS_getdents64, it->fd, it->buf, it->size);
+			if (it->nr < 0) {
+				if (errno == EINTR)
+					goto AGAIN;
+				return -1;
+			}
+			if (it->nr == 0)
+				return 0;
+			it->off = 0;
+		}
+
+		struct linux_dirent64 *dp = (void *)(it->buf + it->off);
+
+		it->off += dp->d_reclen;
+		n = dp->d_name;
+		*type = dp->d_type;
+		*ino = dp->d_ino;
+#else
+		struct dirent *ep;
+
+		errno = 0;
+		if (!(ep = jmscott_readdir(it->dp)))
+			return errno > 0 ? -1 : 0;
+		n = ep->d_name;
+		*type = ep->d_type;
+		*ino = ep->d_ino;
+#endif
+		if (n[0] == '.' && (n[1] == 0 || (n[1] == '.' && n[2] == 0)))
+			continue;
+		*name = n;
+		return 1;
+	}
+}
+
+static void
+dir_iter_close(struct dir_iter *it)
+{
+#ifdef __linux__
+	free(it->buf);
+	it->buf = (char *)0;
+#else
+	if (it->dp)
+		jmscott_closedir(it->dp);
+	it->dp = (DIR *)0;
+#endif
+}
+
+/*
+ *  Synopsis:
+ *	Scan all entries of a directory, except "." and "..", into one block.
+ *  Description:
+ *	The directory open on "dir_fd" is read from the start, via
+ *	getdents64() into a 256KB buffer on linux, or readdir() elsewhere.
+ *	Names are stored null terminated and contiguous in the halloc()ed
+ *	block scan->names, a child of "parent", and indexed by the array
+ *	scan->entries, a child of scan->names, so
+ *
+ *		jmscott_halloc_free(scan->names)
+ *
+ *	frees the whole scan.  The name of entry i is
+ *
+ *		JMSCOTT_DIR_ENTRY_NAME(scan, i)
+ *
+ *	Each entry carries the inode and d_type, DT_UNKNOWN on file systems
+ *	that do not report types, so callers may skip most fstatat()s.
+ *
+ *	The optional filter is called for each entry: > 0 keeps the entry,
+ *	0 skips it, < 0 aborts the scan.
+ *  Returns:
+ *	(char *)0	scan complete, scan->count entries
+ *	(char *)	error, nothing left allocated
+ */
 char *
 jmscott_scan_dir(
-	DIR *dp,
-	int (*filter)(struct dirent *),
-	char ***entries,
-	int *ent_count
-) {
-	int ent_size = 256;
-	struct dirent *ep;
-	int ec = 0;
-
-	*entries = 0;
-	char **entp = (char **)malloc(ent_size * sizeof *entries
-	);
-	if (!entp)
-		return "malloc(entries) failed: out of memory";
+	int dir_fd,
+	int (*filter)(const char *name, unsigned char d_type, void *private),
+	void *private,
+	void *parent,
+	struct jmscott_dir_scan *scan
+){
+	size_t names_size = 64 * 1024, entries_size = 1024, names_len = 0;
+	struct dir_iter it;
+	const char *name;
+	unsigned char type;
+	unsigned long long ino;
+	char *err;
+	int status;
 
-	//  posix manual on readdir ambiguous about errno 
-	errno = 0;
-	while ((ep = jmscott_readdir(dp))) {
+	memset(scan, 0, sizeof *scan);
+	if ((err = dir_iter_open(&it, dir_fd, GETDENTS_SIZE)))
+		return err;
+
+	scan->names = jmscott_halloc(parent, names_size);
+	if (!scan->names) {
+		err = "halloc(names) failed: out of memory";
+		goto BYE;
+	}
+	scan->entries = jmscott_halloc(
+				scan->names,
+				entries_size * sizeof *scan->entries
+	);
+	if (!scan->entries) {
+		err = "halloc(entries) failed: out of memory";
+		goto BYE;
+	}
+	while ((status = dir_iter_next(&it, &name, &type, &ino)) > 0) {
 		if (filter) {
-			int status = (*filter)(ep);
-			if (status < 0)
-				return "dir entry filter < 0";
-			if (status == 0)
+			int keep = (*filter)(name, type, private);
+
+			if (keep < 0) {
+				err = "dir entry filter < 0";
+				goto BYE;
+			}
+			if (keep == 0)
 				continue;
 		}
-		ec++;
-		if (ec > ent_size) {
-			ent_size *= 2;
-			entp = (char **)realloc(
-						entp,
-						ent_size * sizeof *entries
+		err = scan_add(
+			scan,
+			&names_size,
+			&entries_size,
+			&names_len,
+			name,
+			ino,
+			type
+		);
+		if (err)
+			goto BYE;
+	}
+	if (status < 0)
+		err = strerror(errno);
+BYE:
+	dir_iter_close(&it);
+	if (err) {
+		if (scan->names)
+			jmscott_halloc_free(scan->names);
+		memset(scan, 0, sizeof *scan);
+	}
+	return err;
+}
+
+/*
+ *  Parallel tree walk.
+ *
+ *  Each thread owns a queue of directories still to read.  A thread pushes
+ *  the sub directories it finds onto the tail of its own queue and pops
+ *  from the tail, so walks depth first through hot inodes.  An idle thread
+ *  steals from the head of another queue, taking the oldest, typically
+ *  largest, sub tree.  The walk ends when no directory is queued or being
+ *  read.
+ */
+#define WALK_GETDENTS_SIZE	(64 * 1024)
+#define WALK_MAX_QUEUED_FD	256
+#define WALK_PATH_MAX		4096
+
+struct walk_dir
+{
+	char		*path;
+	size_t		path_len;
+	int		fd;		//  opened by parent, or -1
+	int		depth;
+};
+
+struct walk_queue
+{
+	pthread_mutex_t		mutex;
+	struct walk_dir		*dirs;		//  ring of "size" slots
+	size_t			head;
+	size_t			count;
+	size_t			size;
+};
+
+struct walk_state
+{
+	struct jmscott_walk	*walk;
+	struct walk_queue	*queues;
+	int			nthread;
+	dev_t			root_dev;
+
+	long			pending;	//  dirs queued or being read
+	int			queued_fd;	//  open fds waiting in queues
+	int			abort;
+
+	pthread_mutex_t		err_mutex;
+	char			*err;
+};
+
+struct walk_thread
+{
+	struct walk_state	*state;
+	int			thread;
+	pthread_t		id;
+	char			path[WALK_PATH_MAX];
+};
+
+static int
+walk_push(struct walk_queue *q, struct walk_dir *d)
+{
+	pthread_mutex_lock(&q->mutex);
+	if (q->count == q->size) {
+		size_t size = q->size ? q->size * 2 : 64, i;
+		struct walk_dir *dirs = malloc(size * sizeof *dirs);
+
+		if (!dirs) {
+			pthread_mutex_unlock(&q->mutex);
+			return -1;
+		}
+		for (i = 0;  i < q->count;  i++)
+			dirs[i] = q->dirs[(q->head + i) % q->size];
+		free(q->dirs);
+		q->dirs = dirs;
+		q->head = 0;
+		q->size = size;
+	}
+	q->dirs[(q->head + q->count++) % q->size] = *d;
+	pthread_mutex_unlock(&q->mutex);
+	return 0;
+}
+
+/*
+ *  Pop from the tail of our own queue, or steal from the head of another.
+ */
+static int
+walk_pop(struct walk_queue *q, struct walk_dir *d, int steal)
+{
+	int got = 0;
+
+	pthread_mutex_lock(&q->mutex);
+	if (q->count > 0) {
+		if (steal) {
+			*d = q->dirs[q->head];
+			q->head = (q->head + 1) % q->size;
+		} else
+			*d = q->dirs[(q->head + q->count - 1) % q->size];
+		q->count--;
+		got = 1;
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return got;
+}
+
+/*
+ *  Abort the walk, keeping the first error.
+ */
+static void
+walk_abort(struct walk_state *s, char *err)
+{
+	pthread_mutex_lock(&s->err_mutex);
+	if (!s->err)
+		s->err = err;
+	pthread_mutex_unlock(&s->err_mutex);
+	__atomic_store_n(&s->abort, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ *  Report an error on a path.  With no on_error callback, or when the
+ *  callback returns < 0, the walk aborts with the first error.
+ */
+static void
+walk_error(struct walk_state *s, const char *path, char *err)
+{
+	struct jmscott_walk *w = s->walk;
+
+	__atomic_add_fetch(&w->nerror, 1, __ATOMIC_RELAXED);
+	if (w->on_error && (*w->on_error)(path, err, w->private) >= 0)
+		return;
+	walk_abort(s, err);
+}
+
+/*
+ *  Stat an entry, via statx() of only the requested fields, when asked
+ *  and available.
+ */
+static int
+walk_stat(struct jmscott_walk *w, int dir_fd, const char *name, struct stat *st)
+{
+#if defined(__linux__) && defined(STATX_TYPE)
+	if (w->statx_mask) {
+		struct statx stx;
+		int flags = AT_SYMLINK_NOFOLLOW;
+
+		if (w->statx_dont_sync)
+			flags |= AT_STATX_DONT_SYNC;
+		if (statx(dir_fd, name, flags, w->statx_mask|STATX_TYPE, &stx))
+			return -1;
+		memset(st, 0, sizeof *st);
+		st->st_mode = stx.stx_mode;
+		st->st_ino = stx.stx_ino;
+		st->st_nlink = stx.stx_nlink;
+		st->st_uid = stx.stx_uid;
+		st->st_gid = stx.stx_gid;
+		st->st_size = stx.stx_size;
+		st->st_blocks = stx.stx_blocks;
+		st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+		st->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+		st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+		st->st_atim.tv_sec = stx.stx_atime.tv_sec;
+		st->st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+		st->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+		st->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+		return 0;
+	}
+#endif
+	return jmscott_fstatat(dir_fd, name, st, AT_SYMLINK_NOFOLLOW);
+}
+
+static unsigned char
+mode2type(mode_t mode)
+{
+	switch (mode & S_IFMT) {
+	case S_IFREG:	return DT_REG;
+	case S_IFDIR:	return DT_DIR;
+	case S_IFLNK:	return DT_LNK;
+	case S_IFIFO:	return DT_FIFO;
+	case S_IFSOCK:	return DT_SOCK;
+	case S_IFCHR:	return DT_CHR;
+	case S_IFBLK:	return DT_BLK;
+	}
+	return DT_UNKNOWN;
+}
+
+/*
+ *  Filter and visit one entry.  Returns 1 to descend into a directory,
+ *  0 not to.  A filter or callback < 0 aborts the walk, bypassing
+ *  on_error, which sees only errors on paths.
+ */
+static int
+walk_visit(struct walk_state *s, struct jmscott_walk_entry *e)
+{
+	struct jmscott_walk *w = s->walk;
+	int status;
+
+	if (w->stat || w->statx_mask || e->type == DT_UNKNOWN) {
+		if (walk_stat(w, e->dir_fd, e->name, &e->st) < 0) {
+			walk_error(s, e->path, strerror(errno));
+			return 0;
+		}
+		e->have_stat = 1;
+		e->type = mode2type(e->st.st_mode);
+	}
+	__atomic_add_fetch(&w->nentry, 1, __ATOMIC_RELAXED);
+	if (w->filter) {
+		if ((status = (*w->filter)(e, w->private)) < 0) {
+			walk_abort(s, "walk aborted by filter");
+			return 0;
+		}
+		if (status == 0)
+			return 0;
+	}
+	if (w->callback && (*w->callback)(e, w->private) < 0) {
+		walk_abort(s, "walk aborted by callback");
+		return 0;
+	}
+	return e->type == DT_DIR && (w->max_depth == 0 ||
+						e->depth < w->max_depth);
+}
+
+/*
+ *  Queue a sub directory found in the open directory "dir_fd".  The
+ *  directory is opened now, relative to its parent, unless too many fds
+ *  already wait in the queues, then reopened later by path.
+ */
+static void
+walk_queue_dir(
+	struct walk_thread *t,
+	int dir_fd,
+	struct jmscott_walk_entry *e
+){
+	struct walk_state *s = t->state;
+	struct walk_dir d;
+
+	d.fd = -1;
+	d.depth = e->depth;
+	if (__atomic_add_fetch(&s->queued_fd, 1, __ATOMIC_RELAXED) <=
+							WALK_MAX_QUEUED_FD) {
+		d.fd = jmscott_openat(
+				dir_fd,
+				(char *)e->name,
+				O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC,
+				0
+		);
+		if (d.fd < 0) {
+			__atomic_sub_fetch(&s->queued_fd, 1, __ATOMIC_RELAXED);
+			walk_error(s, e->path, strerror(errno));
+			return;
+		}
+	} else
+		__atomic_sub_fetch(&s->queued_fd, 1, __ATOMIC_RELAXED);
+
+	if (!(d.path = malloc(e->path_len + 1))) {
+		walk_error(s, e->path, "malloc(path) failed: out of memory");
+		if (d.fd >= 0)
+			close(d.fd);
+		return;
+	}
+	memcpy(d.path, e->path, e->path_len + 1);
+	d.path_len = e->path_len;
+
+	__atomic_add_fetch(&s->pending, 1, __ATOMIC_RELAXED);
+	if (walk_push(&s->queues[t->thread], &d) < 0) {
+		__atomic_sub_fetch(&s->pending, 1, __ATOMIC_RELAXED);
+		walk_error(s, e->path, "malloc(queue) failed: out of memory");
+		free(d.path);
+		if (d.fd >= 0)
+			close(d.fd);
+	}
+}
+
+/*
+ *  Read one directory, visiting each entry and queueing sub directories.
+ */
+static void
+walk_dir(struct walk_thread *t, struct walk_dir *d, char *buf)
+{
+	struct walk_state *s = t->state;
+	struct jmscott_walk_entry e;
+	struct dir_iter it;
+	const char *name;
+	unsigned long long ino;
+	int fd = d->fd, status = 0;
+
+	if (fd >= 0)
+		__atomic_sub_fetch(&s->queued_fd, 1, __ATOMIC_RELAXED);
+	else {
+		fd = jmscott_open(
+			d->path,
+			O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC,
+			0
+		);
+		if (fd < 0) {
+			walk_error(s, d->path, strerror(errno));
+			return;
+		}
+	}
+	if (s->walk->one_file_system) {
+		struct stat st;
+
+		if (jmscott_fstat(fd, &st) < 0) {
+			walk_error(s, d->path, strerror(errno));
+			goto BYE;
+		}
+		if (st.st_dev != s->root_dev)
+			goto BYE;
+	}
+
+#ifdef __linux__
+	it.fd = fd;
+	it.buf = buf;
+	it.size = WALK_GETDENTS_SIZE;
+	it.nr = it.off = 0;
+#else
+	char *err;
+
+	(void)buf;
+	if ((err = dir_iter_open(&it, fd, 0))) {
+		walk_error(s, d->path, err);
+		goto BYE;
+	}
+#endif
+
+	//  child paths are "<dir>/<name>", built in the thread's buffer
+
+	memcpy(t->path, d->path, d->path_len);
+	size_t dir_len = d->path_len;
+	if (dir_len == 0 || t->path[dir_len - 1] != '/')
+		t->path[dir_len++] = '/';
+
+	while (!__atomic_load_n(&s->abort, __ATOMIC_RELAXED) &&
+	       (status = dir_iter_next(&it, &name, &e.type, &ino)) > 0) {
+		size_t len = strlen(name);
+
+		if (dir_len + len + 1 > sizeof t->path) {
+			t->path[dir_len] = 0;
+			walk_error(s, t->path, "path too long");
+			continue;
+		}
+		memcpy(t->path + dir_len, name, len + 1);
+		e.path = t->path;
+		e.path_len = dir_len + len;
+		e.name = t->path + dir_len;
+		e.dir_fd = fd;
+		e.depth = d->depth + 1;
+		e.have_stat = 0;
+		e.thread = t->thread;
+
+		if (walk_visit(s, &e))
+			walk_queue_dir(t, fd, &e);
+	}
+	if (status < 0)
+		walk_error(s, d->path, strerror(errno));
+#ifndef __linux__
+	dir_iter_close(&it);
+#endif
+BYE:
+	close(fd);
+	__atomic_add_fetch(&s->walk->ndir, 1, __ATOMIC_RELAXED);
+}
+
+static void *
+walk_thread(void *arg)
+{
+	struct walk_thread *t = arg;
+	struct walk_state *s = t->state;
+	struct walk_dir d;
+	int i, idle = 0;
+	char *buf = (char *)0;
+
+#ifdef __linux__
+	if (!(buf = malloc(WALK_GETDENTS_SIZE))) {
+		walk_error(s, "", "malloc(getdents) failed: out of memory");
+		return (void *)0;
+	}
+#endif
+	while (!__atomic_load_n(&s->abort, __ATOMIC_RELAXED)) {
+		int got = walk_pop(&s->queues[t->thread], &d, 0);
+
+		for (i = 1;  !got && i < s->nthread;  i++)
+			got = walk_pop(
+				&s->queues[(t->thread + i) % s->nthread],
+				&d,
+				1
 			);
-			if (!entp)
-				return "realloc(entries) failed: out of memory";
+		if (got) {
+			walk_dir(t, &d, buf);
+			free(d.path);
+			__atomic_sub_fetch(&s->pending, 1, __ATOMIC_RELEASE);
+			idle = 0;
+			continue;
 		}
+		if (__atomic_load_n(&s->pending, __ATOMIC_ACQUIRE) == 0)
+			break;
+
+		//  others are reading directories that may yield work
 
-		if (!entp[ec])
-			return "strdup(entry) failed: out of memory";
-		entp[ec] = strdup(ep->d_name);
+		if (++idle < 64)
+			sched_yield();
+		else {
+			struct timespec ts = {0, 100 * 1000};
+
+			nanosleep(&ts, (struct timespec *)0);
+		}
 	}
-	if (errno > 0)
-		return strerror(errno);
-	*entries = entp;
-	*ent_count = ec;
-	return (char *)0;
+	free(buf);
+	return (void *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Walk a directory tree in parallel, calling back for every entry.
+ *  Description:
+ *	The root and every entry below are passed to w->filter, then, when
+ *	the filter returns > 0, to w->callback, the root first, like find.
+ *	A filter returning 0 skips the entry and prunes a directory.  Either
+ *	returning < 0 aborts the walk.  Both are called concurrently from
+ *	w->nthread threads (0 for the number of online cpus); use e->thread
+ *	to index per thread state.
+ *
+ *	Directories are read with getdents64() and entries stat()ed relative
+ *	to the open parent, via fstatat(), only when w->stat is set or the
+ *	file system does not report d_type.  On linux, w->statx_mask selects
+ *	statx() of just the STATX_* fields needed, which is cheaper on NFS,
+ *	more so with w->statx_dont_sync.
+ *
+ *	Symbolic links are never followed.  With w->one_file_system, other
+ *	file systems are not descended, like find -xdev.  w->max_depth > 0
+ *	limits the depth, the root is depth 0.
+ *
+ *	Errors on a path, like EACCES, call w->on_error.  With no on_error,
+ *	or when on_error returns < 0, the walk aborts.  An abort by filter or
+ *	callback never calls on_error, so is never ignored.
+ *  Returns:
+ *	(char *)0	walk complete, counts in w->nentry, w->ndir, w->nerror
+ *	(char *)	first error that aborted the walk
+ */
+char *
+jmscott_walk(struct jmscott_walk *w, const char *root)
+{
+	struct walk_state s;
+	struct walk_thread *threads;
+	struct jmscott_walk_entry e;
+	int i, nthread = w->nthread, status;
+	char *err = (char *)0;
+
+	w->nentry = w->ndir = w->nerror = 0;
+	if (nthread <= 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nthread = ncpu < 1 ? 1 : ncpu > 256 ? 256 : (int)ncpu;
+	}
+	memset(&s, 0, sizeof s);
+	s.walk = w;
+	s.nthread = nthread;
+	pthread_mutex_init(&s.err_mutex, (pthread_mutexattr_t *)0);
+
+	s.queues = calloc(nthread, sizeof *s.queues);
+	threads = calloc(nthread, sizeof *threads);
+	if (!s.queues || !threads) {
+		err = "calloc(threads) failed: out of memory";
+		goto BYE;
+	}
+	for (i = 0;  i < nthread;  i++)
+		pthread_mutex_init(&s.queues[i].mutex, (pthread_mutexattr_t *)0);
+
+	//  visit the root, then queue it
+
+	memset(&e, 0, sizeof e);
+	e.path = e.name = root;
+	e.path_len = strlen(root);
+	e.dir_fd = AT_FDCWD;
+	if (e.path_len >= WALK_PATH_MAX) {
+		err = "root path too long";
+		goto BYE;
+	}
+	if (walk_stat(w, AT_FDCWD, root, &e.st) < 0) {
+		err = strerror(errno);
+		goto BYE;
+	}
+	s.root_dev = e.st.st_dev;
+	e.have_stat = 1;
+	e.type = mode2type(e.st.st_mode);
+
+	__atomic_add_fetch(&w->nentry, 1, __ATOMIC_RELAXED);
+	status = 1;
+	if (w->filter && (status = (*w->filter)(&e, w->private)) < 0) {
+		err = "walk aborted by filter";
+		goto BYE;
+	}
+	if (status > 0) {
+		if (w->callback && (*w->callback)(&e, w->private) < 0) {
+			err = "walk aborted by callback";
+			goto BYE;
+		}
+		if (e.type == DT_DIR) {
+			struct walk_dir d;
+
+			if (!(d.path = strdup(root))) {
+				err = "strdup(root) failed: out of memory";
+				goto BYE;
+			}
+			d.path_len = e.path_len;
+			d.fd = -1;
+			d.depth = 0;
+			s.pending = 1;
+			if (walk_push(&s.queues[0], &d) < 0) {
+				free(d.path);
+				err = "malloc(queue) failed: out of memory";
+				goto BYE;
+			}
+		}
+	}
+	if (s.pending == 0)
+		goto BYE;
+
+	for (i = 0;  i < nthread;  i++) {
+		threads[i].state = &s;
+		threads[i].thread = i;
+		status = pthread_create(
+				&threads[i].id,
+				(pthread_attr_t *)0,
+				walk_thread,
+				&threads[i]
+		);
+		if (status != 0) {
+			__atomic_store_n(&s.abort, 1, __ATOMIC_RELAXED);
+			err = strerror(status);
+			nthread = i;
+			break;
+		}
+	}
+	for (i = 0;  i < nthread;  i++)
+		pthread_join(threads[i].id, (void **)0);
+	if (!err)
+		err = s.err;
+BYE:
+	if (s.queues) {
+		int j;
+
+		//  directories left queued by an abort
+
+		for (i = 0;  i < s.nthread;  i++) {
+			struct walk_queue *q = &s.queues[i];
+
+			for (j = 0;  j < (int)q->count;  j++) {
+				struct walk_dir *d = &q->dirs[
+						(q->head + j) % q->size
+				];
+				free(d->path);
+				if (d->fd >= 0)
+					close(d->fd);
+			}
+			free(q->dirs);
+			pthread_mutex_destroy(&q->mutex);
+		}
+		free(s.queues);
+	}
+	free(threads);
+	pthread_mutex_destroy(&s.err_mutex);
+	return err;
 }
@@ -21,6 +21,8 @@
  *	Need to make code reentrant, via a jmscott_clib data structure!
  */
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 
@@ -35,6 +37,214 @@
 int	jmscott_ecpg_error_code = 127;
 int	jmscott_ecpg_warn_code = 126;
 
+/*
+ *  Fault maps compiled into perfect hash tables, so a sql state maps to
+ *  its action in one probe, no matter how long the map.
+ *
+ *  A five char sql state of [0-9A-Z] packs base 36 into a 26 bit key.
+ *  The slot is the top "bits" of key * seed, where seed is searched until
+ *  no two keys of the map share a slot.  Maps are compiled on first use
+ *  and cached by address, since maps are typically static arrays.
+ *
+ *  Entries are filled under a mutex, then published by a release store of
+ *  the count, so lookups by other threads take no lock.  Entries are
+ *  never replaced, so a published entry stays valid.
+ */
+#define FAULT_CACHE	8
+#define FAULT_MAX_BITS	10
+
+struct fault_slot
+{
+	int		key;		//  0 is empty; keys are + 1
+	int		action;
+};
+
+struct fault_index
+{
+	unsigned int			seed;
+	int				bits;
+	struct fault_slot		slot[1 << FAULT_MAX_BITS];
+};
+
+//  a null index marks a map that did not compile, so is scanned.
+//  the first entry of the map detects a map reused at the same address.
+static struct
+{
+	struct jmscott_ecpg_state_fault	*map;
+	const char			*first_state;
+	int				first_action;
+	struct fault_index		*index;
+} fault_cache[FAULT_CACHE];
+
+static int		nfault_cache = 0;
+static pthread_mutex_t	fault_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//  base 36 value of [0-9A-Z] plus 1, 0 for any other char
+static const unsigned char b36[256] =
+{
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15,
+	['F'] = 16, ['G'] = 17, ['H'] = 18, ['I'] = 19, ['J'] = 20,
+	['K'] = 21, ['L'] = 22, ['M'] = 23, ['N'] = 24, ['O'] = 25,
+	['P'] = 26, ['Q'] = 27, ['R'] = 28, ['S'] = 29, ['T'] = 30,
+	['U'] = 31, ['V'] = 32, ['W'] = 33, ['X'] = 34, ['Y'] = 35,
+	['Z'] = 36,
+};
+
+/*
+ *  Key of a five char sql state, plus 1, or 0 when not [0-9A-Z]{5}.
+ */
+static int
+state_key(const char *state)
+{
+	int i, key = 0;
+
+	for (i = 0;  i < 5;  i++) {
+		int v = b36[(unsigned char)state[i]];
+
+		if (v == 0)
+			return 0;
+		key = key * 36 + v - 1;
+	}
+	return key + 1;
+}
+
+#define FAULT_SLOT(key, seed, bits)	\
+	(((unsigned int)(key) * (seed)) >> (32 - (bits)))
+
+/*
+ *  Compile a fault map, or return null when the map has a malformed sql
+ *  state, or no seed is found, so the caller scans the map.
+ */
+static struct fault_index *
+fault_compile(struct jmscott_ecpg_state_fault *map)
+{
+	struct jmscott_ecpg_state_fault *f;
+	struct fault_index *x;
+	unsigned int seed = 0x9E3779B1;		//  golden ratio
+	int n = 0, bits, try;
+
+	for (f = map;  f->sql_state;  f++, n++)
+		if (strlen(f->sql_state) != 5 || !state_key(f->sql_state))
+			return (struct fault_index *)0;
+	for (bits = 1;  (1 << bits) < 2 * n;  bits++)
+		;
+	if (!(x = malloc(sizeof *x)))
+		return (struct fault_index *)0;
+
+	for (;  bits <= FAULT_MAX_BITS;  bits++)
+		for (try = 0;  try < 256;  try++, seed += 0x6D2B79F6) {
+			memset(x->slot, 0, sizeof x->slot[0] << bits);
+			for (f = map;  f->sql_state;  f++) {
+				int key = state_key(f->sql_state);
+				struct fault_slot *sp;
+
+				sp = &x->slot[FAULT_SLOT(key, seed | 1, bits)];
+
+				//  first entry wins, like a scan of the map
+
+				if (sp->key == key)
+					continue;
+				if (sp->key != 0)
+					break;
+				sp->key = key;
+				sp->action = f->action;
+			}
+			if (!f->sql_state) {
+				x->seed = seed | 1;
+				x->bits = bits;
+				return x;
+			}
+		}
+	free(x);
+	return (struct fault_index *)0;
+}
+
+/*
+ *  Find the cached index of a map among the first "n" entries, returning
+ *  1 when found.  A cached map whose first entry changed is not indexed.
+ */
+static int
+fault_cache_find(
+	struct jmscott_ecpg_state_fault *map,
+	int n,
+	struct fault_index **x
+){
+	int i;
+
+	for (i = 0;  i < n;  i++)
+		if (fault_cache[i].map == map) {
+			if (map->sql_state == fault_cache[i].first_state &&
+			    map->action == fault_cache[i].first_action)
+				*x = fault_cache[i].index;
+			return 1;
+		}
+	return 0;
+}
+
+/*
+ *  Synopsis:
+ *	Find the action of a five char sql state in a fault map.
+ *  Description:
+ *	The map is compiled into a perfect hash table on first use, then
+ *	each lookup is a single probe.  Up to 8 distinct maps are cached.
+ *	Other maps, maps with malformed states, or large maps, typically
+ *	over 50 states, with no perfect seed in 1024 slots, are scanned.
+ *
+ *	Safe to call from many threads.  Maps are cached by address, so
+ *	must be static, or at least never changed nor freed while the
+ *	process runs.  A map whose first entry no longer matches the cache
+ *	is scanned, but other changes go unnoticed.
+ *  Returns:
+ *	-1		ignore the fault
+ *	0 <= 255	exit status for the fault
+ *	-2		sql state not in map, or null map
+ */
+int
+jmscott_ecpg_state_action(
+	struct jmscott_ecpg_state_fault *fault,
+	const char *sql_state
+){
+	struct fault_index *x = (struct fault_index *)0;
+	int n;
+
+	if (!fault)
+		return -2;
+	n = __atomic_load_n(&nfault_cache, __ATOMIC_ACQUIRE);
+	if (!fault_cache_find(fault, n, &x) && n < FAULT_CACHE) {
+		pthread_mutex_lock(&fault_cache_mutex);
+
+		//  another thread may have cached the map, or filled the cache
+
+		n = nfault_cache;
+		if (!fault_cache_find(fault, n, &x) && n < FAULT_CACHE) {
+			x = fault_compile(fault);
+			fault_cache[n].map = fault;
+			fault_cache[n].first_state = fault->sql_state;
+			fault_cache[n].first_action = fault->action;
+			fault_cache[n].index = x;
+			__atomic_store_n(&nfault_cache, n + 1, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&fault_cache_mutex);
+	}
+
+	if (x) {
+		int key = state_key(sql_state);
+		struct fault_slot *sp;
+
+		if (key == 0)
+			return -2;
+		sp = &x->slot[FAULT_SLOT(key, x->seed, x->bits)];
+		return sp->key == key ? sp->action : -2;
+	}
+	for (;  fault->sql_state;  fault++)
+		if (strncmp(sql_state, fault->sql_state, 5) == 0 &&
+		    fault->sql_state[5] == 0)
+			return fault->action;
+	return -2;
+}
+
 /*
  *  Synopsis:
  *	Low level handler for all sql faults that end with jmscott_die().
@@ -46,60 +256,49 @@ jmscott_ecpg_fault(
 	struct jmscott_ecpg_state_fault *fault
 ) {
 #if JMSCOTT_COMPILE_PG
-	char msg[4096];
+	char msg[4096], state[6];
+	struct jmscott_strbuf sb;
 
-	msg[0] = 0;
-	jmscott_strcat(msg, sizeof msg, "SQL");
-	jmscott_strcat(msg, sizeof msg, what);
-
-	//  add the sql state code to error message
+	//  remap the process exit code for a particular sql state code,
+	//  before formatting, so ignored faults cost only the lookup
 
 	if (sqlca.sqlstate[0] != 0) {
-		char state[6];
+		int act;
 
-		jmscott_strcat(msg, sizeof msg, ": ");
 		memmove(state, sqlca.sqlstate, 5);
 		state[5] = 0;
-		jmscott_strcat(msg, sizeof msg, state);
+		act = jmscott_ecpg_state_action(fault, state);
 
-		//  remap the process exit code for a particular sql state code
+		//  ignore the fault
 
-		if (fault) {
-			while (fault->sql_state) {
-				if (strcmp(state, fault->sql_state) == 0)
-					break;
-				fault++;
-			}
+		if (act == -1)
+			return;
 
-			//  change the default behavior of the fault based
-			//  the sql state code
+		//  change the process exit status
 
-			if (fault->sql_state) {
-				int act = fault->action;
-
-				//  ignore the fault
+		if (0 <= act && act <= 255)
+			status = act;
+	}
 
-				if (act == -1)
-					return;
+	jmscott_strbuf_init(&sb, msg, sizeof msg);
+	jmscott_strbuf_append2(&sb, "SQL", what);
 
-				//  change the process exit status
+	//  add the sql state code to error message
 
-				if (0 <= act && act <= 255)
-					status = act;
-			}
-		}
-	} else
-		jmscott_strcat(msg, sizeof msg, ": (WARN: missing sql state)");
+	if (sqlca.sqlstate[0] != 0)
+		jmscott_strbuf_append2(&sb, ": ", state);
+	else
+		jmscott_strbuf_append(&sb, ": (WARN: missing sql state)");
 
 	//  tack on the sql error message
 
 	if (sqlca.sqlerrm.sqlerrml > 0) {
-		char err[SQLERRMC_LEN + 1];
-
-		jmscott_strcat(msg, sizeof msg, ": ");
-		memmove(err, sqlca.sqlerrm.sqlerrmc, sqlca.sqlerrm.sqlerrml);
-		err[sqlca.sqlerrm.sqlerrml] = 0;
-		jmscott_strcat(msg, sizeof msg, err);
+		jmscott_strbuf_append(&sb, ": ");
+		jmscott_strbuf_appendn(
+			&sb,
+			sqlca.sqlerrm.sqlerrmc,
+			sqlca.sqlerrm.sqlerrml
+		);
 	}
 	jmscott_die(status, msg);
 #else
@@ -5,7 +5,15 @@
  *	sendfile() should in should interpret file EINVAL as a file descriptor
  *	not capable of mmap and attempt a read/write copy.
  */
+#ifdef __linux__
+#define _GNU_SOURCE		//  O_TMPFILE, sync_file_range()
+#endif
+
 #include <sys/errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -140,6 +148,225 @@ AGAIN:
 #endif
 }
 
+#define COPY_BUF_SIZE	(1024 * 1024)
+#define COPY_WINDOW	(8 * 1024 * 1024)
+
+static void
+digest_all(struct jmscott_digest *digests, int ndigest, void *p, size_t n)
+{
+	int i;
+
+	for (i = 0;  i < ndigest;  i++)
+		jmscott_digest_update(&digests[i], p, n);
+}
+
+/*
+ *  Copy and digest via read()/write() through a page aligned buffer, for
+ *  pipes, sockets and files that can not be mapped.
+ */
+static char *
+digest_copyio(
+	int in_fd,
+	int out_fd,
+	struct jmscott_digest *digests,
+	int ndigest,
+	unsigned long long *copy_size
+){
+	unsigned long long total = 0;
+	char *err = (char *)0;
+	void *buf;
+	ssize_t nr;
+	int status;
+
+	status = posix_memalign(&buf, 4096, COPY_BUF_SIZE);
+	if (status != 0)
+		return strerror(status);
+	while ((nr = jmscott_read(in_fd, buf, COPY_BUF_SIZE)) > 0) {
+		digest_all(digests, ndigest, buf, nr);
+		if (jmscott_write_all(out_fd, buf, nr) < 0) {
+			err = strerror(errno);
+			break;
+		}
+		total += nr;
+	}
+	if (nr < 0)
+		err = strerror(errno);
+	free(buf);
+	if (err)
+		return err;
+	if (copy_size)
+		*copy_size = total;
+	return (char *)0;
+}
+
+/*
+ *  Write "len" bytes at offset "off" of the input file, already mapped at
+ *  "p".  Linux sends from the page cache with sendfile(), avoiding a copy
+ *  through user space.  *use_write is set when sendfile() can not write to
+ *  the output, like on some pipes, so the mapped bytes are write()n.
+ */
+static int
+send_window(int in_fd, int out_fd, off_t off, void *p, size_t len, int *use_write)
+{
+#if defined(__APPLE__)
+	(void)in_fd;
+	(void)off;
+	*use_write = 1;
+#else
+	while (!*use_write && len > 0) {
+		ssize_t nw = sendfile(out_fd, in_fd, &off, len);
+
+		if (nw < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (errno != EINVAL && errno != ENOSYS)
+				return -1;
+			*use_write = 1;
+			break;
+		}
+		if (nw == 0) {
+			errno = EIO;		//  file truncated under us
+			return -1;
+		}
+		p = (char *)p + nw;
+		len -= nw;
+	}
+#endif
+	if (len == 0)
+		return 0;
+	return jmscott_write_all(out_fd, p, len);
+}
+
+/*
+ *  Synopsis:
+ *	Copy in_fd to out_fd until end of file, digesting in the same pass.
+ *  Description:
+ *	Each of the "ndigest" digests, already started by the caller with
+ *	jmscott_digest_init(), is updated with every byte copied, so a blob
+ *	may be spooled and its udig computed with a single read of the data.
+ *	The caller finishes the digests with jmscott_digest_udig().
+ *
+ *	A regular input file is copied from the current offset to the size
+ *	at the start of the copy, mapped in 8MB windows.  Each window is
+ *	digested from the page cache then written with sendfile(), so the
+ *	bytes never pass through a user buffer.  Other inputs are copied
+ *	through a 1MB page aligned buffer.  The input offset is left at end
+ *	of file, same as read().
+ *  Returns:
+ *	(char *)0	all bytes copied, *copy_size set to bytes copied
+ *	(char *)	error, system errors are strerror(errno), *copy_size
+ *			not set
+ *  Note:
+ *	A regular file truncated during the copy may raise SIGBUS.
+ *
+ *	Using vmsplice() of the mapped window into a pipe out_fd would save
+ *	the final copy to pipes, at the cost of pinning pages in the pipe.
+ */
+char *
+jmscott_digest_copy(
+	int in_fd,
+	int out_fd,
+	struct jmscott_digest *digests,
+	int ndigest,
+	unsigned long long *copy_size
+){
+	struct stat st;
+	off_t start, pos, end;
+	long page_size;
+	int use_write = 0;
+
+	if (jmscott_fstat(in_fd, &st))
+		return strerror(errno);
+	if (!S_ISREG(st.st_mode) || st.st_size == 0)
+		return digest_copyio(in_fd, out_fd, digests, ndigest, copy_size);
+	if ((start = jmscott_lseek(in_fd, (off_t)0, SEEK_CUR)) < 0)
+		return strerror(errno);
+	pos = start;
+	end = st.st_size;
+	if (pos >= end) {
+		if (copy_size)
+			*copy_size = 0;
+		return (char *)0;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	while (pos < end) {
+		off_t map_off = pos & ~((off_t)page_size - 1);
+		size_t skip = pos - map_off;
+		size_t len = end - pos;
+		void *p;
+
+		if (len > COPY_WINDOW)
+			len = COPY_WINDOW;
+		p = mmap((void *)0, skip + len, PROT_READ, MAP_SHARED,
+								in_fd, map_off);
+		if (p == MAP_FAILED) {
+			if (map_off > 0 || skip > 0)
+				return strerror(errno);
+			return digest_copyio(
+					in_fd,
+					out_fd,
+					digests,
+					ndigest,
+					copy_size
+			);
+		}
+#ifdef MADV_SEQUENTIAL
+		(void)madvise(p, skip + len, MADV_SEQUENTIAL);
+#endif
+		digest_all(digests, ndigest, (char *)p + skip, len);
+		if (send_window(in_fd, out_fd, pos, (char *)p + skip, len,
+							&use_write) < 0) {
+			int e = errno;
+
+			munmap(p, skip + len);
+			return strerror(e);
+		}
+		if (munmap(p, skip + len) < 0)
+			return strerror(errno);
+		pos += len;
+	}
+	if (jmscott_lseek(in_fd, end, SEEK_SET) < 0)
+		return strerror(errno);
+	if (copy_size)
+		*copy_size = end - start;
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Send a whole file, returning the udig of the bytes sent.
+ *  Description:
+ *	Same as jmscott_send_file(), but the udig for digest "algo" is
+ *	computed in the same pass, via jmscott_digest_copy().
+ *  Returns:
+ *	(char *)0	all bytes sent, udig written, *send_size set
+ *	(char *)	error
+ */
+char *
+jmscott_send_file_udig(
+	int in_fd,
+	int out_fd,
+	const char *algo,
+	char *udig,
+	size_t udig_size,
+	long long *send_size
+){
+	struct jmscott_digest d;
+	unsigned long long size;
+	char *err;
+
+	if ((err = jmscott_digest_init(&d, algo)))
+		return err;
+	if ((err = jmscott_digest_copy(in_fd, out_fd, &d, 1, &size)))
+		return err;
+	if ((err = jmscott_digest_udig(&d, udig, udig_size)))
+		return err;
+	if (send_size)
+		*send_size = (long long)size;
+	return (char *)0;
+}
+
 char *
 jmscott_fsizeat(int at_fd, const char *path, off_t *size)
 {
@@ -158,3 +385,377 @@ jmscott_rewind(int fd)
 		return strerror(errno);
 	return (char *)0;
 }
+
+/*
+ *  Synopsis:
+ *	Read all of a file descriptor as paths terminated by "term".
+ *  Usage:
+ *	char **paths;
+ *	size_t npath;
+ *
+ *	err = jmscott_read_paths(0, null_term ? 0 : '\n', &paths, &npath);
+ *  Description:
+ *	Paths are typically new line or null terminated, as written by
+ *	"find" or "find -print0".  A final path need not be terminated and
+ *	empty paths are skipped.  The paths point into a single buffer of
+ *	all the bytes read.  Neither the buffer nor the array are freed,
+ *	since tools read the paths once and exit.
+ *  Returns:
+ *	(char *)0	*paths has *npath null terminated paths
+ *	(char *)	read() failed or out of memory
+ */
+char *
+jmscott_read_paths(int fd, char term, char ***paths, size_t *npath)
+{
+	size_t size = 0, len = 0, max = 0, n = 0, i, start;
+	char *in = (char *)0, **p = (char **)0;
+	ssize_t nr;
+
+	do {
+		if (len == size) {
+			char *grow;
+
+			size = size ? size * 2 : 64 * 1024;
+			if (!(grow = realloc(in, size + 1))) {
+				free(in);
+				return "realloc(paths) failed: out of memory";
+			}
+			in = grow;
+		}
+		nr = jmscott_read(fd, in + len, size - len);
+		if (nr < 0) {
+			char *err = strerror(errno);
+
+			free(in);
+			return err;
+		}
+		len += nr;
+	} while (nr > 0);
+	in[len] = term;
+
+	for (i = 0, start = 0;  i <= len;  i++)
+		if (in[i] == term) {
+			in[i] = 0;
+			if (i > start) {
+				if (n == max) {
+					char **grow;
+
+					max = max ? max * 2 : 1024;
+					grow = realloc(p, max * sizeof *p);
+					if (!grow) {
+						free(p);
+						free(in);
+						return "realloc(paths) failed: "
+							"out of memory";
+					}
+					p = grow;
+				}
+				p[n++] = in + start;
+			}
+			start = i + 1;
+		}
+	*paths = p;
+	*npath = n;
+	return (char *)0;
+}
+
+/*
+ *  Crash safe replacement of files.
+ *
+ *  New contents are written to an unnamed O_TMPFILE in the directory of
+ *  the target, or to a hidden temp name where O_TMPFILE is not supported.
+ *  Commit is
+ *
+ *	fdatasync(new)
+ *	linkat(new, ".target~pid.seq")		//  O_TMPFILE only
+ *	renameat(".target~pid.seq", "target")
+ *	fsync(dir)
+ *
+ *  so after a crash the target is either the complete old or the
+ *  complete new file, never a partial one, and a writer dying before
+ *  commit leaves no garbage behind, except for the fallback temp names.
+ */
+
+static unsigned int	replace_seq = 0;
+
+static void
+replace_close(struct jmscott_replace *r)
+{
+	if (r->fd >= 0)
+		jmscott_close(r->fd);
+	if (r->dir_fd >= 0)
+		jmscott_close(r->dir_fd);
+	r->fd = r->dir_fd = -1;
+}
+
+/*
+ *  Synopsis:
+ *	Open a new, empty version of "path", relative to "at_fd".
+ *  Description:
+ *	Write the new contents to r->fd, then call jmscott_replace_commit()
+ *	to atomically replace "path", or jmscott_replace_abort() to keep
+ *	the old version.  Readers see no change until the commit.
+ *
+ *	The temp file is created with "mode", less the umask.
+ *  Returns:
+ *	(char *)0	new version open on r->fd
+ *	(char *)	error, nothing left open
+ */
+char *
+jmscott_replace_open(
+	struct jmscott_replace *r,
+	int at_fd,
+	const char *path,
+	mode_t mode
+){
+	const char *name = strrchr(path, '/');
+	char dir[JMSCOTT_PATH_MAX + 1], seq[64], *p;
+
+	r->fd = r->dir_fd = -1;
+	r->linked = 0;
+
+	if (name) {
+		if (name == path)
+			strcpy(dir, "/");
+		else if ((size_t)(name - path) > JMSCOTT_PATH_MAX)
+			return "replace: directory path too long";
+		else {
+			memcpy(dir, path, name - path);
+			dir[name - path] = 0;
+		}
+		name++;
+	} else {
+		strcpy(dir, ".");
+		name = path;
+	}
+	if (!*name)
+		return "replace: empty file name";
+
+	size_t len = strlen(name), seq_len;
+
+	r->name[0] = r->tmp_name[0] = 0;
+	if (len > NAME_MAX)
+		return "replace: file name too long";
+	memcpy(r->name, name, len + 1);
+
+	//  ".name~pid.seq", unique across processes and threads by the
+	//  "pid.seq" alone, so a long name is cut to fit NAME_MAX
+
+	p = jmscott_ulltoa(getpid(), seq);
+	*p++ = '.';
+	*jmscott_ulltoa(__sync_fetch_and_add(&replace_seq, 1), p) = 0;
+	seq_len = strlen(seq);
+	if (len > NAME_MAX - seq_len - 2)
+		len = NAME_MAX - seq_len - 2;
+	r->tmp_name[0] = '.';
+	memcpy(r->tmp_name + 1, name, len);
+	r->tmp_name[len + 1] = '~';
+	memcpy(r->tmp_name + len + 2, seq, seq_len + 1);
+
+	r->dir_fd = jmscott_openat(
+			at_fd,
+			dir,
+			O_RDONLY | O_DIRECTORY | O_CLOEXEC,
+			0
+	);
+	if (r->dir_fd < 0)
+		return strerror(errno);
+
+#ifdef O_TMPFILE
+	r->fd = jmscott_openat(r->dir_fd, ".", O_TMPFILE|O_WRONLY|O_CLOEXEC, mode);
+	if (r->fd >= 0)
+		return (char *)0;
+
+	//  file system or kernel without O_TMPFILE
+
+	if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL) {
+		char *err = strerror(errno);
+
+		replace_close(r);
+		return err;
+	}
+#endif
+	r->fd = jmscott_openat(
+			r->dir_fd,
+			r->tmp_name,
+			O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+			mode
+	);
+	if (r->fd < 0) {
+		char *err = strerror(errno);
+
+		replace_close(r);
+		return err;
+	}
+	r->linked = 1;
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Discard the new version, leaving the target untouched.
+ */
+void
+jmscott_replace_abort(struct jmscott_replace *r)
+{
+	if (r->linked && r->dir_fd >= 0)
+		jmscott_unlinkat(r->dir_fd, r->tmp_name, 0);
+	r->linked = 0;
+	replace_close(r);
+}
+
+/*
+ *  Flush data, then atomically rename the new version over the target.
+ *  The directory is not synced.
+ */
+static char *
+replace_rename(struct jmscott_replace *r)
+{
+	if (jmscott_fdatasync(r->fd) < 0)
+		return strerror(errno);
+	if (!r->linked) {
+		char proc[64] = "/proc/self/fd/";
+
+		//  linkat(AT_EMPTY_PATH) needs CAP_DAC_READ_SEARCH, /proc not
+
+		*jmscott_ulltoa(r->fd, proc + 14) = 0;
+		if (jmscott_linkat(
+			AT_FDCWD,
+			proc,
+			r->dir_fd,
+			r->tmp_name,
+			AT_SYMLINK_FOLLOW
+		) < 0)
+			return strerror(errno);
+		r->linked = 1;
+	}
+	if (jmscott_renameat(r->dir_fd, r->tmp_name, r->dir_fd, r->name) < 0)
+		return strerror(errno);
+	r->linked = 0;
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Atomically and durably replace the target with the new version.
+ *  Description:
+ *	With a null "batch", the data, the rename and the directory are all
+ *	synced before returning, costing two fsync round trips per file.
+ *
+ *	With a batch, writeback of the data is only started and the new
+ *	version queued; no reader sees it until jmscott_replace_batch_sync(),
+ *	which then pays one fsync per directory, not per file.  The batch
+ *	syncs itself when JMSCOTT_REPLACE_BATCH files are queued, so call
+ *	jmscott_replace_batch_sync() at the end of each batch of work.
+ *
+ *	Either way, the struct is finished after the call.
+ *  Returns:
+ *	(char *)0	replaced, or queued in batch
+ *	(char *)	error
+ *
+ *	Without a batch, an error before the rename leaves the old version
+ *	in place.  An error syncing the directory comes after the rename,
+ *	so readers already see the new version, which may not survive a
+ *	crash.
+ *
+ *	With a batch, an error is only returned when the commit fills the
+ *	batch, and is the error of jmscott_replace_batch_sync() for any
+ *	queued file, not just this one.
+ */
+char *
+jmscott_replace_commit(
+	struct jmscott_replace *r,
+	struct jmscott_replace_batch *batch
+){
+	char *err;
+
+	if (batch) {
+#ifdef SYNC_FILE_RANGE_WRITE
+		(void)sync_file_range(r->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+		batch->pending[batch->count++] = *r;
+		r->fd = r->dir_fd = -1;
+		r->linked = 0;
+		if (batch->count == JMSCOTT_REPLACE_BATCH)
+			return jmscott_replace_batch_sync(batch);
+		return (char *)0;
+	}
+	if ((err = replace_rename(r))) {
+		jmscott_replace_abort(r);
+		return err;
+	}
+	err = (char *)0;
+	if (jmscott_fsync(r->dir_fd) < 0)
+		err = strerror(errno);
+	replace_close(r);
+	return err;
+}
+
+void
+jmscott_replace_batch_init(struct jmscott_replace_batch *b)
+{
+	b->count = 0;
+	b->nfsync_dir = 0;
+}
+
+/*
+ *  Synopsis:
+ *	Replace all files queued in a batch, then sync each directory once.
+ *  Description:
+ *	Writeback of each file was started at commit, so the fdatasync()s
+ *	mostly wait on i/o already in flight.  The batch is empty on return,
+ *	even on error.
+ *  Returns:
+ *	(char *)0	all queued files durably replaced
+ *	(char *)	first error.  A file whose data sync or rename failed
+ *			keeps the old version; all others are replaced.
+ *			After an error syncing a directory, files renamed in
+ *			it are visible but may not survive a crash.
+ */
+char *
+jmscott_replace_batch_sync(struct jmscott_replace_batch *b)
+{
+	dev_t dev[JMSCOTT_REPLACE_BATCH];
+	ino_t ino[JMSCOTT_REPLACE_BATCH];
+	int i, j, ndir = 0;
+	char *err = (char *)0, *e;
+
+	for (i = 0;  i < b->count;  i++) {
+		struct jmscott_replace *r = &b->pending[i];
+
+		if ((e = replace_rename(r))) {
+			if (!err)
+				err = e;
+			jmscott_replace_abort(r);
+		}
+	}
+
+	//  one fsync per distinct directory
+
+	for (i = 0;  i < b->count;  i++) {
+		struct jmscott_replace *r = &b->pending[i];
+		struct stat st;
+
+		if (r->dir_fd < 0)
+			continue;
+		if (jmscott_fstat(r->dir_fd, &st) < 0) {
+			if (!err)
+				err = strerror(errno);
+			continue;
+		}
+		for (j = 0;  j < ndir;  j++)
+			if (dev[j] == st.st_dev && ino[j] == st.st_ino)
+				break;
+		if (j < ndir)
+			continue;
+		dev[ndir] = st.st_dev;
+		ino[ndir++] = st.st_ino;
+		b->nfsync_dir++;
+		if (jmscott_fsync(r->dir_fd) < 0 && !err)
+			err = strerror(errno);
+	}
+	for (i = 0;  i < b->count;  i++)
+		replace_close(&b->pending[i]);
+	b->count = 0;
+	return err;
+}
@@ -9,12 +9,23 @@
  *	plus new line.	The characters '>' and '<' represent either write
  *	(shell output) or read (shell input), respectively.
  *
-     0  >  67 65 74 20 70 69 6e 67 3a 61 62 63 64 65 66 0a  get ping:abcdef.   
+     0  >  67 65 74 20 70 69 6e 67 3a 61 62 63 64 65 66 0a  get ping:abcdef.
     16  >  3a 35 34 20 43 44 54 09 31 32 37 2e 30 2e 30 2e  :54 CDT.127.0.0.
-    32  >  01 02 03                                         ... 
+    32  >  01 02 03                                         ...
 
 0.........1.........2.........3.........4.........5.........6.........7.........
 
+ *
+ *	A struct jmscott_hexdump streams either the trace format above,
+ *	via jmscott_hexdump_trace(), or the canonical format of "hexdump -C",
+ *	via jmscott_hexdump_write(), through a 16KB buffer to a file
+ *	descriptor.
+ *
+00000000  67 65 74 20 70 69 6e 67  3a 61 62 63 64 65 66 0a  |get ping:abcdef.|
+00000010
+ *
+ *	Lines are formatted 16 bytes per step: hex pairs from a table, the
+ *	ascii column with SSE2, and no stdio.
  *
  *  Derived from a hexdump written by Andy Fullford, eons ago.
  *
@@ -23,13 +34,144 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <sys/errno.h>
 #include <unistd.h>
 #include <string.h>
-#include <stdio.h>
-#include <ctype.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "jmscott/libjmscott.h"
 
+extern int	errno;
+
+#define TRACE_LINE	77		//  76 chars plus new line
+#define CANON_LINE	79		//  78 chars plus new line
+
+static const char hexpair[] =
+	"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff"
+;
+
+/*
+ *  Copy "n" bytes, replacing bytes outside of ascii [ -~] with '.'.
+ *  Independent of locale, unlike isprint().
+ */
+static void
+printable(char *t, const unsigned char *s, int n)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	if (n == 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i ok = _mm_and_si128(
+			_mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(' ')), v),
+			_mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8('~')), v)
+		);
+		_mm_storeu_si128(
+			(__m128i *)t,
+			_mm_or_si128(
+				_mm_and_si128(ok, v),
+				_mm_andnot_si128(ok, _mm_set1_epi8('.'))
+			)
+		);
+		return;
+	}
+#endif
+	for (;  i < n;  i++)
+		t[i] = (unsigned char)(s[i] - ' ') <= '~' - ' ' ? s[i] : '.';
+}
+
+/*
+ *  Format one trace line of "n" <= 16 bytes at "t", TRACE_LINE chars.
+ *  Offsets past 999999 wrap, to keep the 76 column layout.
+ */
+static void
+trace_line(
+	char *t,
+	unsigned long offset,
+	char direction,
+	const unsigned char *s,
+	int n
+){
+	int i;
+
+	offset %= 1000000;
+	for (i = 5;  i >= 0;  i--) {
+		t[i] = offset > 0 || i == 5 ? '0' + offset % 10 : ' ';
+		offset /= 10;
+	}
+	t[6] = t[7] = ' ';
+	t[8] = direction;
+	t[9] = ' ';
+
+	for (i = 0;  i < n;  i++) {
+		char *h = t + 10 + i * 3;
+
+		h[0] = ' ';
+		memcpy(h + 1, hexpair + 2 * s[i], 2);
+	}
+	memset(t + 10 + n * 3, ' ', (16 - n) * 3 + 2);
+	printable(t + 60, s, n);
+	memset(t + 60 + n, ' ', 16 - n);
+	t[76] = '\n';
+}
+
+/*
+ *  Format a canonical offset, at least 8 hex digits, returning the width.
+ */
+static int
+canon_offset(char *t, unsigned long long offset)
+{
+	int i, w;
+
+	for (w = 8;  w < 16 && (offset >> (4 * w)) > 0;  w++)
+		;
+	for (i = w - 1;  i >= 0;  i--) {
+		t[i] = hexpair[2 * (offset & 0xf) + 1];
+		offset >>= 4;
+	}
+	return w;
+}
+
+/*
+ *  Format one canonical "hexdump -C" line of "n" <= 16 bytes.  Returns
+ *  the length, CANON_LINE chars for a full line, less for a short line,
+ *  or more when the offset exceeds 8 hex digits.
+ */
+static int
+canon_line(char *t, unsigned long long offset, const unsigned char *s, int n)
+{
+	char *h = t + canon_offset(t, offset);
+	int i;
+
+	memset(h, ' ', 2 + 16 * 3 + 2);
+	for (i = 0;  i < n;  i++)
+		memcpy(h + 2 + i * 3 + (i >= 8), hexpair + 2 * s[i], 2);
+	h += 2 + 16 * 3 + 2;
+	*h++ = '|';
+	printable(h, s, n);
+	h += n;
+	*h++ = '|';
+	*h++ = '\n';
+	return h - t;
+}
+
+/*
+ *  Format "src_size" bytes into the null terminated buffer "tgt", 76 chars
+ *  plus new line per 16 bytes of source.
+ *
+ *  When "tgt" is too small, only the whole lines that fit are formatted.
+ *  A "tgt_size" of ((src_size - 1) / 16 + 1) * 77 + 1 always fits.
+ */
 void
 jmscott_hexdump(
 	unsigned char *src,
@@ -39,88 +181,198 @@ jmscott_hexdump(
 	int tgt_size
 )
 {
-	char *t;
-	unsigned char *s, *s_end;
-	int need;
+	int off;
+	char *t = tgt;
 
-	if (src_size == 0) {
-		*tgt = 0;
+	if (tgt_size <= 0)
 		return;
+	if (src_size > 0 && ((src_size - 1) / 16 + 1) * TRACE_LINE + 1 >
+								tgt_size)
+		src_size = (tgt_size - 1) / TRACE_LINE * 16;
+
+	for (off = 0;  off < src_size;  off += 16) {
+		int n = src_size - off < 16 ? src_size - off : 16;
+
+		trace_line(t, off, direction, src + off, n);
+		t += TRACE_LINE;
 	}
+	*t = 0;
+}
 
-	static char hexchar[] = "0123456789abcdef";
-
-	/*
-	 *  Insure we have plenty of room in the target buffer.
-	 *
-	 *  Each line of ascii output formats up to 16 bytes in the source
-	 *  buffer, so the number of lines is the ceiling(src_size/16).
-	 *  The number of characters per line is 76 characters plus the 
-	 *  trailing new line.
-	 *
-	 *	((src_size - 1) / 16 + 1) * (76 + 1) + 1
-	 *
-	 *  with the entire ascii string terminated with a null byte.
-	 */
-	need = ((src_size - 1) / 16 + 1) * (76 + 1) + 1;
-
-	/*
-	 *  Not enough space in the target buffer ... probably ought
-	 *  to truncate instead of punting.
-	 */
-	if (need > tgt_size)
-		src_size = tgt_size;
-
-	s = src;
-	s_end = s + src_size;
-	t = tgt;
-
-	while (s < s_end) {
-		int i;
-
-		/*
-		 *  Start of line in the target.
-		 */
-		char *l = t;
-
-		/*
-		 *  Write the offset into the source buffer.
-		 */
-		sprintf(l, "%6lu", (long unsigned)(s - src));
-
-		/*
-		 *  Write direction of flow
-		 */
-		l[6] = l[7] = ' ';
-		l[8] = direction;
-		l[9] = ' ';
-
-		/*
-		 *  Format up to next 16 bytes from the source.
-		 */
-		for (i = 0;  s < s_end && i < 16;  i++) {
-			l[10 + i * 3] = ' ';
-			l[10 + i * 3 + 1] = hexchar[(*s >> 4) & 0x0F];
-			l[10 + i * 3 + 2] = hexchar[*s & 0x0F];
-			if (isprint(*s))
-				l[60 + i] = *s;
-			else
-				l[60 + i] = '.';
-			s++;
-		}
-		/*
-		 *  Pad out last line with white space.
-		 */
-		while (i < 16) {
-			l[10 + i * 3] =
-			l[10 + i * 3 + 1] =
-			l[10 + i * 3 + 2] = ' ';
-			l[60 + i] = ' ';
-			i++;
+/*
+ *  Synopsis:
+ *	Start a buffered hexdump stream to file descriptor "fd".
+ *  Description:
+ *	Repeated canonical lines are squeezed to "*", like hexdump -C.
+ *	Set h->squeeze = 0 for all lines, like hexdump -C -v.
+ */
+void
+jmscott_hexdump_init(struct jmscott_hexdump *h, int fd)
+{
+	memset(h, 0, sizeof *h - sizeof h->out);
+	h->fd = fd;
+	h->squeeze = 1;
+}
+
+/*
+ *  Synopsis:
+ *	Write the buffered lines.
+ *  Returns:
+ *	(char *)0	lines written
+ *	(char *)	write() failed, strerror(errno)
+ */
+char *
+jmscott_hexdump_flush(struct jmscott_hexdump *h)
+{
+	if (h->out_len > 0 && jmscott_write_all(h->fd, h->out, h->out_len) < 0)
+		return strerror(errno);
+	h->out_len = 0;
+	return (char *)0;
+}
+
+/*
+ *  Room for one more line, flushing when needed.
+ */
+static char *
+room(struct jmscott_hexdump *h)
+{
+	if (h->out_len + CANON_LINE + 8 > sizeof h->out)
+		return jmscott_hexdump_flush(h);
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Append one read or write of "len" bytes in the 76 column trace format.
+ *  Description:
+ *	Offsets restart at 0 for each call, so each buffer traces as a
+ *	record, tagged with "direction", typically '<' for read or '>' for
+ *	write.  Lines are buffered, so call jmscott_hexdump_flush() when the
+ *	trace must be seen.
+ *  Returns:
+ *	(char *)0	lines buffered
+ *	(char *)	write() of full buffer failed, strerror(errno)
+ */
+char *
+jmscott_hexdump_trace(
+	struct jmscott_hexdump *h,
+	char direction,
+	const void *src,
+	size_t len
+){
+	const unsigned char *s = src;
+	size_t off;
+	char *err;
+
+	for (off = 0;  off < len;  off += 16) {
+		int n = len - off < 16 ? len - off : 16;
+
+		if ((err = room(h)))
+			return err;
+		trace_line(h->out + h->out_len, off, direction, s + off, n);
+		h->out_len += TRACE_LINE;
+	}
+	return (char *)0;
+}
+
+/*
+ *  Append one full, canonical line, squeezing repeats.
+ */
+static char *
+canon_full(struct jmscott_hexdump *h, const unsigned char *s)
+{
+	char *err;
+
+	if (h->squeeze && h->have_prev && memcmp(h->prev, s, 16) == 0) {
+		if (!h->squeezing) {
+			if ((err = room(h)))
+				return err;
+			h->out[h->out_len++] = '*';
+			h->out[h->out_len++] = '\n';
+			h->squeezing = 1;
 		}
-		l[58] = l[59] = ' ';
-		l[76] = '\n';
-		t = l + 77;
+	} else {
+		if ((err = room(h)))
+			return err;
+		h->out_len += canon_line(h->out + h->out_len, h->offset, s, 16);
+		memcpy(h->prev, s, 16);
+		h->have_prev = 1;
+		h->squeezing = 0;
+	}
+	h->offset += 16;
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Append "len" bytes of a stream in the format of "hexdump -C".
+ *  Description:
+ *	Lines span calls, so the stream may be written in chunks of any
+ *	size.  Call jmscott_hexdump_close() to write the final short line and
+ *	the offset of end of stream.
+ *  Returns:
+ *	(char *)0	bytes formatted
+ *	(char *)	write() of full buffer failed, strerror(errno)
+ */
+char *
+jmscott_hexdump_write(struct jmscott_hexdump *h, const void *src, size_t len)
+{
+	const unsigned char *s = src;
+	char *err;
+
+	if (h->nline > 0) {
+		size_t n = 16 - h->nline;
+
+		if (n > len)
+			n = len;
+		memcpy(h->line + h->nline, s, n);
+		h->nline += n;
+		s += n;
+		len -= n;
+		if (h->nline < 16)
+			return (char *)0;
+		h->nline = 0;
+		if ((err = canon_full(h, h->line)))
+			return err;
+	}
+	while (len >= 16) {
+		if ((err = canon_full(h, s)))
+			return err;
+		s += 16;
+		len -= 16;
+	}
+	memcpy(h->line, s, len);
+	h->nline = len;
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Finish a "hexdump -C" stream, then flush all buffered lines.
+ *  Returns:
+ *	(char *)0	all lines written
+ *	(char *)	write() failed, strerror(errno)
+ */
+char *
+jmscott_hexdump_close(struct jmscott_hexdump *h)
+{
+	char *err;
+
+	if ((err = room(h)))
+		return err;
+	if (h->nline > 0) {
+		h->out_len += canon_line(
+				h->out + h->out_len,
+				h->offset,
+				h->line,
+				h->nline
+		);
+		h->offset += h->nline;
+		h->nline = 0;
+	}
+	if (h->offset > 0) {
+		h->out_len += canon_offset(h->out + h->out_len, h->offset);
+		h->out[h->out_len++] = '\n';
 	}
-	tgt[need - 1] = 0;
+	return jmscott_hexdump_flush(h);
 }
@@ -24,6 +24,7 @@
 #include <time.h>
 #include <arpa/inet.h>
 #include <dirent.h>
+#include <limits.h>
 
 /*
  *  Pragmatic, reliable, atomic message size across many protocols, such as
@@ -131,6 +132,60 @@ extern char *	jmscott_strcat11(char *tgt, int tgtsize,
 			const char *src10,
 			const char *src11
 		);
+/*
+ *  Length tracking string builder over a stack or halloc()ed buffer.
+ *  See strbuf.c.
+ */
+struct jmscott_strbuf
+{
+	char	*buf;		//  always null terminated
+	size_t	size;		//  bytes in buf, including the null
+	size_t	len;		//  strlen(buf)
+
+	int	truncated;	//  sticky: some append did not fit
+	int	grow;		//  buf halloc()ed, so double when full
+};
+
+extern void	jmscott_strbuf_init(
+			struct jmscott_strbuf *sb,
+			char *buf,
+			size_t size
+		);
+extern char	*jmscott_strbuf_halloc(
+			struct jmscott_strbuf *sb,
+			void *parent,
+			size_t size
+		);
+extern int	jmscott_strbuf_appendn(
+			struct jmscott_strbuf *sb,
+			const char *src,
+			size_t n
+		);
+extern int	jmscott_strbuf_append(struct jmscott_strbuf *sb, const char *src);
+extern int	jmscott_strbuf_append2(
+			struct jmscott_strbuf *sb,
+			const char *src1,
+			const char *src2
+		);
+extern int	jmscott_strbuf_append3(
+			struct jmscott_strbuf *sb,
+			const char *src1,
+			const char *src2,
+			const char *src3
+		);
+extern int	jmscott_strbuf_append4(
+			struct jmscott_strbuf *sb,
+			const char *src1,
+			const char *src2,
+			const char *src3,
+			const char *src4
+		);
+extern int	jmscott_strbuf_append_int(struct jmscott_strbuf *sb, long long ll);
+extern int	jmscott_strbuf_append_RFC3339Nano(
+			struct jmscott_strbuf *sb,
+			struct timespec *ts
+		);
+
 extern char 	*jmscott_ulltoa(unsigned long long ull, char *digits);
 extern char 	*jmscott_lltoa(long long ull, char *digits);
 extern char	*jmscott_a2ui63(char *a, unsigned long long *ull);
@@ -164,10 +219,100 @@ extern void	jmscott_die6(
 			char *msg6
 		);
 extern void	jmscott_die_argc(int status, int got, int expect, char *usage);
+extern void	jmscott_stderr3(char *msg1, char *msg2, char *msg3);
 extern void	jmscott_panic(char *msg);
 extern void	jmscott_panic2(char *msg1, char *msg2);
 
+/*
+ *  Leveled log records, safe in signal handlers.  See log.c.
+ */
+#define JMSCOTT_LOG_DEBUG	10
+#define JMSCOTT_LOG_INFO	20
+#define JMSCOTT_LOG_WARN	30
+#define JMSCOTT_LOG_ERROR	40
+
+extern int	jmscott_log_level;		//  default JMSCOTT_LOG_INFO
+extern int	jmscott_log_fd;			//  default 2
+extern int	jmscott_log_buffered;		//  hold records below WARN
+
+extern void	jmscott_log_msgs(int level, char **msgs, int nmsg);
+extern char	*jmscott_log_flush();
+
+//  arguments are evaluated only when the level is enabled
+#define JMSCOTT_LOG(level, ...)						\
+	do {								\
+		if ((level) >= jmscott_log_level)			\
+			jmscott_log_msgs(				\
+				(level),				\
+				(char *[]){__VA_ARGS__},		\
+				sizeof (char *[]){__VA_ARGS__} /	\
+							sizeof (char *)	\
+			);						\
+	} while (0)
+
+#define jmscott_debug(...)	JMSCOTT_LOG(JMSCOTT_LOG_DEBUG, __VA_ARGS__)
+#define jmscott_info(...)	JMSCOTT_LOG(JMSCOTT_LOG_INFO, __VA_ARGS__)
+#define jmscott_warn(...)	JMSCOTT_LOG(JMSCOTT_LOG_WARN, __VA_ARGS__)
+#define jmscott_error(...)	JMSCOTT_LOG(JMSCOTT_LOG_ERROR, __VA_ARGS__)
+
 extern char *	jmscott_frisk_udig(char *udig);
+extern char *	jmscott_frisk_udign(const char *udig, size_t len);
+extern char *	jmscott_frisk_udig_len(const char *udig, size_t *len);
+
+/*
+ *  Incremental digest for computing udigs "sha256:..." and "blake2b:...".
+ *  See digest.c.
+ */
+#define JMSCOTT_DIGEST_SHA256	1
+#define JMSCOTT_DIGEST_BLAKE2B	2
+
+//  longest udig, including null: [a-z][a-z0-9]{0,7}:[[:graph:]]{32,128}
+#define JMSCOTT_UDIG_SIZE	(8 + 1 + 128 + 1)
+
+struct jmscott_digest
+{
+	int			algo;		//  JMSCOTT_DIGEST_*
+	unsigned int		nbuf;		//  bytes pending in block[]
+	unsigned long long	length;		//  byte counter, per algorithm
+	unsigned char		block[128];
+	union {
+		unsigned int		sha256[8];
+		unsigned long long	blake2b[8];
+	} h;
+};
+
+extern char *	jmscott_digest_init(struct jmscott_digest *d, const char *algo);
+extern void	jmscott_digest_update(
+			struct jmscott_digest *d,
+			const void *src,
+			size_t len
+		);
+extern char *	jmscott_digest_udig(
+			struct jmscott_digest *d,
+			char *udig,
+			size_t udig_size
+		);
+extern char *	jmscott_udig_buf(
+			const char *algo,
+			const void *src,
+			size_t len,
+			char *udig,
+			size_t udig_size
+		);
+extern char *	jmscott_udig_fd(
+			const char *algo,
+			int fd,
+			char *udig,
+			size_t udig_size,
+			unsigned long long *nbytes
+		);
+extern char *	jmscott_udig_file(
+			const char *algo,
+			int fd,
+			char *udig,
+			size_t udig_size,
+			unsigned long long *nbytes
+		);
 
 //  map sql state codes onto process exit status.
 //  only used when query faults.  caller code
@@ -189,6 +334,52 @@ extern void jmscott_ecpg_fault(
 
 extern void	jmscott_ecpg_error(struct jmscott_ecpg_state_fault *fault);
 extern void	jmscott_ecpg_warning(struct jmscott_ecpg_state_fault *fault);
+extern int	jmscott_ecpg_state_action(
+			struct jmscott_ecpg_state_fault *fault,
+			const char *sql_state
+		);
+
+/*
+ *  Pipelined statements over libpq.  See pq.c.
+ *  struct pg_conn is the PGconn of libpq-fe.h.
+ */
+struct pg_conn;
+
+//  default syncs in flight before reading results
+#define JMSCOTT_PQ_PIPELINE_WINDOW	256
+
+struct jmscott_pq_pipeline
+{
+	struct pg_conn			*conn;
+	struct jmscott_ecpg_state_fault	*fault;
+	int				batch;		//  statements per sync
+	int				window;		//  syncs in flight
+	int				npending;	//  since last sync
+	int				nsync_pending;
+	int				status;		//  exit status of fault
+
+	unsigned long long		nexec;
+	unsigned long long		nsync;
+	unsigned long long		nignored;
+	unsigned long long		naborted;	//  rolled back by fault
+
+	char				err[JMSCOTT_ATOMIC_WRITE_SIZE];
+};
+
+extern char	*jmscott_pq_pipeline_begin(
+			struct jmscott_pq_pipeline *p,
+			struct pg_conn *conn,
+			struct jmscott_ecpg_state_fault *fault,
+			int batch,
+			int window
+		);
+extern char	*jmscott_pq_pipeline_exec(
+			struct jmscott_pq_pipeline *p,
+			const char *sql,
+			int nparam,
+			const char * const *values
+		);
+extern char	*jmscott_pq_pipeline_end(struct jmscott_pq_pipeline *p);
 
 struct jmscott_halloc_callback
 {
@@ -216,6 +407,72 @@ extern void	jmscott_hexdump(
 			int tgt_size
 );
 
+/*
+ *  Buffered hexdump stream, in trace or "hexdump -C" format.
+ *  See hexdump.c.
+ */
+struct jmscott_hexdump
+{
+	int			fd;
+	int			squeeze;	//  "*" for repeated lines
+	int			have_prev;
+	int			squeezing;
+	int			nline;		//  bytes pending in line[]
+	unsigned long long	offset;		//  bytes in full lines
+	unsigned char		line[16];
+	unsigned char		prev[16];
+	size_t			out_len;
+	char			out[16 * 1024];	//  must be last, see init
+};
+
+extern void	jmscott_hexdump_init(struct jmscott_hexdump *h, int fd);
+extern char	*jmscott_hexdump_trace(
+			struct jmscott_hexdump *h,
+			char direction,
+			const void *src,
+			size_t len
+		);
+extern char	*jmscott_hexdump_write(
+			struct jmscott_hexdump *h,
+			const void *src,
+			size_t len
+		);
+extern char	*jmscott_hexdump_flush(struct jmscott_hexdump *h);
+extern char	*jmscott_hexdump_close(struct jmscott_hexdump *h);
+
+/*
+ *  Decode trace, "hexdump -C" or xxd text back into bytes.
+ *  See unhexdump.c.
+ */
+struct jmscott_unhexdump
+{
+	int			fd;
+	char			direction;	//  trace: '<', '>' or 0 for all
+	int			squeezing;	//  "*" seen
+	int			nprev;		//  bytes in prev[]
+	unsigned long long	line_no;
+	unsigned long long	offset;		//  expected offset of next line
+	unsigned char		prev[256];
+	size_t			nin;		//  partial line in in[]
+	char			in[1024];
+	size_t			out_len;
+	unsigned char		out[64 * 1024];	//  must be last, see init
+};
+
+extern void	jmscott_unhexdump_init(struct jmscott_unhexdump *u, int fd);
+extern char	*jmscott_unhexdump_line(
+			struct jmscott_unhexdump *u,
+			const char *line,
+			size_t len
+		);
+extern char	*jmscott_unhexdump_write(
+			struct jmscott_unhexdump *u,
+			const char *src,
+			size_t len
+		);
+extern char	*jmscott_unhexdump_flush(struct jmscott_unhexdump *u);
+extern char	*jmscott_unhexdump_close(struct jmscott_unhexdump *u);
+
 extern ssize_t	jmscott_read(int fd, void *p, ssize_t nbytes);
 extern int	jmscott_poll_POLLIN(int fd, int millisec);
 extern ssize_t	jmscott_read_timeout(
@@ -268,6 +525,150 @@ extern int	jmscott_faccessat(
 			int flag
 		);
 extern char	*jmscott_fsizeat(int at_fd, const char *path, off_t *size);
+extern char	*jmscott_read_paths(
+			int fd,
+			char term,
+			char ***paths,
+			size_t *npath
+		);
+extern int	jmscott_fsync(int fd);
+extern int	jmscott_fdatasync(int fd);
+
+/*
+ *  Crash safe replacement of a file.  See jmscott_replace_open() in file.c.
+ */
+struct jmscott_replace
+{
+	int		fd;				//  write new contents
+	int		dir_fd;				//  parent of target
+	int		linked;				//  tmp_name in dir_fd
+	char		name[NAME_MAX + 1];		//  target in dir_fd
+	char		tmp_name[NAME_MAX + 1];		//  ".name~pid.seq"
+};
+
+#define JMSCOTT_REPLACE_BATCH	64
+
+struct jmscott_replace_batch
+{
+	int			count;
+	unsigned long long	nfsync_dir;
+	struct jmscott_replace	pending[JMSCOTT_REPLACE_BATCH];
+};
+
+extern char	*jmscott_replace_open(
+			struct jmscott_replace *r,
+			int at_fd,
+			const char *path,
+			mode_t mode
+		);
+extern char	*jmscott_replace_commit(
+			struct jmscott_replace *r,
+			struct jmscott_replace_batch *batch
+		);
+extern void	jmscott_replace_abort(struct jmscott_replace *r);
+extern void	jmscott_replace_batch_init(struct jmscott_replace_batch *b);
+extern char	*jmscott_replace_batch_sync(struct jmscott_replace_batch *b);
+
+#define JMSCOTT_UTF8_SCALAR	0
+#define JMSCOTT_UTF8_SSE4	1
+#define JMSCOTT_UTF8_AVX2	2
+#define JMSCOTT_UTF8_AVX512	3
+
+/*
+ *  Streaming UTF-8 validator.  bad_offset is the stream offset of the
+ *  first invalid sequence.
+ */
+struct jmscott_utf8
+{
+	int			simd;		//  JMSCOTT_UTF8_* kernel
+	int			state;		//  0 between chars
+	unsigned int		code_point;
+	int			bad;
+	unsigned long long	offset;		//  bytes validated
+	unsigned long long	start;		//  offset of current sequence
+	unsigned long long	bad_offset;
+
+	int			count;		//  tally ncode[]
+	unsigned long long	ncode[4];	//  code points of 1 to 4 bytes
+};
+
+extern void	jmscott_utf8_init(struct jmscott_utf8 *u);
+extern int	jmscott_utf8_write(
+			struct jmscott_utf8 *u,
+			const void *src,
+			size_t len
+		);
+extern int	jmscott_utf8_close(struct jmscott_utf8 *u);
+extern int	jmscott_utf8_simd(void);
+extern char	*jmscott_utf8_simd_name(int simd);
+extern int	jmscott_isutf8_len(const void *src, size_t len);
+
+/*
+ *  Batched udp socket.  After jmscott_udp_recv(), msg[0 .. count-1] are the
+ *  datagrams received.
+ */
+struct jmscott_udp_msg
+{
+	char			*buf;		//  msg_size bytes in ring
+	size_t			len;
+	unsigned int		segment_size;	//  gro: coalesced datagram size
+	socklen_t		addr_len;
+	struct sockaddr_storage	addr;
+};
+
+struct jmscott_udp
+{
+	int			fd;
+	int			family;
+	unsigned int		nmsg;		//  messages in ring
+	size_t			msg_size;	//  bytes per message buffer
+	unsigned int		count;		//  received
+	unsigned int		nqueued;	//  put, not yet sent
+	int			gro;
+	int			gso_size;
+	int			rcvbuf;		//  actual size, set by kernel
+
+	struct jmscott_udp_msg	*msg;
+	void			*mmsg;		//  struct mmsghdr[nmsg]
+	char			*control;	//  cmsg space per message
+
+	unsigned long long	nrecv;
+	unsigned long long	nsend;
+	unsigned long long	nrecv_call;
+	unsigned long long	nsend_call;
+	unsigned long long	nsend_drop;	//  undeliverable, dropped
+};
+
+extern char	*jmscott_udp_open(
+			struct jmscott_udp *u,
+			int family,
+			unsigned int nmsg,
+			size_t msg_size
+		);
+extern char	*jmscott_udp_reuseport(struct jmscott_udp *u);
+extern char	*jmscott_udp_rcvbuf(struct jmscott_udp *u, int size);
+extern char	*jmscott_udp_gro(struct jmscott_udp *u);
+extern char	*jmscott_udp_gso(struct jmscott_udp *u, int segment_size);
+extern char	*jmscott_udp_bind(
+			struct jmscott_udp *u,
+			const struct sockaddr *addr,
+			socklen_t addr_len
+		);
+extern char	*jmscott_udp_connect(
+			struct jmscott_udp *u,
+			const struct sockaddr *addr,
+			socklen_t addr_len
+		);
+extern char	*jmscott_udp_recv(struct jmscott_udp *u);
+extern char	*jmscott_udp_put(
+			struct jmscott_udp *u,
+			const void *buf,
+			size_t len,
+			const struct sockaddr *addr,
+			socklen_t addr_len
+		);
+extern char	*jmscott_udp_flush(struct jmscott_udp *u);
+extern char	*jmscott_udp_close(struct jmscott_udp *u);
 
 struct jmscott_json
 {
@@ -306,18 +707,131 @@ extern char			*jmscott_RFC3339Nano_now(
 					char *buf,
 					int buf_size
 				);
+extern char			*jmscott_RFC3339Nano_timespec(
+					char *buf,
+					int buf_size,
+					struct timespec *ts
+				);
+extern char			*jmscott_RFC3339_parse(
+					const char *src,
+					size_t len,
+					long long *epoch_nsec,
+					size_t *nparsed
+				);
 extern char			*jmscott_net_32addr2text(u_long addr);
+
+//  text sizes, including null: dotted quad, rfc5952 and "[ip6]:port"
+#define JMSCOTT_INET4_TEXT_SIZE		16
+#define JMSCOTT_INET6_TEXT_SIZE		46
+#define JMSCOTT_SOCKADDR_TEXT_SIZE	54
+
+extern char			*jmscott_inet4_format(
+					const unsigned char *addr,
+					char *tgt
+				);
+extern char			*jmscott_inet6_format(
+					const unsigned char *addr,
+					char *tgt
+				);
+extern char			*jmscott_sockaddr_format(
+					const void *sockaddr,
+					char *tgt
+				);
+extern char			*jmscott_inet4_parse(
+					const char *src,
+					size_t len,
+					unsigned char *addr
+				);
+extern char			*jmscott_inet6_parse(
+					const char *src,
+					size_t len,
+					unsigned char *addr
+				);
+extern char			*jmscott_sockaddr_parse(
+					const char *src,
+					size_t len,
+					struct sockaddr_storage *ss,
+					socklen_t *addr_len
+				);
 extern int			jmscott_flock(int fd, int op);
 extern char			*jmscott_send_file(
 					int in_fd,
 					int out_fd,
 					long long *send_size
 				);
+extern char			*jmscott_send_file_udig(
+					int in_fd,
+					int out_fd,
+					const char *algo,
+					char *udig,
+					size_t udig_size,
+					long long *send_size
+				);
+extern char			*jmscott_digest_copy(
+					int in_fd,
+					int out_fd,
+					struct jmscott_digest *digests,
+					int ndigest,
+					unsigned long long *copy_size
+				);
 char *				jmscott_mkdirat_path(
 					int at_fd,
 					char *path,
 					mode_t mode
 				);
+/*
+ *  Cache of directories made by jmscott_dir_cache_mkdir().  See dir.c.
+ */
+struct jmscott_dir_cache_slot
+{
+	unsigned int		hash;
+	unsigned int		name;		//  offset of path in c->names
+	unsigned int		len;		//  0 is an empty slot
+	int			fd;		//  O_PATH dir or -1
+};
+
+struct jmscott_dir_cache
+{
+	int				at_fd;
+	mode_t				mode;
+	int				max_open;
+	int				nopen;
+	struct jmscott_dir_cache_slot	*slots;		//  child of names
+	unsigned int			nslot;		//  power of 2
+	unsigned int			count;
+	char				*names;		//  halloc()ed
+	size_t				names_len;
+	size_t				names_size;
+
+	unsigned long long		nhit;
+	unsigned long long		nmkdir;
+};
+
+char *				jmscott_dir_cache_init(
+					struct jmscott_dir_cache *c,
+					void *parent,
+					int at_fd,
+					mode_t mode,
+					int max_open
+				);
+char *				jmscott_dir_cache_mkdir(
+					struct jmscott_dir_cache *c,
+					const char *path,
+					int *dir_fd
+				);
+char *				jmscott_dir_cache_open(
+					struct jmscott_dir_cache *c,
+					const char *path,
+					int oflag,
+					mode_t mode,
+					int *fd
+				);
+void				jmscott_dir_cache_clear(
+					struct jmscott_dir_cache *c
+				);
+void				jmscott_dir_cache_free(
+					struct jmscott_dir_cache *c
+				);
 int				jmscott_renameat(
 					int at_fd_old,
 					const char *old_path,
@@ -326,6 +840,77 @@ int				jmscott_renameat(
 				);
 int				jmscott_rename(char *old_path, char *new_path);
 int				jmscott_fchmod(int fd, mode_t mode);
+/*
+ *  Directory entries from jmscott_scan_dir(), names in one block.
+ *  See dir.c.
+ */
+struct jmscott_dir_entry
+{
+	unsigned long long	ino;
+	unsigned int		name;		//  offset of name in scan->names
+	unsigned char		type;		//  DT_*, maybe DT_UNKNOWN
+};
+
+struct jmscott_dir_scan
+{
+	char				*names;		//  halloc()ed
+	struct jmscott_dir_entry	*entries;	//  child of names
+	int				count;
+};
+
+#define JMSCOTT_DIR_ENTRY_NAME(scan, i)	\
+	((scan)->names + (scan)->entries[i].name)
+
+char *				jmscott_scan_dir(
+					int dir_fd,
+					int (*filter)(
+						const char *name,
+						unsigned char d_type,
+						void *private
+					),
+					void *private,
+					void *parent,
+					struct jmscott_dir_scan *scan
+				);
+/*
+ *  Parallel directory tree walk.  See jmscott_walk() in dir.c.
+ */
+struct jmscott_walk_entry
+{
+	const char		*path;		//  root relative, like find
+	size_t			path_len;
+	const char		*name;		//  last component of path
+	int			dir_fd;		//  open parent, for *at() calls
+	int			depth;		//  root is 0
+	unsigned char		type;		//  DT_*
+	int			have_stat;
+	struct stat		st;
+	int			thread;		//  0 <= thread < nthread
+};
+
+struct jmscott_walk
+{
+	int		nthread;		//  0 is online cpus
+	int		stat;			//  stat() every entry
+	unsigned int	statx_mask;		//  linux: statx() STATX_* only
+	int		statx_dont_sync;	//  linux: AT_STATX_DONT_SYNC
+	int		max_depth;		//  0 is unlimited
+	int		one_file_system;	//  like find -xdev
+
+	int		(*filter)(struct jmscott_walk_entry *e, void *private);
+	int		(*callback)(struct jmscott_walk_entry *e, void *private);
+	int		(*on_error)(const char *path, char *err, void *private);
+	void		*private;
+
+	unsigned long long	nentry;
+	unsigned long long	ndir;
+	unsigned long long	nerror;
+};
+
+char *				jmscott_walk(
+					struct jmscott_walk *w,
+					const char *root
+				);
 DIR *				jmscott_fdopendir(int dir_fd);
 struct dirent *			jmscott_readdir(DIR *dp);
 int				jmscott_closedir(DIR *dp);
@@ -341,4 +926,43 @@ extern char			*jmscott_progname;
 int				jmscott_isgraph(char *str);
 int				jmscott_isdigit(char *str);
 
+/*
+ *  256 bit membership bitmap of byte values, for jmscott_span_class().
+ *  Build with jmscott_char_class_{zero,add,add_range}(), since the
+ *  nibble tables for the simd kernels are derived from the bitmap.
+ */
+struct jmscott_char_class
+{
+	unsigned long long	bits[4];
+
+	unsigned char		row_lo[16];	//  rows 0x0? - 0x7?
+	unsigned char		row_hi[16];	//  rows 0x8? - 0xf?
+};
+
+extern void			jmscott_char_class_zero(
+					struct jmscott_char_class *cc
+				);
+extern void			jmscott_char_class_add(
+					struct jmscott_char_class *cc,
+					const char *chars
+				);
+extern void			jmscott_char_class_add_range(
+					struct jmscott_char_class *cc,
+					unsigned char lo,
+					unsigned char hi
+				);
+extern size_t			jmscott_span_class(
+					const struct jmscott_char_class *cc,
+					const char *src,
+					size_t len
+				);
+extern size_t			jmscott_span_range(
+					const char *src,
+					size_t len,
+					unsigned char lo,
+					unsigned char hi
+				);
+extern size_t			jmscott_isgraph_len(const char *str, size_t len);
+extern size_t			jmscott_isdigit_len(const char *str, size_t len);
+
 #endif //  JMSCOTT_LIBJMSCOTT_H
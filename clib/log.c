@@ -0,0 +1,226 @@
+/*
+ *  Synopsis:
+ *	Leveled log records, safe in signal handlers.
+ *  Usage:
+ *	#include "jmscott/libjmscott.h"
+ *
+ *	jmscott_log_level = JMSCOTT_LOG_DEBUG;
+ *	jmscott_info("postmaster pid", pid);
+ *	jmscott_error("kill(postmaster, INT) failed", strerror(errno));
+ *  Description:
+ *	Each record is a single line
+ *
+ *	    2024-05-01T14:02:11.123456789+00:00 pg_launchd: #73: WARN: msg
+ *
+ *	of RFC3339 time, jmscott_progname, pid, level and the messages
+ *	separated by ": ", written to jmscott_log_fd, by default stderr.
+ *
+ *	The macros jmscott_{debug,info,warn,error}() test the level before
+ *	evaluating any argument, so a disabled level costs one compare.
+ *
+ *	Records are formatted on the stack, no malloc() or stdio, then
+ *	written with the records pending in the per thread ring in one
+ *	writev().  With jmscott_log_buffered set, records below WARN stay in
+ *	the ring until it fills, a WARN or ERROR record, or a call to
+ *	jmscott_log_flush(), trading latency for fewer system calls.
+ *
+ *	A signal handler that interrupts a log call in the same thread
+ *	writes its record directly, bypassing the ring, so may appear
+ *	before records buffered by the interrupted code.  errno is
+ *	preserved.
+ *  Note:
+ *	Records longer than JMSCOTT_ATOMIC_WRITE_SIZE are truncated, but
+ *	always end with a new line.
+ */
+#include <sys/errno.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jmscott/libjmscott.h"
+
+extern int	errno;
+
+int	jmscott_log_level = JMSCOTT_LOG_INFO;
+int	jmscott_log_fd = 2;
+int	jmscott_log_buffered = 0;
+
+#define RING_SIZE	(8 * 1024)
+
+static __thread struct
+{
+	volatile sig_atomic_t	busy;		//  ring being updated
+	size_t			head;
+	size_t			len;
+	char			buf[RING_SIZE];
+} ring;
+
+static const char *
+level_name(int level)
+{
+	if (level >= JMSCOTT_LOG_ERROR)
+		return "ERROR";
+	if (level >= JMSCOTT_LOG_WARN)
+		return "WARN";
+	if (level >= JMSCOTT_LOG_INFO)
+		return "INFO";
+	return "DEBUG";
+}
+
+/*
+ *  writev() all of the iovecs, restarting on interrupt or partial write.
+ */
+static int
+writev_all(int fd, struct iovec *iov, int niov)
+{
+	while (niov > 0) {
+		ssize_t nw = writev(fd, iov, niov);
+
+		if (nw < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		while (niov > 0 && (size_t)nw >= iov->iov_len) {
+			nw -= iov->iov_len;
+			iov++;
+			niov--;
+		}
+		if (niov > 0) {
+			iov->iov_base = (char *)iov->iov_base + nw;
+			iov->iov_len -= nw;
+		}
+	}
+	return 0;
+}
+
+/*
+ *  Write the ring, wrapped in at most two pieces, plus "len" bytes of
+ *  "rec", then empty the ring.
+ */
+static int
+ring_write(const char *rec, size_t len)
+{
+	struct iovec iov[3];
+	int niov = 0;
+	size_t first = ring.len;
+
+	if (ring.head + first > RING_SIZE)
+		first = RING_SIZE - ring.head;
+	if (first > 0) {
+		iov[niov].iov_base = ring.buf + ring.head;
+		iov[niov++].iov_len = first;
+	}
+	if (ring.len > first) {
+		iov[niov].iov_base = ring.buf;
+		iov[niov++].iov_len = ring.len - first;
+	}
+	if (len > 0) {
+		iov[niov].iov_base = (char *)rec;
+		iov[niov++].iov_len = len;
+	}
+	ring.head = ring.len = 0;
+	return writev_all(jmscott_log_fd, iov, niov);
+}
+
+/*
+ *  Append a record to the ring, which has room.
+ */
+static void
+ring_put(const char *rec, size_t len)
+{
+	size_t tail = (ring.head + ring.len) % RING_SIZE;
+	size_t first = RING_SIZE - tail;
+
+	if (first > len)
+		first = len;
+	memcpy(ring.buf + tail, rec, first);
+	memcpy(ring.buf, rec + first, len - first);
+	ring.len += len;
+}
+
+/*
+ *  Synopsis:
+ *	Format and log a record of "nmsg" messages at "level".
+ *  Description:
+ *	Typically called via the macros JMSCOTT_LOG() or jmscott_info(),
+ *	etc., which skip the call when the level is disabled.
+ */
+void
+jmscott_log_msgs(int level, char **msgs, int nmsg)
+{
+	char buf[JMSCOTT_ATOMIC_WRITE_SIZE];
+	struct jmscott_strbuf rec;
+	struct timespec now;
+	int i, e = errno;
+
+	if (level < jmscott_log_level)
+		return;
+
+	//  reserve a byte for the trailing new line
+	jmscott_strbuf_init(&rec, buf, sizeof buf - 1);
+
+	if (clock_gettime(CLOCK_REALTIME, &now) == 0)
+		jmscott_strbuf_append_RFC3339Nano(&rec, &now);
+	jmscott_strbuf_append(&rec, " ");
+	if (jmscott_progname)
+		jmscott_strbuf_append2(&rec, jmscott_progname, ": ");
+	jmscott_strbuf_append(&rec, "#");
+	jmscott_strbuf_append_int(&rec, getpid());
+	jmscott_strbuf_append3(&rec, ": ", level_name(level), ": ");
+	for (i = 0;  i < nmsg;  i++) {
+		if (i > 0)
+			jmscott_strbuf_append(&rec, ": ");
+		jmscott_strbuf_append(&rec, msgs[i]);
+	}
+	buf[rec.len++] = '\n';
+
+	//  interrupted a log call in this thread, so leave the ring be
+
+	if (ring.busy) {
+		struct iovec iov = {buf, rec.len};
+
+		(void)writev_all(jmscott_log_fd, &iov, 1);
+		errno = e;
+		return;
+	}
+	ring.busy = 1;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+	if (jmscott_log_buffered && level < JMSCOTT_LOG_WARN &&
+	    ring.len + rec.len <= RING_SIZE)
+		ring_put(buf, rec.len);
+	else
+		(void)ring_write(buf, rec.len);
+
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	ring.busy = 0;
+	errno = e;
+}
+
+/*
+ *  Synopsis:
+ *	Write the records buffered by the calling thread.
+ *  Returns:
+ *	(char *)0	written, or ring busy in an interrupted log call
+ *	(char *)	writev() failed, strerror(errno)
+ */
+char *
+jmscott_log_flush()
+{
+	char *err = (char *)0;
+	int e = errno;
+
+	if (ring.busy || ring.len == 0)
+		return (char *)0;
+	ring.busy = 1;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	if (ring_write((char *)0, 0) < 0)
+		err = strerror(errno);
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	ring.busy = 0;
+	errno = e;
+	return err;
+}
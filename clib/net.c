@@ -1,49 +1,971 @@
 /*
- *  Convert 32 bit internet address to dotted text, rotating through
- *  static buffer pool.
+ *  Synopsis:
+ *	Internet addresses and batched udp sockets.
+ *  Description:
+ *	A struct jmscott_udp owns a socket and a ring of nmsg preallocated
+ *	message buffers, read in one recvmmsg() or written in one sendmmsg(),
+ *	so a busy receiver makes one system call per ring, not per datagram.
  *
+ *		struct jmscott_udp u;
+ *
+ *		jmscott_udp_open(&u, AF_INET, 256, 2048);
+ *		jmscott_udp_reuseport(&u);		//  one socket per thread
+ *		jmscott_udp_rcvbuf(&u, 16 * 1024 * 1024);
+ *		jmscott_udp_bind(&u, (struct sockaddr *)&sin, sizeof sin);
+ *		while (jmscott_udp_recv(&u) == (char *)0)
+ *			for (i = 0;  i < u.count;  i++)
+ *				work(u.msg[i].buf, u.msg[i].len);
+ *
+ *	Sockets sharing a port via jmscott_udp_reuseport() are load balanced
+ *	by the kernel on a hash of the peer, so each thread may own a socket
+ *	with no locking.
+ *
+ *	jmscott_udp_gro() lets linux coalesce datagrams of a flow into a
+ *	single message with msg[i].segment_size set to the size of each
+ *	datagram, the last possibly shorter.  Buffers must then be 64KB.
+ *	jmscott_udp_gso() is the reverse for sending: each message put is
+ *	split by the kernel, or nic, into datagrams of the segment size.
+ *
+ *	A ring either receives or sends, since both share the buffers.
+ *	u->count is the number received by the last jmscott_udp_recv() and
+ *	u->nqueued the number put but not yet sent.  jmscott_udp_put()
+ *	fails while received datagrams remain, so set u->count to 0 when
+ *	done with them, and jmscott_udp_recv() fails while datagrams are
+ *	queued, so flush first.
  *  Note:
- *	Need to replace static buf rotator code with hypothetical
- *	jmscott_str*() family!
+ *	Without recvmmsg(), i.e. not linux or freebsd, the batch is a loop
+ *	of recvmsg() or sendmsg().
  *
- *	Derived from code written by https://github.com/akfullfo.
+ *	jmscott_net_32addr2text() derived from code written by
+ *	https://github.com/akfullfo.
  */
+#ifdef __linux__
+#define _GNU_SOURCE		//  recvmmsg(), sendmmsg()
+#endif
+
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "jmscott/libjmscott.h"
 
+extern int	errno;
+
+#if defined(__linux__) || defined(__FreeBSD__)
+#define HAVE_MMSG
+#else
+struct mmsghdr
+{
+	struct msghdr	msg_hdr;
+	unsigned int	msg_len;
+};
+
+//  flags are ignored by the recvmmsg() emulation below
+#ifndef MSG_WAITFORONE
+#define MSG_WAITFORONE	0
+#endif
+#endif
+
+#if defined(__linux__) && defined(UDP_GRO)
+#define CONTROL_SIZE	CMSG_SPACE(sizeof (int))
+#else
+#define CONTROL_SIZE	0
+#endif
+
+//  decimal text of each byte, for dotted quads
+static const struct
+{
+	char		digits[4];
+	unsigned char	len;
+} dec[256] =
+{
+	{"0", 1}, {"1", 1}, {"2", 1}, {"3", 1}, {"4", 1}, {"5", 1},
+	{"6", 1}, {"7", 1}, {"8", 1}, {"9", 1}, {"10", 2}, {"11", 2},
+	{"12", 2}, {"13", 2}, {"14", 2}, {"15", 2}, {"16", 2}, {"17", 2},
+	{"18", 2}, {"19", 2}, {"20", 2}, {"21", 2}, {"22", 2}, {"23", 2},
+	{"24", 2}, {"25", 2}, {"26", 2}, {"27", 2}, {"28", 2}, {"29", 2},
+	{"30", 2}, {"31", 2}, {"32", 2}, {"33", 2}, {"34", 2}, {"35", 2},
+	{"36", 2}, {"37", 2}, {"38", 2}, {"39", 2}, {"40", 2}, {"41", 2},
+	{"42", 2}, {"43", 2}, {"44", 2}, {"45", 2}, {"46", 2}, {"47", 2},
+	{"48", 2}, {"49", 2}, {"50", 2}, {"51", 2}, {"52", 2}, {"53", 2},
+	{"54", 2}, {"55", 2}, {"56", 2}, {"57", 2}, {"58", 2}, {"59", 2},
+	{"60", 2}, {"61", 2}, {"62", 2}, {"63", 2}, {"64", 2}, {"65", 2},
+	{"66", 2}, {"67", 2}, {"68", 2}, {"69", 2}, {"70", 2}, {"71", 2},
+	{"72", 2}, {"73", 2}, {"74", 2}, {"75", 2}, {"76", 2}, {"77", 2},
+	{"78", 2}, {"79", 2}, {"80", 2}, {"81", 2}, {"82", 2}, {"83", 2},
+	{"84", 2}, {"85", 2}, {"86", 2}, {"87", 2}, {"88", 2}, {"89", 2},
+	{"90", 2}, {"91", 2}, {"92", 2}, {"93", 2}, {"94", 2}, {"95", 2},
+	{"96", 2}, {"97", 2}, {"98", 2}, {"99", 2}, {"100", 3}, {"101", 3},
+	{"102", 3}, {"103", 3}, {"104", 3}, {"105", 3}, {"106", 3}, {"107", 3},
+	{"108", 3}, {"109", 3}, {"110", 3}, {"111", 3}, {"112", 3}, {"113", 3},
+	{"114", 3}, {"115", 3}, {"116", 3}, {"117", 3}, {"118", 3}, {"119", 3},
+	{"120", 3}, {"121", 3}, {"122", 3}, {"123", 3}, {"124", 3}, {"125", 3},
+	{"126", 3}, {"127", 3}, {"128", 3}, {"129", 3}, {"130", 3}, {"131", 3},
+	{"132", 3}, {"133", 3}, {"134", 3}, {"135", 3}, {"136", 3}, {"137", 3},
+	{"138", 3}, {"139", 3}, {"140", 3}, {"141", 3}, {"142", 3}, {"143", 3},
+	{"144", 3}, {"145", 3}, {"146", 3}, {"147", 3}, {"148", 3}, {"149", 3},
+	{"150", 3}, {"151", 3}, {"152", 3}, {"153", 3}, {"154", 3}, {"155", 3},
+	{"156", 3}, {"157", 3}, {"158", 3}, {"159", 3}, {"160", 3}, {"161", 3},
+	{"162", 3}, {"163", 3}, {"164", 3}, {"165", 3}, {"166", 3}, {"167", 3},
+	{"168", 3}, {"169", 3}, {"170", 3}, {"171", 3}, {"172", 3}, {"173", 3},
+	{"174", 3}, {"175", 3}, {"176", 3}, {"177", 3}, {"178", 3}, {"179", 3},
+	{"180", 3}, {"181", 3}, {"182", 3}, {"183", 3}, {"184", 3}, {"185", 3},
+	{"186", 3}, {"187", 3}, {"188", 3}, {"189", 3}, {"190", 3}, {"191", 3},
+	{"192", 3}, {"193", 3}, {"194", 3}, {"195", 3}, {"196", 3}, {"197", 3},
+	{"198", 3}, {"199", 3}, {"200", 3}, {"201", 3}, {"202", 3}, {"203", 3},
+	{"204", 3}, {"205", 3}, {"206", 3}, {"207", 3}, {"208", 3}, {"209", 3},
+	{"210", 3}, {"211", 3}, {"212", 3}, {"213", 3}, {"214", 3}, {"215", 3},
+	{"216", 3}, {"217", 3}, {"218", 3}, {"219", 3}, {"220", 3}, {"221", 3},
+	{"222", 3}, {"223", 3}, {"224", 3}, {"225", 3}, {"226", 3}, {"227", 3},
+	{"228", 3}, {"229", 3}, {"230", 3}, {"231", 3}, {"232", 3}, {"233", 3},
+	{"234", 3}, {"235", 3}, {"236", 3}, {"237", 3}, {"238", 3}, {"239", 3},
+	{"240", 3}, {"241", 3}, {"242", 3}, {"243", 3}, {"244", 3}, {"245", 3},
+	{"246", 3}, {"247", 3}, {"248", 3}, {"249", 3}, {"250", 3}, {"251", 3},
+	{"252", 3}, {"253", 3}, {"254", 3}, {"255", 3},
+};
+
+static const char hex[] = "0123456789abcdef";
+
+/*
+ *  Synopsis:
+ *	Format a 4 byte ipv4 address, network order, as a dotted quad.
+ *  Description:
+ *	"tgt" must hold JMSCOTT_INET4_TEXT_SIZE chars.  The text is null
+ *	terminated.  No locks, no allocation, safe in threads and signal
+ *	handlers.
+ *  Returns:
+ *	Pointer to the null at the end of the text.
+ */
+char *
+jmscott_inet4_format(const unsigned char *addr, char *tgt)
+{
+	int i;
+
+	for (i = 0;  i < 4;  i++) {
+		if (i > 0)
+			*tgt++ = '.';
+		memcpy(tgt, dec[addr[i]].digits, 4);
+		tgt += dec[addr[i]].len;
+	}
+	*tgt = 0;
+	return tgt;
+}
+
+/*
+ *  Synopsis:
+ *	Format a 16 byte ipv6 address, network order, as rfc5952 text.
+ *  Description:
+ *	Hex digits are lower case with no leading zeros, the first longest
+ *	run of two or more zero groups is compressed to "::", and ipv4 mapped
+ *	addresses end in a dotted quad, "::ffff:10.1.2.3".
+ *
+ *	"tgt" must hold JMSCOTT_INET6_TEXT_SIZE chars.  The text is null
+ *	terminated.
+ *  Returns:
+ *	Pointer to the null at the end of the text.
+ */
+char *
+jmscott_inet6_format(const unsigned char *addr, char *tgt)
+{
+	unsigned int g[8];
+	int i, ngroup = 8, zero_at = -1, zero_len = 1, run;
+
+	for (i = 0;  i < 8;  i++)
+		g[i] = addr[2 * i] << 8 | addr[2 * i + 1];
+
+	//  ipv4 mapped, ::ffff:a.b.c.d
+
+	if (g[0] == 0 && g[1] == 0 && g[2] == 0 && g[3] == 0 && g[4] == 0 &&
+	    g[5] == 0xffff)
+		ngroup = 6;
+
+	for (i = 0;  i < ngroup;  i += run > 0 ? run : 1) {
+		for (run = 0;  i + run < ngroup && g[i + run] == 0;  run++)
+			;
+		if (run > zero_len) {
+			zero_at = i;
+			zero_len = run;
+		}
+	}
+
+	for (i = 0;  i < ngroup;  i++) {
+		unsigned int v = g[i];
+
+		if (i == zero_at) {
+			*tgt++ = ':';
+			if (i == 0)
+				*tgt++ = ':';
+			i += zero_len - 1;
+			continue;
+		}
+		if (v >= 0x1000)
+			*tgt++ = hex[v >> 12];
+		if (v >= 0x100)
+			*tgt++ = hex[(v >> 8) & 0xf];
+		if (v >= 0x10)
+			*tgt++ = hex[(v >> 4) & 0xf];
+		*tgt++ = hex[v & 0xf];
+		if (i < 7)
+			*tgt++ = ':';
+	}
+	if (ngroup == 6)
+		return jmscott_inet4_format(addr + 12, tgt);
+	*tgt = 0;
+	return tgt;
+}
+
+/*
+ *  Synopsis:
+ *	Format an AF_INET or AF_INET6 socket address as "ip:port".
+ *  Usage:
+ *	char peer[JMSCOTT_SOCKADDR_TEXT_SIZE];
+ *
+ *	jmscott_sockaddr_format(&u.msg[i].addr, peer);
+ *  Description:
+ *	An ipv6 address is bracketed, "[fe80::1]:514".  The port is dropped
+ *	when zero, and the ipv6 scope id is never written.
+ *  Returns:
+ *	(char *)0	address formatted, null terminated
+ *	(char *)	unknown address family, tgt set to ""
+ */
+char *
+jmscott_sockaddr_format(const void *sockaddr, char *tgt)
+{
+	const struct sockaddr *sa = sockaddr;
+	unsigned int port;
+
+	switch (sa->sa_family) {
+	case AF_INET: {
+		const struct sockaddr_in *in = sockaddr;
+
+		tgt = jmscott_inet4_format(
+				(const unsigned char *)&in->sin_addr,
+				tgt
+		);
+		port = ntohs(in->sin_port);
+		break;
+	}
+	case AF_INET6: {
+		const struct sockaddr_in6 *in6 = sockaddr;
+
+		*tgt++ = '[';
+		tgt = jmscott_inet6_format(in6->sin6_addr.s6_addr, tgt);
+		*tgt++ = ']';
+		port = ntohs(in6->sin6_port);
+		break;
+	}
+	default:
+		*tgt = 0;
+		return "unknown address family";
+	}
+	if (port > 0) {
+		*tgt++ = ':';
+		tgt = jmscott_ulltoa(port, tgt);
+	}
+	*tgt = 0;
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Parse a dotted quad into a 4 byte ipv4 address, network order.
+ *  Description:
+ *	Exactly four decimal parts, 0 to 255, with no leading zeros, which
+ *	inet_aton() would read as octal.
+ *  Returns:
+ *	(char *)0	address parsed
+ *	(char *)	malformed address
+ */
+char *
+jmscott_inet4_parse(const char *src, size_t len, unsigned char *addr)
+{
+	const char *end = src + len;
+	int i;
+
+	for (i = 0;  i < 4;  i++) {
+		unsigned int v = 0;
+		const char *p;
+
+		if (i > 0) {
+			if (src == end || *src != '.')
+				return "ipv4: expected '.'";
+			src++;
+		}
+		for (p = src;  p < end && p - src < 3;  p++) {
+			unsigned int d = (unsigned char)(*p - '0');
+
+			if (d > 9)
+				break;
+			v = v * 10 + d;
+		}
+		if (p == src)
+			return "ipv4: expected decimal digit";
+		if (p < end && (unsigned char)(*p - '0') <= 9)
+			return "ipv4: part > 3 digits";
+		if (v > 255)
+			return "ipv4: part > 255";
+		if (*src == '0' && p - src > 1)
+			return "ipv4: part has leading zero";
+		addr[i] = v;
+		src = p;
+	}
+	if (src != end)
+		return "ipv4: unexpected char after address";
+	return (char *)0;
+}
+
+//  value of hex char plus 1, 0 for not hex
+static const unsigned char nibble1[256] =
+{
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+/*
+ *  Synopsis:
+ *	Parse rfc4291 text into a 16 byte ipv6 address, network order.
+ *  Description:
+ *	Groups of 1 to 4 hex digits, at most one "::", and an optional
+ *	trailing dotted quad.  A "%scope" suffix is rejected.
+ *  Returns:
+ *	(char *)0	address parsed
+ *	(char *)	malformed address
+ */
+char *
+jmscott_inet6_parse(const char *src, size_t len, unsigned char *addr)
+{
+	const char *p = src, *end = src + len;
+	unsigned char a[16];
+	int n = 0, gap = -1;
+	char *err;
+
+	if (len >= 2 && p[0] == ':' && p[1] == ':') {
+		gap = 0;
+		p += 2;
+	} else if (len > 0 && p[0] == ':')
+		return "ipv6: leading single ':'";
+
+	while (p < end) {
+		unsigned int v = 0;
+		const char *g = p;
+
+		while (p < end && p - g < 5 && nibble1[(unsigned char)*p])
+			v = v << 4 | (nibble1[(unsigned char)*p++] - 1);
+		if (p == g)
+			return "ipv6: expected hex digit";
+
+		//  trailing dotted quad
+
+		if (p < end && *p == '.') {
+			if (n > 12)
+				return "ipv6: too many groups before ipv4";
+			if ((err = jmscott_inet4_parse(g, end - g, a + n)))
+				return err;
+			n += 4;
+			p = end;
+			break;
+		}
+		if (p - g > 4)
+			return "ipv6: group > 4 hex digits";
+		if (n == 16)
+			return "ipv6: too many groups";
+		a[n++] = v >> 8;
+		a[n++] = v;
+		if (p == end)
+			break;
+		if (*p != ':')
+			return "ipv6: unexpected char";
+		if (++p < end && *p == ':') {
+			if (gap >= 0)
+				return "ipv6: more than one \"::\"";
+			gap = n;
+			p++;
+		} else if (p == end)
+			return "ipv6: trailing single ':'";
+	}
+	if (gap < 0) {
+		if (n != 16)
+			return "ipv6: too few groups";
+		memcpy(addr, a, 16);
+		return (char *)0;
+	}
+	if (n == 16)
+		return "ipv6: \"::\" in full address";
+	memcpy(addr, a, gap);
+	memset(addr + gap, 0, 16 - n);
+	memcpy(addr + gap + 16 - n, a + gap, n - gap);
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Parse "ip:port", "[ip6]:port" or a bare ip into a socket address.
+ *  Description:
+ *	No name lookup.  A bare address has port 0.
+ *  Returns:
+ *	(char *)0	address parsed, *addr_len set
+ *	(char *)	malformed address or port
+ */
+char *
+jmscott_sockaddr_parse(
+	const char *src,
+	size_t len,
+	struct sockaddr_storage *ss,
+	socklen_t *addr_len
+){
+	const char *end = src + len, *host = src, *host_end, *colon;
+	unsigned long long port = 0;
+	char *err;
+
+	memset(ss, 0, sizeof *ss);
+	if (len > 0 && src[0] == '[') {
+		host++;
+		if (!(host_end = memchr(host, ']', end - host)))
+			return "address: missing ']'";
+		colon = host_end + 1;
+		if (colon < end && *colon != ':')
+			return "address: expected ':' after ']'";
+	} else {
+		colon = memchr(src, ':', len);
+
+		//  more than one colon is a bare ipv6 address
+
+		if (colon && memchr(colon + 1, ':', end - colon - 1))
+			colon = end;
+		host_end = colon ? colon : end;
+	}
+	if (colon && colon < end) {
+		const char *p;
+
+		if (colon + 1 == end || end - colon > 6)
+			return "address: port not 1 to 5 digits";
+		for (p = colon + 1;  p < end;  p++) {
+			if ((unsigned char)(*p - '0') > 9)
+				return "address: port not decimal";
+			port = port * 10 + (*p - '0');
+		}
+		if (port > 65535)
+			return "address: port > 65535";
+	}
+
+	if (memchr(host, ':', host_end - host)) {
+		struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)ss;
+
+		err = jmscott_inet6_parse(host, host_end-host, in6->sin6_addr.s6_addr);
+		if (err)
+			return err;
+		in6->sin6_family = AF_INET6;
+		in6->sin6_port = htons(port);
+		*addr_len = sizeof *in6;
+	} else {
+		struct sockaddr_in *in = (struct sockaddr_in *)ss;
+
+		if (host != src)
+			return "address: ipv4 in brackets";
+		err = jmscott_inet4_parse(
+				host,
+				host_end - host,
+				(unsigned char *)&in->sin_addr
+		);
+		if (err)
+			return err;
+		in->sin_family = AF_INET;
+		in->sin_port = htons(port);
+		*addr_len = sizeof *in;
+	}
+	return (char *)0;
+}
+
+/*
+ *  Convert 32 bit internet address, host order, to dotted text, rotating
+ *  through a per thread buffer pool.
+ *
+ *  Note:
+ *	Prefer jmscott_inet4_format() into a caller buffer, since the
+ *	returned text is overwritten by the fourth following call.
+ */
 char *
 jmscott_net_32addr2text(u_long addr)
 {
 #define SHOW_IP_BUFS	4
-#define SHOW_IP_BUFSIZE	20
 
-	char *cp, *buf;
-	u_int byte;
-	int n;
-	static char bufs[SHOW_IP_BUFS][SHOW_IP_BUFSIZE];
-	static int curbuf = 0;
+	static __thread char bufs[SHOW_IP_BUFS][JMSCOTT_INET4_TEXT_SIZE];
+	static __thread int curbuf = 0;
+	unsigned char a[4];
+	char *buf;
 
 	buf = bufs[curbuf++];
 	if (curbuf >= SHOW_IP_BUFS)
 		curbuf = 0;
 
-	cp = buf + SHOW_IP_BUFSIZE;
-	*--cp = '\0';
-
-	n = 4;
-	do {
-		byte = addr & 0xff;
-		*--cp = byte % 10 + '0';
-		byte /= 10;
-		if (byte > 0) {
-			*--cp = byte % 10 + '0';
-			byte /= 10;
-			if (byte > 0)
-				*--cp = byte + '0';
-		}
-		*--cp = '.';
-		addr >>= 8;
-	} while (--n > 0);
-
-	cp++;
-	return cp;
+	a[0] = addr >> 24;
+	a[1] = addr >> 16;
+	a[2] = addr >> 8;
+	a[3] = addr;
+	jmscott_inet4_format(a, buf);
+	return buf;
+}
+
+#ifndef HAVE_MMSG
+
+/*
+ *  Emulate recvmmsg(MSG_WAITFORONE): block for the first message only.
+ */
+static int
+recvmmsg(int fd, struct mmsghdr *mm, unsigned int n, int flags, void *tmo)
+{
+	unsigned int i;
+	ssize_t nr;
+
+	(void)flags;
+	(void)tmo;
+	for (i = 0;  i < n;  i++) {
+		nr = recvmsg(fd, &mm[i].msg_hdr, i == 0 ? 0 : MSG_DONTWAIT);
+		if (nr < 0)
+			break;
+		mm[i].msg_len = nr;
+	}
+	if (i == 0)
+		return -1;
+	return (int)i;
+}
+
+static int
+sendmmsg(int fd, struct mmsghdr *mm, unsigned int n, int flags)
+{
+	unsigned int i;
+	ssize_t nw;
+
+	(void)flags;
+	for (i = 0;  i < n;  i++) {
+		if ((nw = sendmsg(fd, &mm[i].msg_hdr, 0)) < 0)
+			break;
+		mm[i].msg_len = nw;
+	}
+	if (i == 0)
+		return -1;
+	return (int)i;
+}
+
+#endif
+
+/*
+ *  Synopsis:
+ *	Open a udp socket and allocate a ring of "nmsg" message buffers.
+ *  Usage:
+ *	jmscott_udp_open(&u, AF_INET6, 512, 2048);
+ *  Description:
+ *	The ring is a single allocation: message headers, io vectors,
+ *	addresses, gro control space and nmsg * msg_size bytes of buffers.
+ *  Returns:
+ *	(char *)0	socket open, ring allocated
+ *	(char *)	error, socket closed
+ */
+char *
+jmscott_udp_open(
+	struct jmscott_udp *u,
+	int family,
+	unsigned int nmsg,
+	size_t msg_size
+){
+	struct mmsghdr *mm;
+	struct iovec *iov;
+	char *p, *bufs;
+	size_t size;
+	unsigned int i;
+
+	memset(u, 0, sizeof *u);
+	u->fd = -1;
+	if (nmsg == 0 || nmsg > 1024)
+		return "udp: ring messages not in 1..1024";
+	if (msg_size == 0 || msg_size > 65535)
+		return "udp: message size not in 1..65535";
+
+	size = nmsg * (sizeof *u->msg + sizeof *mm + sizeof *iov +CONTROL_SIZE);
+	size = (size + 63) & ~(size_t)63;
+	if (!(p = malloc(size + nmsg * msg_size)))
+		return "udp: malloc(ring) failed: out of memory";
+	u->msg = (struct jmscott_udp_msg *)p;
+	mm = (struct mmsghdr *)(u->msg + nmsg);
+	iov = (struct iovec *)(mm + nmsg);
+	u->control = (char *)(iov + nmsg);
+	bufs = p + size;
+	memset(p, 0, size);
+
+	for (i = 0;  i < nmsg;  i++) {
+		u->msg[i].buf = bufs + i * msg_size;
+		iov[i].iov_base = u->msg[i].buf;
+		mm[i].msg_hdr.msg_iov = &iov[i];
+		mm[i].msg_hdr.msg_iovlen = 1;
+	}
+	u->mmsg = mm;
+	u->nmsg = nmsg;
+	u->msg_size = msg_size;
+	u->family = family;
+
+	if ((u->fd = socket(family, SOCK_DGRAM, 0)) < 0) {
+		char *err = strerror(errno);
+
+		free(u->msg);
+		u->msg = (struct jmscott_udp_msg *)0;
+		return err;
+	}
+	return (char *)0;
+}
+
+static char *
+setsockopt_int(struct jmscott_udp *u, int level, int opt, int val)
+{
+	if (setsockopt(u->fd, level, opt, &val, sizeof val) < 0)
+		return strerror(errno);
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Share the port of a later bind with other sockets, via SO_REUSEPORT.
+ */
+char *
+jmscott_udp_reuseport(struct jmscott_udp *u)
+{
+#ifdef SO_REUSEPORT
+	return setsockopt_int(u, SOL_SOCKET, SO_REUSEPORT, 1);
+#else
+	(void)u;
+	return "udp: SO_REUSEPORT not supported";
+#endif
+}
+
+/*
+ *  Synopsis:
+ *	Size the kernel receive buffer, absorbing bursts between recv calls.
+ *  Description:
+ *	SO_RCVBUFFORCE, which ignores net.core.rmem_max, is tried first,
+ *	quietly falling back to SO_RCVBUF, capped by rmem_max.  The size
+ *	granted by the kernel is stored in u->rcvbuf.
+ */
+char *
+jmscott_udp_rcvbuf(struct jmscott_udp *u, int size)
+{
+	socklen_t len = sizeof u->rcvbuf;
+	char *err;
+
+#ifdef SO_RCVBUFFORCE
+	if (setsockopt_int(u, SOL_SOCKET, SO_RCVBUFFORCE, size))
+#endif
+		if ((err = setsockopt_int(u, SOL_SOCKET, SO_RCVBUF, size)))
+			return err;
+	if (getsockopt(u->fd, SOL_SOCKET, SO_RCVBUF, &u->rcvbuf, &len) < 0)
+		return strerror(errno);
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Receive coalesced datagrams via UDP_GRO, linux 5.0 or later.
+ *  Note:
+ *	Message buffers smaller than 65535 bytes are rejected, since the
+ *	kernel truncates a coalesced message that does not fit.
+ */
+char *
+jmscott_udp_gro(struct jmscott_udp *u)
+{
+#if defined(__linux__) && defined(UDP_GRO)
+	char *err;
+
+	if (u->msg_size < 65535)
+		return "udp: gro needs 65535 byte message buffers";
+	if ((err = setsockopt_int(u, IPPROTO_UDP, UDP_GRO, 1)))
+		return err;
+	u->gro = 1;
+	return (char *)0;
+#else
+	(void)u;
+	return "udp: UDP_GRO not supported";
+#endif
+}
+
+/*
+ *  Synopsis:
+ *	Segment each message put into datagrams of "segment_size" bytes, via
+ *	UDP_SEGMENT, linux 4.18 or later.
+ */
+char *
+jmscott_udp_gso(struct jmscott_udp *u, int segment_size)
+{
+#if defined(__linux__) && defined(UDP_SEGMENT)
+	char *err;
+
+	if (segment_size <= 0 || (size_t)segment_size > u->msg_size)
+		return "udp: gso segment size not in 1..message size";
+	if ((err = setsockopt_int(u, IPPROTO_UDP, UDP_SEGMENT, segment_size)))
+		return err;
+	u->gso_size = segment_size;
+	return (char *)0;
+#else
+	(void)u;
+	(void)segment_size;
+	return "udp: UDP_SEGMENT not supported";
+#endif
+}
+
+char *
+jmscott_udp_bind(
+	struct jmscott_udp *u,
+	const struct sockaddr *addr,
+	socklen_t addr_len
+){
+	if (bind(u->fd, addr, addr_len) < 0)
+		return strerror(errno);
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Set the default peer, so jmscott_udp_put() may pass a null address.
+ */
+char *
+jmscott_udp_connect(
+	struct jmscott_udp *u,
+	const struct sockaddr *addr,
+	socklen_t addr_len
+){
+	if (connect(u->fd, addr, addr_len) < 0)
+		return strerror(errno);
+	return (char *)0;
+}
+
+/*
+ *  Gro segment size from the control messages of a received message.
+ */
+static unsigned int
+segment_size(struct msghdr *mh)
+{
+#if defined(__linux__) && defined(UDP_GRO)
+	struct cmsghdr *c;
+
+	for (c = CMSG_FIRSTHDR(mh);  c;  c = CMSG_NXTHDR(mh, c))
+		if (c->cmsg_level == IPPROTO_UDP && c->cmsg_type == UDP_GRO) {
+			int size;
+
+			memcpy(&size, CMSG_DATA(c), sizeof size);
+			return (unsigned int)size;
+		}
+#else
+	(void)mh;
+#endif
+	return 0;
+}
+
+/*
+ *  Synopsis:
+ *	Wait for at least one datagram, then take all that fit in the ring.
+ *  Description:
+ *	On return u->count is the number of messages in u->msg[].  A receive
+ *	timeout, SO_RCVTIMEO, or a non-blocking socket return with count 0.
+ *	Interrupted calls are restarted.
+ *  Returns:
+ *	(char *)0	u->count messages received
+ *	(char *)	recvmmsg() failed, or datagrams queued to send
+ */
+char *
+jmscott_udp_recv(struct jmscott_udp *u)
+{
+	struct mmsghdr *mm = u->mmsg;
+	unsigned int i;
+	int n;
+
+	if (u->nqueued > 0)
+		return "udp: recv with datagrams queued to send";
+	for (i = 0;  i < u->nmsg;  i++) {
+		struct msghdr *mh = &mm[i].msg_hdr;
+
+		mh->msg_name = &u->msg[i].addr;
+		mh->msg_namelen = sizeof u->msg[i].addr;
+		mh->msg_iov->iov_len = u->msg_size;
+		if (u->gro) {
+			mh->msg_control = u->control + i * CONTROL_SIZE;
+			mh->msg_controllen = CONTROL_SIZE;
+		}
+		mh->msg_flags = 0;
+	}
+	u->count = 0;
+AGAIN:
+	n = recvmmsg(u->fd, mm, u->nmsg, MSG_WAITFORONE, (struct timespec *)0);
+	if (n < 0) {
+		if (errno == EINTR)
+			goto AGAIN;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return (char *)0;
+		return strerror(errno);
+	}
+	u->nrecv_call++;
+	for (i = 0;  i < (unsigned int)n;  i++) {
+		struct jmscott_udp_msg *m = &u->msg[i];
+
+		m->len = mm[i].msg_len;
+		m->addr_len = mm[i].msg_hdr.msg_namelen;
+		m->segment_size = u->gro ? segment_size(&mm[i].msg_hdr) : 0;
+	}
+	u->count = n;
+	u->nrecv += n;
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Copy a datagram into the ring, sending the ring when full.
+ *  Description:
+ *	A null "addr" sends to the peer of jmscott_udp_connect().  With
+ *	jmscott_udp_gso(), "len" may be any multiple of the segment size,
+ *	up to the message size.
+ *
+ *	When the ring is full it is flushed first.  Datagrams dropped by
+ *	that flush are only counted in u->nsend_drop.
+ *  Returns:
+ *	(char *)0	datagram queued
+ *	(char *)	datagram too big, received datagrams in the ring, or
+ *			flush of full ring failed with the ring still full
+ */
+char *
+jmscott_udp_put(
+	struct jmscott_udp *u,
+	const void *buf,
+	size_t len,
+	const struct sockaddr *addr,
+	socklen_t addr_len
+){
+	struct mmsghdr *mm = u->mmsg;
+	struct jmscott_udp_msg *m;
+	char *err;
+
+	if (len > u->msg_size)
+		return "udp: datagram bigger than message size";
+	if (addr && addr_len > sizeof m->addr)
+		return "udp: address too long";
+	if (u->count > 0)
+		return "udp: put with received datagrams in ring";
+	if (u->nqueued == u->nmsg && (err = jmscott_udp_flush(u)) &&
+	    u->nqueued == u->nmsg)
+		return err;
+
+	m = &u->msg[u->nqueued];
+	memcpy(m->buf, buf, len);
+	m->len = len;
+	mm[u->nqueued].msg_hdr.msg_iov->iov_len = len;
+	mm[u->nqueued].msg_hdr.msg_control = (void *)0;
+	mm[u->nqueued].msg_hdr.msg_controllen = 0;
+	if (addr) {
+		memcpy(&m->addr, addr, addr_len);
+		m->addr_len = addr_len;
+		mm[u->nqueued].msg_hdr.msg_name = &m->addr;
+		mm[u->nqueued].msg_hdr.msg_namelen = addr_len;
+	} else {
+		m->addr_len = 0;
+		mm[u->nqueued].msg_hdr.msg_name = (void *)0;
+		mm[u->nqueued].msg_hdr.msg_namelen = 0;
+	}
+	u->nqueued++;
+	return (char *)0;
+}
+
+/*
+ *  Is a send error transient, so the datagram stays queued?
+ */
+static int
+send_retry(int e)
+{
+	return e == EAGAIN || e == EWOULDBLOCK || e == ENOBUFS || e == ENOMEM;
+}
+
+/*
+ *  Synopsis:
+ *	Send all queued datagrams, restarting partial batches.
+ *  Description:
+ *	A datagram the kernel rejects, for example EINVAL, EMSGSIZE,
+ *	EHOSTUNREACH or ECONNREFUSED, is dropped and counted in
+ *	u->nsend_drop, and the datagrams behind it are still sent.  On a
+ *	transient error, EAGAIN or ENOBUFS, the unsent datagrams are moved
+ *	to the head of the ring and stay queued for the next flush.
+ *  Returns:
+ *	(char *)0	ring sent and empty
+ *	(char *)	error of the first dropped datagram, ring empty, or
+ *			transient error, unsent datagrams stay queued
+ */
+char *
+jmscott_udp_flush(struct jmscott_udp *u)
+{
+	struct mmsghdr *mm = u->mmsg;
+	unsigned int off = 0;
+	char *drop_err = (char *)0;
+	int n;
+
+	while (off < u->nqueued) {
+		n = sendmmsg(u->fd, mm + off, u->nqueued - off, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			//  the datagram at "off" is undeliverable, so drop it
+
+			if (!send_retry(errno)) {
+				if (!drop_err)
+					drop_err = strerror(errno);
+				u->nsend_drop++;
+				off++;
+				continue;
+			}
+
+			//  keep the unsent tail at the head of the ring
+
+			if (off > 0) {
+				unsigned int i, j;
+
+				for (i = 0, j = off;  j < u->nqueued;  i++, j++) {
+					struct jmscott_udp_msg *m = &u->msg[i];
+
+					memcpy(m->buf, u->msg[j].buf, u->msg[j].len);
+					m->len = u->msg[j].len;
+					m->addr = u->msg[j].addr;
+					m->addr_len = u->msg[j].addr_len;
+					mm[i].msg_hdr.msg_iov->iov_len = m->len;
+					mm[i].msg_hdr.msg_name = m->addr_len ?
+							&m->addr : (void *)0;
+					mm[i].msg_hdr.msg_namelen = m->addr_len;
+				}
+				u->nqueued -= off;
+			}
+			return strerror(errno);
+		}
+		u->nsend_call++;
+		u->nsend += n;
+		off += n;
+	}
+	u->nqueued = 0;
+	return drop_err;
+}
+
+/*
+ *  Synopsis:
+ *	Close the socket and free the ring.  Queued datagrams are dropped.
+ */
+char *
+jmscott_udp_close(struct jmscott_udp *u)
+{
+	char *err = (char *)0;
+
+	if (u->fd >= 0 && jmscott_close(u->fd) < 0)
+		err = strerror(errno);
+	u->fd = -1;
+	free(u->msg);
+	u->msg = (struct jmscott_udp_msg *)0;
+	u->mmsg = (void *)0;
+	u->count = u->nqueued = u->nmsg = 0;
+	return err;
 }
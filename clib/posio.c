@@ -542,3 +542,37 @@ AGAIN:
 	}
 	return 0;
 }
+
+int
+jmscott_fsync(int fd)
+{
+AGAIN:
+	if (fsync(fd)) {
+		if (errno == EINTR || errno == EAGAIN)
+			goto AGAIN;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  Synopsis:
+ *	Flush file data, and only the metadata needed to read it back.
+ *  Note:
+ *	fsync() on Darwin, which lacks a declared fdatasync().
+ */
+int
+jmscott_fdatasync(int fd)
+{
+AGAIN:
+#ifdef __APPLE__
+	if (fsync(fd)) {
+#else
+	if (fdatasync(fd)) {
+#endif
+		if (errno == EINTR || errno == EAGAIN)
+			goto AGAIN;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ *  Synopsis:
+ *	Pipelined statements over libpq, for bulk loads.
+ *  Usage:
+ *	#include "jmscott/libjmscott.h"
+ *
+ *	static struct jmscott_ecpg_state_fault load_fault[] =
+ *	{
+ *		{"23505", -1},		//  unique violation: row exists
+ *		{(char *)0, 0}
+ *	};
+ *	struct jmscott_pq_pipeline p;
+ *
+ *	err = jmscott_pq_pipeline_begin(&p, conn, load_fault, 1, 0);
+ *	while (...)
+ *		err = jmscott_pq_pipeline_exec(&p, "INSERT ...", 2, values);
+ *	err = jmscott_pq_pipeline_end(&p);
+ *	if (err)
+ *		jmscott_die(p.status, err);
+ *
+ *	//  ecpg programs get the connection via ECPGget_PGconn(name)
+ *  Description:
+ *	A pipeline sends statements without waiting for results.  Every
+ *	"batch" statements a sync is sent, ending an implicit transaction,
+ *	so a fault rolls back the whole batch: the statements before the
+ *	fault, already reported ok, and the statements after, aborted.
+ *	Results are read only when "window" syncs are in flight, and then
+ *	just the results of the oldest batch, so the server always has
+ *	statements queued and n statements cost far fewer than n round
+ *	trips, while the results in flight stay bounded.
+ *
+ *	So, when faults are ignored, as for unique violations in idempotent
+ *	loads, use a batch of 1, which isolates each statement in its own
+ *	transaction, yet still keeps "window" statements in flight.  Larger
+ *	batches save the commit per statement, but an ignored fault rolls
+ *	back the other statements of its batch, which is reported as an
+ *	error.  p->naborted counts the statements rolled back with a fault,
+ *	not counting the fault itself.
+ *
+ *	Faults are remapped by the same struct jmscott_ecpg_state_fault as
+ *	jmscott_ecpg_fault(): action -1 ignores the fault, 0 <= 255 sets
+ *	the exit status, saved in p->status, else jmscott_ecpg_error_code.
+ *	Error strings are "SQLERROR: <state>: <message>", like ecpg.c.
+ *  Note:
+ *	Pipeline mode requires libpq >= 14.
+ *
+ *	The connection is left in blocking mode, so a window of statements
+ *	with very large results could fill both socket buffers.  Keep the
+ *	window of SELECTs small.
+ */
+#include <string.h>
+
+#if JMSCOTT_COMPILE_PG
+#include "libpq-fe.h"
+#endif
+
+#include "jmscott/libjmscott.h"
+
+#if JMSCOTT_COMPILE_PG && defined(LIBPQ_HAS_PIPELINING)
+
+/*
+ *  Remap a faulted result, formatting the error into "err".
+ *  Returns 1 for an ignored fault, else 0.
+ */
+static int
+fault(
+	PGresult *res,
+	PGconn *conn,
+	struct jmscott_ecpg_state_fault *map,
+	int *status,
+	char *err,
+	size_t err_size
+){
+	const char *state = (char *)0, *msg;
+	struct jmscott_strbuf sb;
+	int act = -2;
+
+	if (res)
+		state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+	if (state && strlen(state) == 5)
+		act = jmscott_ecpg_state_action(map, state);
+	if (act == -1)
+		return 1;
+	*status = 0 <= act && act <= 255 ? act : jmscott_ecpg_error_code;
+
+	msg = res ? PQresultErrorMessage(res) : PQerrorMessage(conn);
+	jmscott_strbuf_init(&sb, err, err_size);
+	jmscott_strbuf_append(&sb, "SQLERROR: ");
+	jmscott_strbuf_append(&sb, state ? state : "(missing sql state)");
+	jmscott_strbuf_append(&sb, ": ");
+	jmscott_strbuf_appendn(&sb, msg, strcspn(msg, "\n"));
+	return 0;
+}
+
+/*
+ *  Send a sync, ending the current batch.
+ */
+static char *
+pipeline_sync(struct jmscott_pq_pipeline *p)
+{
+	if (PQpipelineSync(p->conn) != 1)
+		return "PQpipelineSync() failed";
+	p->npending = 0;
+	p->nsync++;
+	p->nsync_pending++;
+	return (char *)0;
+}
+
+/*
+ *  Read results of the oldest batches until at most "nkeep" syncs are in
+ *  flight.  The first unignored fault is kept in p->err.
+ */
+static char *
+pipeline_drain(struct jmscott_pq_pipeline *p, int nkeep)
+{
+	PGconn *conn = p->conn;
+	char *err = (char *)0;
+	PGresult *res;
+	int nstmt = 0, faulted = 0, ignored = 0, status;
+	char ignore[sizeof p->err];
+
+	while (p->nsync_pending > nkeep) {
+		if (!(res = PQgetResult(conn))) {
+
+			//  null ends the results of one statement
+
+			if (PQstatus(conn) == CONNECTION_BAD) {
+				p->nsync_pending = 0;
+				return "pipeline: connection to server lost";
+			}
+			continue;
+		}
+		if (PQresultStatus(res) != PGRES_PIPELINE_SYNC)
+			nstmt++;
+		switch (PQresultStatus(res)) {
+		case PGRES_PIPELINE_SYNC:
+			p->nsync_pending--;
+
+			//  a fault rolls back every statement of the batch
+
+			if (faulted && nstmt > 1)
+				p->naborted += nstmt - 1;
+			if (!err && ignored && nstmt > 1) {
+				struct jmscott_strbuf sb;
+
+				jmscott_strbuf_init(&sb, p->err, sizeof p->err);
+				jmscott_strbuf_append(&sb,
+					"pipeline: batch rolled back by ignored "
+					"fault: statements lost: ");
+				jmscott_strbuf_append_int(&sb, nstmt - 1);
+				p->status = jmscott_ecpg_error_code;
+				err = p->err;
+			}
+			nstmt = faulted = ignored = 0;
+			break;
+		case PGRES_COMMAND_OK:
+		case PGRES_TUPLES_OK:
+		case PGRES_PIPELINE_ABORTED:
+			break;
+		default:
+			faulted = 1;
+
+			//  keep the message of the first fault
+
+			if (fault(
+				res,
+				conn,
+				p->fault,
+				err ? &status : &p->status,
+				err ? ignore : p->err,
+				sizeof p->err
+			)) {
+				p->nignored++;
+				ignored = 1;
+			} else if (!err)
+				err = p->err;
+		}
+		PQclear(res);
+	}
+	return err;
+}
+
+#endif
+
+/*
+ *  Synopsis:
+ *	Put a connection in pipeline mode, syncing every "batch" statements
+ *	and reading results when "window" syncs are in flight.
+ *  Description:
+ *	A batch or window <= 0 is 1 or JMSCOTT_PQ_PIPELINE_WINDOW.
+ *  Returns:
+ *	(char *)0	in pipeline mode
+ *	(char *)	error in english
+ */
+char *
+jmscott_pq_pipeline_begin(
+	struct jmscott_pq_pipeline *p,
+	struct pg_conn *conn,
+	struct jmscott_ecpg_state_fault *fault,
+	int batch,
+	int window
+){
+	memset(p, 0, sizeof *p);
+	p->conn = conn;
+	p->fault = fault;
+	p->batch = batch > 0 ? batch : 1;
+	p->window = window > 0 ? window : JMSCOTT_PQ_PIPELINE_WINDOW;
+	p->status = jmscott_ecpg_error_code;
+#if JMSCOTT_COMPILE_PG && defined(LIBPQ_HAS_PIPELINING)
+	if (PQenterPipelineMode(conn) != 1)
+		return "PQenterPipelineMode() failed";
+	return (char *)0;
+#else
+	return "jmscott_pq_pipeline_begin: no libpq pipeline mode";
+#endif
+}
+
+/*
+ *  Synopsis:
+ *	Queue a statement with "nparam" text parameters $1, $2, ...
+ *  Description:
+ *	A null value is sql NULL.  When "batch" statements are queued, a
+ *	sync is sent, and when "window" syncs are in flight, the results of
+ *	the oldest batch are read.
+ *  Returns:
+ *	(char *)0	queued, and any batch read had no fault
+ *	(char *)	first unignored fault of a batch, or batch rolled
+ *			back by an ignored fault, exit in p->status
+ */
+char *
+jmscott_pq_pipeline_exec(
+	struct jmscott_pq_pipeline *p,
+	const char *sql,
+	int nparam,
+	const char * const *values
+){
+#if JMSCOTT_COMPILE_PG && defined(LIBPQ_HAS_PIPELINING)
+	char *err;
+
+	if (!PQsendQueryParams(
+		p->conn,
+		sql,
+		nparam,
+		(Oid *)0,
+		values,
+		(int *)0,
+		(int *)0,
+		0
+	)) {
+		(void)fault(
+			(PGresult *)0,
+			p->conn,
+			(struct jmscott_ecpg_state_fault *)0,
+			&p->status,
+			p->err,
+			sizeof p->err
+		);
+		return p->err;
+	}
+	p->nexec++;
+	if (++p->npending < p->batch)
+		return (char *)0;
+	if ((err = pipeline_sync(p)))
+		return err;
+	return pipeline_drain(p, p->window - 1);
+#else
+	(void)p;
+	(void)sql;
+	(void)nparam;
+	(void)values;
+	return "jmscott_pq_pipeline_exec: no libpq pipeline mode";
+#endif
+}
+
+/*
+ *  Synopsis:
+ *	Sync the final batch, read all results and leave pipeline mode.
+ *  Returns:
+ *	(char *)0	all statements completed, or faults ignored
+ *	(char *)	first unignored fault, or batch rolled back by an
+ *			ignored fault, exit in p->status
+ */
+char *
+jmscott_pq_pipeline_end(struct jmscott_pq_pipeline *p)
+{
+#if JMSCOTT_COMPILE_PG && defined(LIBPQ_HAS_PIPELINING)
+	char *err = (char *)0;
+
+	if (p->npending > 0)
+		err = pipeline_sync(p);
+	if (!err)
+		err = pipeline_drain(p, 0);
+	if (PQexitPipelineMode(p->conn) != 1 && !err)
+		return "PQexitPipelineMode() failed";
+	return err;
+#else
+	(void)p;
+	return "jmscott_pq_pipeline_end: no libpq pipeline mode";
+#endif
+}
@@ -0,0 +1,368 @@
+/*
+ *  Synopsis:
+ *	Length aware, locale free scanners over ascii character classes.
+ *  Description:
+ *	A struct jmscott_char_class is a 256 bit membership bitmap, one bit
+ *	per byte value.  jmscott_span_class() returns the length of the
+ *	initial run of bytes in the class, similar to strspn(), but does not
+ *	stop at a null and classifies 16 or 32 bytes per step on x86_64.
+ *
+ *	The SIMD class kernel splits each byte into nibbles and uses the
+ *	low nibble to look up which of the 16 high nibble rows hold the
+ *	byte, via pshufb, as described by Wojciech Mula
+ *
+ *		http://0x80.pl/articles/simd-byte-lookup.html
+ *
+ *	The contiguous ranges of jmscott_isgraph_len() and
+ *	jmscott_isdigit_len() only need an unsigned range compare, which is
+ *	plain SSE2 and so always available on x86_64.
+ *
+ *	AVX2 and SSSE3 kernels are chosen at run time.  Other architectures
+ *	use the scalar bitmap.
+ *  Usage:
+ *	struct jmscott_char_class hex;
+ *
+ *	jmscott_char_class_zero(&hex);
+ *	jmscott_char_class_add_range(&hex, '0', '9');
+ *	jmscott_char_class_add_range(&hex, 'a', 'f');
+ *
+ *	size_t n = jmscott_span_class(&hex, digest, 64);
+ *	if (n < 64)
+ *		die2("non hex char in digest", ...);
+ *  Note:
+ *	Add a NEON class kernel for arm64 macs.
+ */
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define JMSCOTT_SPAN_X86	1
+#include <immintrin.h>
+#endif
+
+#include "jmscott/libjmscott.h"
+
+#define IN_CLASS(cc, c)	(((cc)->bits[(c) >> 6] >> ((c) & 63)) & 1)
+
+void
+jmscott_char_class_zero(struct jmscott_char_class *cc)
+{
+	memset(cc, 0, sizeof *cc);
+}
+
+/*
+ *  Synopsis:
+ *	Add the bytes in the inclusive range [lo, hi] to a class.
+ */
+void
+jmscott_char_class_add_range(
+	struct jmscott_char_class *cc,
+	unsigned char lo,
+	unsigned char hi
+){
+	int c;
+
+	for (c = lo;  c <= hi;  c++) {
+		int row = c >> 4, col = c & 0x0f;
+
+		cc->bits[c >> 6] |= 1ULL << (c & 63);
+
+		//  nibble tables for the simd kernels
+		if (row < 8)
+			cc->row_lo[col] |= 1 << row;
+		else
+			cc->row_hi[col] |= 1 << (row - 8);
+	}
+}
+
+/*
+ *  Synopsis:
+ *	Add each byte of a null terminated string to a class.
+ */
+void
+jmscott_char_class_add(struct jmscott_char_class *cc, const char *chars)
+{
+	unsigned char c;
+
+	while ((c = *chars++))
+		jmscott_char_class_add_range(cc, c, c);
+}
+
+static size_t
+span_class_scalar(
+	const struct jmscott_char_class *cc,
+	const unsigned char *s,
+	size_t i,
+	size_t len
+){
+	while (i < len && IN_CLASS(cc, s[i]))
+		i++;
+	return i;
+}
+
+/*
+ *  Span of bytes in the unsigned range [lo, hi], scalar.
+ */
+static size_t
+span_range_scalar(
+	const unsigned char *s,
+	size_t i,
+	size_t len,
+	unsigned char lo,
+	unsigned char hi
+){
+	while (i < len && (unsigned char)(s[i] - lo) <= (unsigned char)(hi - lo))
+		i++;
+	return i;
+}
+
+#ifdef JMSCOTT_SPAN_X86
+
+static int
+have_avx2()
+{
+	static int avx2 = -1;
+
+	if (avx2 == -1)
+		avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	return avx2;
+}
+
+static int
+have_ssse3()
+{
+	static int ssse3 = -1;
+
+	if (ssse3 == -1)
+		ssse3 = __builtin_cpu_supports("ssse3") ? 1 : 0;
+	return ssse3;
+}
+
+/*
+ *  Span of the unsigned range [lo, hi], 16 bytes per step.
+ *
+ *  Bias by lo, so in range bytes are exactly those <= hi - lo, then test
+ *  with min_epu8(), since sse2 has no unsigned compare.
+ */
+static size_t
+span_range_sse2(
+	const unsigned char *s,
+	size_t len,
+	unsigned char lo,
+	unsigned char hi
+){
+	const __m128i vlo = _mm_set1_epi8((char)lo);
+	const __m128i vwidth = _mm_set1_epi8((char)(hi - lo));
+	size_t i = 0;
+
+	for (;  i + 16 <= len;  i += 16) {
+		__m128i x = _mm_sub_epi8(
+				_mm_loadu_si128((const __m128i *)(s + i)),
+				vlo
+		);
+		__m128i in = _mm_cmpeq_epi8(_mm_min_epu8(x, vwidth), x);
+		unsigned out = ~_mm_movemask_epi8(in) & 0xffff;
+		if (out)
+			return i + __builtin_ctz(out);
+	}
+	return span_range_scalar(s, i, len, lo, hi);
+}
+
+__attribute__((target("avx2")))
+static size_t
+span_range_avx2(
+	const unsigned char *s,
+	size_t len,
+	unsigned char lo,
+	unsigned char hi
+){
+	const __m256i vlo = _mm256_set1_epi8((char)lo);
+	const __m256i vwidth = _mm256_set1_epi8((char)(hi - lo));
+	size_t i = 0;
+
+	for (;  i + 32 <= len;  i += 32) {
+		__m256i x = _mm256_sub_epi8(
+				_mm256_loadu_si256((const __m256i *)(s + i)),
+				vlo
+		);
+		__m256i in = _mm256_cmpeq_epi8(_mm256_min_epu8(x, vwidth), x);
+		unsigned out = ~(unsigned)_mm256_movemask_epi8(in);
+		if (out)
+			return i + __builtin_ctz(out);
+	}
+	return span_range_scalar(s, i, len, lo, hi);
+}
+
+/*
+ *  Class membership of 16 bytes via nibble lookup:
+ *
+ *	rows = (high nibble < 8 ? row_lo : row_hi)[low nibble]
+ *	bit  = 1 << (high nibble & 7)
+ *	in   = (rows & bit) != 0
+ */
+__attribute__((target("ssse3")))
+static size_t
+span_class_ssse3(
+	const struct jmscott_char_class *cc,
+	const unsigned char *s,
+	size_t len
+){
+	const __m128i row_lo = _mm_loadu_si128((const __m128i *)cc->row_lo);
+	const __m128i row_hi = _mm_loadu_si128((const __m128i *)cc->row_hi);
+	const __m128i bit = _mm_setr_epi8(
+				1, 2, 4, 8, 16, 32, 64, -128,
+				1, 2, 4, 8, 16, 32, 64, -128
+	);
+	const __m128i nib = _mm_set1_epi8(0x0f);
+	const __m128i seven = _mm_set1_epi8(7);
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+
+	for (;  i + 16 <= len;  i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i lo = _mm_and_si128(x, nib);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), nib);
+		__m128i upper = _mm_cmpgt_epi8(hi, seven);
+		__m128i rows = _mm_or_si128(
+				_mm_andnot_si128(upper,
+					_mm_shuffle_epi8(row_lo, lo)),
+				_mm_and_si128(upper,
+					_mm_shuffle_epi8(row_hi, lo))
+		);
+		__m128i in = _mm_and_si128(rows, _mm_shuffle_epi8(bit, hi));
+		unsigned out = _mm_movemask_epi8(_mm_cmpeq_epi8(in, zero));
+		if (out)
+			return i + __builtin_ctz(out);
+	}
+	return span_class_scalar(cc, s, i, len);
+}
+
+__attribute__((target("avx2")))
+static size_t
+span_class_avx2(
+	const struct jmscott_char_class *cc,
+	const unsigned char *s,
+	size_t len
+){
+	const __m256i row_lo = _mm256_broadcastsi128_si256(
+				_mm_loadu_si128((const __m128i *)cc->row_lo)
+	);
+	const __m256i row_hi = _mm256_broadcastsi128_si256(
+				_mm_loadu_si128((const __m128i *)cc->row_hi)
+	);
+	const __m256i bit = _mm256_setr_epi8(
+				1, 2, 4, 8, 16, 32, 64, -128,
+				1, 2, 4, 8, 16, 32, 64, -128,
+				1, 2, 4, 8, 16, 32, 64, -128,
+				1, 2, 4, 8, 16, 32, 64, -128
+	);
+	const __m256i nib = _mm256_set1_epi8(0x0f);
+	const __m256i seven = _mm256_set1_epi8(7);
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+
+	for (;  i + 32 <= len;  i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i lo = _mm256_and_si256(x, nib);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), nib);
+		__m256i upper = _mm256_cmpgt_epi8(hi, seven);
+		__m256i rows = _mm256_blendv_epi8(
+				_mm256_shuffle_epi8(row_lo, lo),
+				_mm256_shuffle_epi8(row_hi, lo),
+				upper
+		);
+		__m256i in = _mm256_and_si256(
+				rows,
+				_mm256_shuffle_epi8(bit, hi)
+		);
+		unsigned out = _mm256_movemask_epi8(
+				_mm256_cmpeq_epi8(in, zero)
+		);
+		if (out)
+			return i + __builtin_ctz(out);
+	}
+	return span_class_scalar(cc, s, i, len);
+}
+
+#endif	//  JMSCOTT_SPAN_X86
+
+/*
+ *  Synopsis:
+ *	Length of initial run of bytes in unsigned range [lo, hi].
+ */
+size_t
+jmscott_span_range(
+	const char *src,
+	size_t len,
+	unsigned char lo,
+	unsigned char hi
+){
+	const unsigned char *s = (const unsigned char *)src;
+
+	if (lo > hi)
+		return 0;
+#ifdef JMSCOTT_SPAN_X86
+	if (len >= 32 && have_avx2())
+		return span_range_avx2(s, len, lo, hi);
+	return span_range_sse2(s, len, lo, hi);
+#else
+	return span_range_scalar(s, 0, len, lo, hi);
+#endif
+}
+
+/*
+ *  Synopsis:
+ *	Length of initial run of "len" bytes in the character class.
+ *  Returns:
+ *	len		all bytes are in the class
+ *	< len		offset of first byte not in the class
+ *  Note:
+ *	Null bytes are classified like any other byte.
+ */
+size_t
+jmscott_span_class(
+	const struct jmscott_char_class *cc,
+	const char *src,
+	size_t len
+){
+	const unsigned char *s = (const unsigned char *)src;
+
+#ifdef JMSCOTT_SPAN_X86
+	if (len >= 32 && have_avx2())
+		return span_class_avx2(cc, s, len);
+	if (len >= 16 && have_ssse3())
+		return span_class_ssse3(cc, s, len);
+#endif
+	return span_class_scalar(cc, s, 0, len);
+}
+
+/*
+ *  Synopsis:
+ *	Are all "len" bytes ascii graphics chars, [!-~]?
+ *  Returns:
+ *	0	all graphics chars
+ *	<pos>	position of first non-graphical char, starting at 1
+ *  Note:
+ *	Unlike isgraph(), the answer does not depend upon the locale.
+ */
+size_t
+jmscott_isgraph_len(const char *str, size_t len)
+{
+	size_t n = jmscott_span_range(str, len, '!', '~');
+
+	return n == len ? 0 : n + 1;
+}
+
+/*
+ *  Synopsis:
+ *	Are all "len" bytes ascii digits, [0-9]?
+ *  Returns:
+ *	0	all digits
+ *	<pos>	position of first non-digit char, starting at 1
+ */
+size_t
+jmscott_isdigit_len(const char *str, size_t len)
+{
+	size_t n = jmscott_span_range(str, len, '0', '9');
+
+	return n == len ? 0 : n + 1;
+}
@@ -0,0 +1,216 @@
+/*
+ *  Synopsis:
+ *	Length tracking string builder, replacing chains of jmscott_strcatN().
+ *  Description:
+ *	A struct jmscott_strbuf remembers the length of the string built so
+ *	far, so each append copies only the new bytes, instead of rescanning
+ *	the target for the terminating null, as jmscott_strcat() does.
+ *
+ *	The buffer is either owned by the caller (typically on the stack)
+ *	or allocated with jmscott_halloc().  A stack buffer never grows and
+ *	is safe in signal handlers.  A halloc()ed buffer doubles in size
+ *	when full.
+ *
+ *	Overflow is never silent.  Bytes that do not fit are dropped, the
+ *	string remains null terminated and the sticky field "truncated" is
+ *	set.  Each append also returns -1 upon truncation.
+ *  Usage:
+ *	char buf[JMSCOTT_ATOMIC_WRITE_SIZE];
+ *	struct jmscott_strbuf sb;
+ *
+ *	jmscott_strbuf_init(&sb, buf, sizeof buf);
+ *	jmscott_strbuf_append3(&sb, "hello", ", ", "world");
+ *	jmscott_strbuf_append(&sb, ": pid #");
+ *	jmscott_strbuf_append_int(&sb, getpid());
+ *	if (sb.truncated)
+ *		die("message too long");
+ *	write(2, sb.buf, sb.len);
+ *  Note:
+ *	Consider a jmscott_strbuf_append_json() that escapes ascii, similar
+ *	to jmscott_ascii2json_string().
+ */
+#include <sys/errno.h>
+#include <string.h>
+
+#include "jmscott/libjmscott.h"
+
+/*
+ *  Synopsis:
+ *	Initialize a string builder over a caller owned buffer.
+ *  Note:
+ *	A buffer of size 0 is treated as always truncated, with buf left
+ *	pointing to a static empty string.
+ */
+void
+jmscott_strbuf_init(struct jmscott_strbuf *sb, char *buf, size_t size)
+{
+	static char empty[] = "";
+
+	sb->grow = 0;
+	sb->len = 0;
+	sb->truncated = 0;
+	if (size == 0) {
+		sb->buf = empty;
+		sb->size = 1;
+		return;
+	}
+	sb->buf = buf;
+	sb->size = size;
+	buf[0] = 0;
+}
+
+/*
+ *  Synopsis:
+ *	Initialize a growable string builder allocated by jmscott_halloc().
+ *  Returns:
+ *	(char *)0	buffer allocated
+ *	(char *)	english error, consult errno
+ *  Note:
+ *	The buffer belongs to the parent.  Free with either
+ *	jmscott_halloc_free(sb->buf) or by freeing the parent.
+ */
+char *
+jmscott_strbuf_halloc(struct jmscott_strbuf *sb, void *parent, size_t size)
+{
+	if (size == 0)
+		size = 64;
+	char *buf = jmscott_halloc(parent, size);
+	if (!buf)
+		return "halloc(strbuf) failed: out of memory";
+
+	jmscott_strbuf_init(sb, buf, size);
+	sb->grow = 1;
+	return (char *)0;
+}
+
+/*
+ *  Make room for "need" more bytes plus the null, doubling a halloc()ed
+ *  buffer as required.  Return the number of bytes that fit.
+ */
+static size_t
+room(struct jmscott_strbuf *sb, size_t need)
+{
+	size_t avail = sb->size - sb->len - 1;
+
+	if (need <= avail || !sb->grow)
+		return need <= avail ? need : avail;
+
+	size_t size = sb->size;
+	while (size - sb->len - 1 < need) {
+		if (size > (size_t)-1 / 2)
+			return avail;
+		size *= 2;
+	}
+	char *buf = jmscott_halloc_resize(sb->buf, size);
+	if (!buf)
+		return avail;
+	sb->buf = buf;
+	sb->size = size;
+	return need;
+}
+
+/*
+ *  Synopsis:
+ *	Append exactly "n" bytes of src, which need not be null terminated.
+ *  Returns:
+ *	0	all bytes appended
+ *	-1	truncated, the field sb->truncated is set
+ */
+int
+jmscott_strbuf_appendn(struct jmscott_strbuf *sb, const char *src, size_t n)
+{
+	size_t fit = room(sb, n);
+
+	memcpy(sb->buf + sb->len, src, fit);
+	sb->len += fit;
+	sb->buf[sb->len] = 0;
+	if (fit < n) {
+		sb->truncated = 1;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  Synopsis:
+ *	Append a null terminated string.  A null pointer appends nothing,
+ *	similar to jmscott_strcat().
+ */
+int
+jmscott_strbuf_append(struct jmscott_strbuf *sb, const char *src)
+{
+	if (!src)
+		return sb->truncated ? -1 : 0;
+	return jmscott_strbuf_appendn(sb, src, strlen(src));
+}
+
+int
+jmscott_strbuf_append2(
+	struct jmscott_strbuf *sb,
+	const char *src1,
+	const char *src2
+){
+	jmscott_strbuf_append(sb, src1);
+	return jmscott_strbuf_append(sb, src2);
+}
+
+int
+jmscott_strbuf_append3(
+	struct jmscott_strbuf *sb,
+	const char *src1,
+	const char *src2,
+	const char *src3
+){
+	jmscott_strbuf_append(sb, src1);
+	jmscott_strbuf_append(sb, src2);
+	return jmscott_strbuf_append(sb, src3);
+}
+
+int
+jmscott_strbuf_append4(
+	struct jmscott_strbuf *sb,
+	const char *src1,
+	const char *src2,
+	const char *src3,
+	const char *src4
+){
+	jmscott_strbuf_append(sb, src1);
+	jmscott_strbuf_append(sb, src2);
+	jmscott_strbuf_append(sb, src3);
+	return jmscott_strbuf_append(sb, src4);
+}
+
+/*
+ *  Synopsis:
+ *	Append a signed decimal integer, without stdio.
+ */
+int
+jmscott_strbuf_append_int(struct jmscott_strbuf *sb, long long ll)
+{
+	char digits[21];	//  "-9223372036854775808"
+
+	return jmscott_strbuf_appendn(
+			sb,
+			digits,
+			jmscott_lltoa(ll, digits) - digits
+	);
+}
+
+/*
+ *  Synopsis:
+ *	Append a timestamp formatted as YYYY-MM-DDThh:mm:ss.nsec+00:00
+ *  Returns:
+ *	0	appended
+ *	-1	truncated, or time not representable and nothing appended
+ */
+int
+jmscott_strbuf_append_RFC3339Nano(
+	struct jmscott_strbuf *sb,
+	struct timespec *ts
+){
+	char buf[JMSCOTT_RFC3339NANO_SIZE + 1];
+
+	if (jmscott_RFC3339Nano_timespec(buf, sizeof buf, ts))
+		return -1;
+	return jmscott_strbuf_appendn(sb, buf, JMSCOTT_RFC3339NANO_SIZE);
+}
@@ -7,13 +7,12 @@
  *	Investigate in clang is a caller can be forced to use a return value.
  *	In particular, see function jmscott_ulltoa().
  *
- *	Add func is_utf8() and merge with is-utf8wf.c.  see ctyoe isalnum_l.
- *	Add func is_in_set() and merge with isdigit().
- *
  *	The BSD clib function strlcat() comes close to the behaviour of the
  *	jmscott_strcat*() functions.  However, strlcat() is not on linux.  
  *	
- *	Should jmscott_strcat*() funcs return char * to terminating \0?
+ *	The jmscott_strcat*() funcs rescan the target for the terminating
+ *	null on every call, so long chains are quadratic.  Prefer the
+ *	length tracking struct jmscott_strbuf in strbuf.c for new code.
  *
  *	Need version of *_strcatN() that separates args with ": ",
  *	maybe named jmscott_coloncatN().
@@ -26,6 +25,7 @@
 #include <ctype.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 
 #include "jmscott/libjmscott.h"
 
@@ -409,6 +409,8 @@ jmscott_split(char *src, char split, int *offset, int *noffset)
  *
  *	A zero length string is considered to contain all graphics, since we
  *	cannot point to a offset of an offending char.  not perfect.
+ *
+ *	Graphics chars are ascii [!-~], regardless of locale.  See span.c.
  *  Usage:
  *	int pos = jmscott_isgraph(argv[2]);
  *	if (pos-- > 0)
@@ -420,16 +422,7 @@ jmscott_split(char *src, char split, int *offset, int *noffset)
 int
 jmscott_isgraph(char *str)
 {
-	char *s = str;
-
-	if (*s) {
-		char c;
-
-		while ((c = *s++))
-			if (!isgraph(c))
-				return s - str;
-	}
-	return 0;
+	return (int)jmscott_isgraph_len(str, strlen(str));
 }
 
 /*
@@ -450,14 +443,5 @@ jmscott_isgraph(char *str)
 int
 jmscott_isdigit(char *str)
 {
-	char *s = str;
-
-	if (*s) {
-		char c;
-
-		while ((c = *s++))
-			if (!isdigit(c))
-				return s - str;
-	}
-	return 0;
+	return (int)jmscott_isdigit_len(str, strlen(str));
 }
@@ -0,0 +1,81 @@
+/*
+ *  Synopsis:
+ *	Hand run test that a callback or filter abort stops jmscott_walk().
+ *  Usage:
+ *	$ cc test-dir-walk-abort.c -L. -ljmscott -lpthread
+ *	$ ./a.out /usr/include; echo $?
+ *  Description:
+ *	The on_error callback ignores every error, as a tolerant caller
+ *	would, so must never see the abort of a filter or callback.  With
+ *	one thread, the walk must stop at the entry that aborted.
+ */
+#include <string.h>
+
+#include "libjmscott.h"
+
+char *jmscott_progname = "t";
+
+static void
+die(char *msg)
+{
+	jmscott_die(1, msg);
+}
+
+static void
+die2(char *msg1, char *msg2)
+{
+	jmscott_die2(1, msg1, msg2);
+}
+
+static int
+tolerate(const char *path, char *err, void *private)
+{
+	(void)path;
+	(void)err;
+	(void)private;
+	return 0;
+}
+
+//  keep the root, abort at the first entry below
+
+static int
+abort_below_root(struct jmscott_walk_entry *e, void *private)
+{
+	(void)private;
+	return e->depth == 0 ? 1 : -1;
+}
+
+static void
+walk(char *what, char *root, char *want)
+{
+	struct jmscott_walk w;
+	char *err;
+
+	memset(&w, 0, sizeof w);
+	w.nthread = 1;
+	w.on_error = tolerate;
+	if (strcmp(what, "filter") == 0)
+		w.filter = abort_below_root;
+	else
+		w.callback = abort_below_root;
+
+	err = jmscott_walk(&w, root);
+	if (!err)
+		die2(what, "abort ignored: walk returned no error");
+	if (strcmp(err, want) != 0)
+		die2(what, err);
+	if (w.nerror != 0)
+		die2(what, "abort counted as error on path");
+	if (w.nentry != 2)
+		die2(what, "walk did not stop at aborted entry");
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 2)
+		die("wrong number of command args");
+	walk("callback", argv[1], "walk aborted by callback");
+	walk("filter", argv[1], "walk aborted by filter");
+	return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ *  Synopsis:
+ *	Hand run test of pipelined inserts in pq.c.
+ *  Usage:
+ *	#  scratch server in a temp dir, listening only on a unix socket
+ *	$ D=$(mktemp -d)
+ *	$ initdb -D $D/data >/dev/null
+ *	$ pg_ctl -D $D/data -l $D/log -o "-k $D -c listen_addresses=" start
+ *
+ *	#  libjmscott.a built with JMSCOTT_COMPILE_PG=1
+ *	$ cc -I$PGINC test-pq-pipeline.c -L. -ljmscott -L$PGLIB -lpq
+ *	$ ./a.out "host=$D dbname=postgres"; echo $?
+ *
+ *	$ pg_ctl -D $D/data stop;  rm -r $D
+ *  Description:
+ *	Loads rows through a pipeline, each row sent twice, so half the
+ *	inserts fault with unique violation 23505, which the fault map
+ *	ignores.  With a batch of 1 no statement may be aborted, and many
+ *	statements must be in flight per sync read.  A batch of 4 with a
+ *	duplicate must roll back the whole batch, including the statement
+ *	before the duplicate, and report it.  A map of 23505 to exit 3 must
+ *	set the status.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "libpq-fe.h"
+#include "libjmscott.h"
+
+char *jmscott_progname = "test-pq-pipeline";
+
+#define NROW	10000
+
+static struct jmscott_ecpg_state_fault ignore_dup[] =
+{
+	{"23505", -1},		//  unique violation: row exists
+	{(char *)0, 0}
+};
+
+static struct jmscott_ecpg_state_fault exit_dup[] =
+{
+	{"23505", 3},
+	{(char *)0, 0}
+};
+
+static PGconn *conn;
+
+static void
+die(char *msg)
+{
+	jmscott_die(1, msg);
+}
+
+static void
+die2(char *msg1, char *msg2)
+{
+	jmscott_die2(1, msg1, msg2);
+}
+
+static void
+sql(char *stmt)
+{
+	PGresult *res = PQexec(conn, stmt);
+
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		die2(stmt, PQerrorMessage(conn));
+	PQclear(res);
+}
+
+static unsigned long long
+count(char *table)
+{
+	char stmt[64];
+	PGresult *res;
+	unsigned long long n;
+
+	snprintf(stmt, sizeof stmt, "SELECT count(*) FROM %s", table);
+	res = PQexec(conn, stmt);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		die2(stmt, PQerrorMessage(conn));
+	if (jmscott_a2ui63(PQgetvalue(res, 0, 0), &n))
+		die2("count not a number", PQgetvalue(res, 0, 0));
+	PQclear(res);
+	return n;
+}
+
+static void
+test_pipeline()
+{
+	struct jmscott_pq_pipeline p;
+	char id[32], *err;
+	const char *values[1] = {id};
+	int i;
+
+	sql("CREATE TEMP TABLE pipe(id int PRIMARY KEY)");
+
+	//  batch of 1: every duplicate ignored, nothing aborted
+
+	if ((err = jmscott_pq_pipeline_begin(&p, conn, ignore_dup, 1, 0)))
+		die2("pipeline_begin(1) failed", err);
+	for (i = 0;  i < 2 * NROW;  i++) {
+		snprintf(id, sizeof id, "%d", i / 2);
+		if ((err = jmscott_pq_pipeline_exec(
+			&p,
+			"INSERT INTO pipe(id) VALUES($1::int)",
+			1,
+			values
+		)))
+			die2("pipeline_exec(1) failed", err);
+		if (p.nsync_pending > p.window)
+			die("more syncs in flight than window");
+	}
+	if ((err = jmscott_pq_pipeline_end(&p)))
+		die2("pipeline_end(1) failed", err);
+	if (p.nexec != 2 * NROW || p.nsync != 2 * NROW)
+		die("pipeline(1): wrong count of statements or syncs");
+	if (p.nignored != NROW)
+		die("pipeline(1): ignored faults != row count");
+	if (p.naborted != 0)
+		die("pipeline(1): statements aborted");
+	if (count("pipe") != NROW)
+		die("pipeline(1): wrong count of rows");
+
+	//  batches of 4: an ignored fault rolls back all of 0, 0, 2, 3,
+	//  leaving only the 4 rows of the second batch
+
+	sql("TRUNCATE pipe");
+	if ((err = jmscott_pq_pipeline_begin(&p, conn, ignore_dup, 4, 8)))
+		die2("pipeline_begin(4) failed", err);
+	for (i = 0;  i < 8 && !err;  i++) {
+		snprintf(id, sizeof id, "%d", i == 1 ? 0 : i);
+		err = jmscott_pq_pipeline_exec(
+			&p,
+			"INSERT INTO pipe(id) VALUES($1::int)",
+			1,
+			values
+		);
+	}
+	if (!err)
+		err = jmscott_pq_pipeline_end(&p);
+	else
+		(void)jmscott_pq_pipeline_end(&p);
+	if (!err || !strstr(err, "batch rolled back by ignored fault"))
+		die("pipeline(4): no error for rolled back batch");
+	if (p.nignored != 1)
+		die("pipeline(4): ignored faults != 1");
+	if (p.naborted != 3)
+		die("pipeline(4): rolled back statements != 3");
+	if (count("pipe") != 4)
+		die("pipeline(4): row count != 4");
+
+	//  unignored fault remaps the exit status
+
+	if ((err = jmscott_pq_pipeline_begin(&p, conn, exit_dup, 1, 0)))
+		die2("pipeline_begin(exit) failed", err);
+	snprintf(id, sizeof id, "%d", 7);
+	err = jmscott_pq_pipeline_exec(
+		&p,
+		"INSERT INTO pipe(id) VALUES($1::int)",
+		1,
+		values
+	);
+	if (!err)
+		err = jmscott_pq_pipeline_end(&p);
+	else
+		(void)jmscott_pq_pipeline_end(&p);
+	if (!err || strncmp(err, "SQLERROR: 23505: ", 17) != 0)
+		die("pipeline(exit): no SQLERROR: 23505");
+	if (p.status != 3)
+		die("pipeline(exit): status != 3");
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 2)
+		die("wrong number of command args");
+	conn = PQconnectdb(argv[1]);
+	if (PQstatus(conn) != CONNECTION_OK)
+		die2("PQconnectdb() failed", PQerrorMessage(conn));
+
+	test_pipeline();
+
+	PQfinish(conn);
+	return 0;
+}
@@ -1,18 +1,213 @@
 /*
  *  Synopsis:
  *	Common time routines.
+ *  Description:
+ *	All RFC3339 formatters share a per thread cache of the prefix
+ *	YYYY-MM-DDThh:mm:ss for the most recent second, so the calendar
+ *	date is computed at most once per second per thread.  Only the fractional
+ *	digits are written per call, two digits at a time from a table,
+ *	without branches or stdio.
+ *
+ *	The cache is guarded by a sequence counter, similar to a seqlock, so
+ *	a signal handler formatting a time while the interrupted code was
+ *	updating or reading the cache sees either a consistent prefix or a
+ *	miss.
+ *  Note:
+ *	Leap seconds (ss == 60) are never generated, since time_t has none.
  */
 #include <sys/time.h>
 #include <time.h>
 #include <sys/errno.h>
 #include <string.h>
-#include <stdio.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "jmscott/libjmscott.h"
 
-static char	*RFC3339 = "%04d-%02d-%02dT%02d:%02d:%02d+00:00";
-static char	*RFC3339Nano = "%04d-%02d-%02dT%02d:%02d:%02d.%09ld+00:00";
-static char	*RFC3339Micro = "%04d-%02d-%02dT%02d:%02d:%02d.%03ld%c+00:00";
+//  YYYY-MM-DDThh:mm:ss
+#define PREFIX_SIZE	19
+
+static __thread struct
+{
+	unsigned	seq;		//  0 is empty, odd while updating
+	time_t		sec;
+	char		prefix[PREFIX_SIZE];
+} cache;
+
+static const char digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899"
+;
+
+//  write two digits of v, 0 <= v < 100
+#define PUT2(p, v)	memcpy((p), digit_pairs + 2 * (v), 2)
+
+/*
+ *  Write "n" decimal digits of "v", zero padded, most significant first.
+ */
+static char *
+put_digits(char *p, unsigned long v, int n)
+{
+	char *end = p + n;
+
+	while (n-- > 0) {
+		p[n] = '0' + v % 10;
+		v /= 10;
+	}
+	return end;
+}
+
+/*
+ *  Proleptic gregorian date of days since 1970-01-01, the inverse of
+ *  days_from_civil() below.  Unlike gmtime_r(), which in glibc takes the
+ *  time zone lock, safe in signal handlers.
+ */
+static void
+civil_from_days(long long z, long long *y, int *m, int *d)
+{
+	z += 719468;
+
+	long long era = (z >= 0 ? z : z - 146096) / 146097;
+	long long doe = z - era * 146097;
+	long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	long long mp = (5 * doy + 2) / 153;
+
+	*d = doy - (153 * mp + 2) / 5 + 1;
+	*m = mp < 10 ? mp + 3 : mp - 9;
+	*y = yoe + era * 400 + (*m <= 2);
+}
+
+/*
+ *  Format YYYY-MM-DDThh:mm:ss for the second, bypassing the cache.
+ */
+static char *
+format_prefix(char *p, time_t sec)
+{
+	long long days = sec / 86400, y;
+	long s = sec % 86400;
+	int m, d;
+
+	if (s < 0) {
+		s += 86400;
+		days--;
+	}
+	civil_from_days(days, &y, &m, &d);
+	if (y > 9999 || y < 0)
+		return "year not in [0000, 9999]";
+
+	p = put_digits(p, y, 4);
+	*p++ = '-';
+	PUT2(p, m);			p += 2;
+	*p++ = '-';
+	PUT2(p, d);			p += 2;
+	*p++ = 'T';
+	PUT2(p, s / 3600);		p += 2;
+	*p++ = ':';
+	PUT2(p, s / 60 % 60);		p += 2;
+	*p++ = ':';
+	PUT2(p, s % 60);
+	return (char *)0;
+}
+
+/*
+ *  Copy YYYY-MM-DDThh:mm:ss into p, from the per thread cache when the
+ *  second has not changed.
+ */
+static char *
+put_prefix(char *p, time_t sec)
+{
+	unsigned seq = cache.seq;
+
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	if (seq != 0 && (seq & 1) == 0 && cache.sec == sec) {
+		memcpy(p, cache.prefix, PREFIX_SIZE);
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+		//  not rewritten by a signal handler while copying
+		if (cache.seq == seq)
+			return (char *)0;
+	}
+
+	char *err = format_prefix(p, sec);
+	if (err)
+		return err;
+
+	//  an odd sequence means an interrupted update, so leave cache be
+	if (cache.seq & 1)
+		return (char *)0;
+	cache.seq++;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	cache.sec = sec;
+	memcpy(cache.prefix, p, PREFIX_SIZE);
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	cache.seq++;
+	return (char *)0;
+}
+
+/*
+ *  Branch free fractional digits, nine for nano seconds.
+ */
+static char *
+put_nano(char *p, unsigned long nsec)
+{
+	*p++ = '0' + nsec / 100000000;
+	nsec %= 100000000;
+	PUT2(p, nsec / 1000000);
+	PUT2(p + 2, nsec / 10000 % 100);
+	PUT2(p + 4, nsec / 100 % 100);
+	PUT2(p + 6, nsec % 100);
+	return p + 8;
+}
+
+/*
+ *  Branch free fractional digits, six for micro seconds.
+ */
+static char *
+put_micro(char *p, unsigned long usec)
+{
+	PUT2(p, usec / 10000);
+	PUT2(p + 2, usec / 100 % 100);
+	PUT2(p + 4, usec % 100);
+	return p + 6;
+}
+
+/*
+ *  Format YYYY-MM-DDThh:mm:ss[.frac]+00:00, where "ndigit" is 0, 6 or 9.
+ */
+static char *
+format(char *buf, int buf_size, time_t sec, long frac, int ndigit)
+{
+	char *err;
+
+	if (buf_size <= PREFIX_SIZE + (ndigit ? ndigit + 1 : 0) + 6)
+		return "time buffer too small";
+	if (frac < 0 || frac > (ndigit == 9 ? 999999999 : 999999))
+		return "fractional second out of range";
+	if ((err = put_prefix(buf, sec)))
+		return err;
+
+	char *p = buf + PREFIX_SIZE;
+	if (ndigit > 0) {
+		*p++ = '.';
+		if (ndigit == 9)
+			p = put_nano(p, frac);
+		else
+			p = put_micro(p, frac);
+	}
+	memcpy(p, "+00:00", 7);
+	return (char *)0;
+}
 
 /*
  *  Synopsis:
@@ -20,30 +215,13 @@ static char	*RFC3339Micro = "%04d-%02d-%02dT%02d:%02d:%02d.%03ld%c+00:00";
  *  Returns:
  *	(char *)0	ok
  *	(char *)	error string in english
- *  Note:
- *	Not rounding correctly!
  */
 char *
 jmscott_RFC3339Micro_timeval(char *buf, int buf_size, struct timeval *tv)
 {
 	if (!tv)
 		return "null timeval";
-	struct tm *t = gmtime(&tv->tv_sec);
-	if (!t)
-		return strerror(errno);
-
-	/*
-	 *  Format the buffer.
-	 */
-	return snprintf(buf, buf_size, RFC3339Micro,
-		t->tm_year + 1900,
-		t->tm_mon + 1,
-		t->tm_mday,
-		t->tm_hour,
-		t->tm_min,
-		t->tm_sec,
-		tv->tv_usec
-	) < buf_size ? (char *)0 : "time buffer too small";
+	return format(buf, buf_size, tv->tv_sec, tv->tv_usec, 6);
 }
 
 /*
@@ -60,21 +238,7 @@ jmscott_RFC3339Sec_timeval(char *buf, int buf_size, struct timeval *tv)
 {
 	if (!tv)
 		return "null timeval";
-	struct tm *t = gmtime(&tv->tv_sec);
-	if (!t)
-		return strerror(errno);
-
-	/*
-	 *  Format the buffer.
-	 */
-	return snprintf(buf, buf_size, RFC3339Micro,
-		t->tm_year + 1900,
-		t->tm_mon + 1,
-		t->tm_mday,
-		t->tm_hour,
-		t->tm_min,
-		t->tm_sec
-	) < buf_size ? (char *)0 : "time buffer too small";
+	return format(buf, buf_size, tv->tv_sec, 0, 0);
 }
 
 /*
@@ -89,94 +253,280 @@ jmscott_RFC3339Nano_timeval(char *buf, int buf_size, struct timeval *tv)
 {
 	if (!tv)
 		return "null timeval";
-	struct tm *t = gmtime(&tv->tv_sec);
-	if (!t)
-		return strerror(errno);
+	return format(buf, buf_size, tv->tv_sec, tv->tv_usec * 1000, 9);
+}
 
-	/*
-	 *  Format the buffer.
-	 */
-	return snprintf(buf, buf_size, RFC3339Nano,
-		t->tm_year + 1900,
-		t->tm_mon + 1,
-		t->tm_mday,
-		t->tm_hour,
-		t->tm_min,
-		t->tm_sec,
-		tv->tv_usec
-	) < buf_size ? (char *)0 : "time buffer too small";
+/*
+ *  Synopsis:
+ *	Convert timespec to YYYY-MM-DDThh:mm:ss.nsec+00:00, without stdio.
+ *  Returns:
+ *	(char *)0	ok
+ *	(char *)	error string in english
+ *  Note:
+ *	Safe in signal handlers.
+ */
+char *
+jmscott_RFC3339Nano_timespec(char *buf, int buf_size, struct timespec *ts)
+{
+	if (!ts)
+		return "null timespec";
+	return format(buf, buf_size, ts->tv_sec, ts->tv_nsec, 9);
 }
 
 char *
 jmscott_RFC3339Nano_now(char *buf, int buf_size)
 {
 	struct timespec	now;
-	struct tm *t;
-	
+
         if (clock_gettime(CLOCK_REALTIME, &now) < 0)
 		return strerror(errno);
-	t = gmtime(&now.tv_sec);
-	if (t == NULL)
-		return strerror(errno);
-	/*
-	 *  Format the time buffer.
-	 */
-	return snprintf(buf, buf_size, RFC3339Nano,
-		t->tm_year + 1900,
-		t->tm_mon + 1,
-		t->tm_mday,
-		t->tm_hour,
-		t->tm_min,
-		t->tm_sec,
-		now.tv_nsec
-	) < buf_size ? (char *)0 : "time buffer too small";
+	return format(buf, buf_size, now.tv_sec, now.tv_nsec, 9);
 }
 
 char *
 jmscott_RFC3339Micro_now(char *buf, int buf_size)
 {
 	struct timespec	now;
-	struct tm *t;
-	
+
         if (clock_gettime(CLOCK_REALTIME, &now) < 0)
 		return strerror(errno);
-	t = gmtime(&now.tv_sec);
-	if (t == NULL)
-		return strerror(errno);
-	/*
-	 *  Format the time buffer.
-	 */
-	return snprintf(buf, buf_size, RFC3339Nano,
-		t->tm_year + 1900,
-		t->tm_mon + 1,
-		t->tm_mday,
-		t->tm_hour,
-		t->tm_min,
-		t->tm_sec,
-		now.tv_nsec
-	) < buf_size ? (char *)0 : "time buffer too small";
+	return format(buf, buf_size, now.tv_sec, now.tv_nsec / 1000, 6);
 }
 
 char *
 jmscott_RFC333Sec_now(char *buf, int buf_size)
 {
 	struct timespec	now;
-	struct tm *t;
-	
+
         if (clock_gettime(CLOCK_REALTIME, &now) < 0)
 		return strerror(errno);
-	t = gmtime(&now.tv_sec);
-	if (t == NULL)
-		return strerror(errno);
-	/*
-	 *  Format the time buffer.
-	 */
-	return snprintf(buf, buf_size, RFC3339,
-		t->tm_year + 1900,
-		t->tm_mon + 1,
-		t->tm_mday,
-		t->tm_hour,
-		t->tm_min,
-		t->tm_sec
-	) < buf_size ? (char *)0 : "time buffer too small";
+	return format(buf, buf_size, now.tv_sec, 0, 0);
+}
+
+/*
+ *  Days since 1970-01-01 of a proleptic gregorian date.  See
+ *
+ *	https://howardhinnant.github.io/date_algorithms.html#days_from_civil
+ */
+static long long
+days_from_civil(long long y, int m, int d)
+{
+	y -= m <= 2;
+
+	long long era = (y >= 0 ? y : y - 399) / 400;
+	long long yoe = y - era * 400;
+	long long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+static int
+days_in_month(int y, int m)
+{
+	static const char mdays[] = {31,28,31,30,31,30,31,31,30,31,30,31};
+
+	if (m == 2 && y % 4 == 0 && (y % 100 != 0 || y % 400 == 0))
+		return 29;
+	return mdays[m - 1];
+}
+
+#define DIG(c)		((unsigned char)((c) - '0') <= 9)
+#define D2(p)		(((p)[0] - '0') * 10 + (p)[1] - '0')
+
+/*
+ *  Scalar check of the layout YYYY-MM-DDThh:mm:ss, with precise errors.
+ */
+static char *
+layout_scalar(const char *s)
+{
+	static const char layout[] = "dddd-dd-ddTdd:dd:dd";
+	int i;
+
+	for (i = 0;  i < PREFIX_SIZE;  i++) {
+		char c = s[i];
+
+		switch (layout[i]) {
+		case 'd':
+			if (!DIG(c))
+				return "non digit in date or time";
+			break;
+		case 'T':
+			if (c != 'T' && c != 't')
+				return "date and time not separated by T";
+			break;
+		case '-':
+			if (c != '-')
+				return "date fields not separated by -";
+			break;
+		default:
+			if (c != ':')
+				return "time fields not separated by :";
+		}
+	}
+	return (char *)0;
+}
+
+#ifdef __SSE2__
+
+/*
+ *  Vectorized check of the fixed layout "YYYY-MM-DDThh:mm", the first
+ *  16 bytes of every timestamp, in one compare against a template.
+ *  Returns 1 when all 16 bytes match.
+ */
+static int
+layout16_sse2(const char *s)
+{
+	const __m128i tmpl = _mm_setr_epi8(
+				0, 0, 0, 0, '-', 0, 0, '-',
+				0, 0, 'T', 0, 0, ':', 0, 0
+	);
+	const __m128i sep = _mm_setr_epi8(
+				0, 0, 0, 0, -1, 0, 0, -1,
+				0, 0, -1, 0, 0, -1, 0, 0
+	);
+	__m128i x = _mm_loadu_si128((const __m128i *)s);
+	__m128i d = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+	__m128i is_dig = _mm_cmpeq_epi8(
+				_mm_min_epu8(d, _mm_set1_epi8(9)),
+				d
+	);
+	__m128i ok = _mm_or_si128(
+			_mm_and_si128(sep, _mm_cmpeq_epi8(x, tmpl)),
+			_mm_andnot_si128(sep, is_dig)
+	);
+	return _mm_movemask_epi8(ok) == 0xffff;
+}
+#endif
+
+/*
+ *  Synopsis:
+ *	Strictly parse an RFC3339 timestamp into nano seconds since epoch.
+ *  Description:
+ *	Parse the layout
+ *
+ *		YYYY-MM-DDThh:mm:ss[.f{1,9}](Z|[+-]hh:mm)
+ *
+ *	from the first "len" bytes of src, no null required.  The 'T' and
+ *	'Z' may be lower case, per the RFC.  The common layout is checked
+ *	with a single vector compare, falling back to a scalar scan for
+ *	precise errors.  Offsets other than Z or +00:00 are applied to
+ *	yield UTC.
+ *
+ *	No memory is allocated and no locale or time zone is consulted.
+ *  Returns:
+ *	(char *)0	*epoch_nsec set, *nparsed set to bytes consumed
+ *	(char *)	english error
+ *  Note:
+ *	A leap second, ss == 60, is accepted only at 23:59 UTC, after
+ *	applying the offset, and folds into the following second.
+ *
+ *	Representable times are 1677-09-21 to 2262-04-11, the range of
+ *	signed 64 bit nano seconds.
+ */
+char *
+jmscott_RFC3339_parse(
+	const char *src,
+	size_t len,
+	long long *epoch_nsec,
+	size_t *nparsed
+){
+	const char *s = src;
+	char *err;
+
+	//  shortest: YYYY-MM-DDThh:mm:ssZ
+	if (len < PREFIX_SIZE + 1)
+		return "timestamp too short";
+#ifdef __SSE2__
+	if (!layout16_sse2(s) || !DIG(s[17]) || !DIG(s[18]) || s[16] != ':')
+#endif
+		if ((err = layout_scalar(s)))
+			return err;
+
+	int year = D2(s) * 100 + D2(s + 2);
+	int month = D2(s + 5);
+	int day = D2(s + 8);
+	int hour = D2(s + 11);
+	int min = D2(s + 14);
+	int sec = D2(s + 17);
+
+	if (month < 1 || month > 12)
+		return "month not in [01, 12]";
+	if (day < 1 || day > days_in_month(year, month))
+		return "day not in month";
+	if (hour > 23)
+		return "hour not in [00, 23]";
+	if (min > 59)
+		return "minute not in [00, 59]";
+	if (sec > 60)
+		return "second not in [00, 60]";
+
+	const char *p = s + PREFIX_SIZE, *end = src + len;
+	long nsec = 0;
+
+	if (*p == '.') {
+		static const long scale[] = {
+			0, 100000000, 10000000, 1000000, 100000,
+			10000, 1000, 100, 10, 1
+		};
+		const char *f = ++p;
+		long frac = 0;
+
+		while (p < end && DIG(*p)) {
+			if (p - f == 9)
+				return "fractional second > 9 digits";
+			frac = frac * 10 + (*p++ - '0');
+		}
+		if (p == f)
+			return "no digits in fractional second";
+		nsec = frac * scale[p - f];
+	}
+	if (p >= end)
+		return "missing time zone offset";
+
+	long long offset = 0;
+	if (*p == 'Z' || *p == 'z')
+		p++;
+	else if (*p == '+' || *p == '-') {
+		if (end - p < 6)
+			return "time zone offset too short";
+		if (!DIG(p[1]) || !DIG(p[2]) || p[3] != ':' ||
+		    !DIG(p[4]) || !DIG(p[5]))
+			return "time zone offset not [+-]hh:mm";
+
+		//  fast path: +00:00 and -00:00 are utc
+		if (memcmp(p + 1, "00:00", 5)) {
+			int oh = D2(p + 1), om = D2(p + 4);
+
+			if (oh > 23)
+				return "offset hour not in [00, 23]";
+			if (om > 59)
+				return "offset minute not in [00, 59]";
+			offset = oh * 3600 + om * 60;
+			if (*p == '-')
+				offset = -offset;
+		}
+		p += 6;
+	} else
+		return "time zone offset not Z or [+-]hh:mm";
+
+	//  leap seconds are inserted only at the end of a utc day
+	if (sec == 60) {
+		long long utc_min = hour * 60 + min - offset / 60;
+
+		if ((utc_min % 1440 + 1440) % 1440 != 23 * 60 + 59)
+			return "leap second not at 23:59 UTC";
+	}
+
+	long long secs = days_from_civil(year, month, day) * 86400 +
+				hour * 3600 + min * 60 + sec - offset;
+	long long ns;
+	if (__builtin_mul_overflow(secs, 1000000000LL, &ns) ||
+	    __builtin_add_overflow(ns, nsec, &ns))
+		return "timestamp out of range of 64 bit nano seconds";
+
+	*epoch_nsec = ns;
+	if (nparsed)
+		*nparsed = p - src;
+	return (char *)0;
 }
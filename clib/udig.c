@@ -1,67 +1,248 @@
 /*
  *  Synopsis:
  *	Uniform digest routines.
+ *  Description:
+ *	Frisk the syntax of udigs, and compute the udigs of buffers, file
+ *	descriptors and mmap()ed files, via the incremental digests in
+ *	digest.c.
  *  Note:
  *	https://github.com/jmscott/blobio
  */
-#include <stdio.h>
-#include <ctype.h>
+#include <sys/errno.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <string.h>
 
 #include "jmscott/libjmscott.h"
 
+extern int	errno;
+
+#define READ_SIZE	(128 * 1024)
+
+/*
+ *  Is byte in [a-z0-9]?  Table lookup, independent of locale.
+ */
+static const unsigned char algo_char[256] = {
+	['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1,
+	['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+	['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1,
+	['g'] = 1, ['h'] = 1, ['i'] = 1, ['j'] = 1, ['k'] = 1, ['l'] = 1,
+	['m'] = 1, ['n'] = 1, ['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1,
+	['s'] = 1, ['t'] = 1, ['u'] = 1, ['v'] = 1, ['w'] = 1, ['x'] = 1,
+	['y'] = 1, ['z'] = 1,
+};
+
 /*
  *  Synopsis:
- *	Frisk a udig matching: [a-z][a-z0-9]{0,7}:([:graph:]&&[:ascii:]){32,128}
+ *	Frisk "len" bytes of a udig, no null required.
+ *  Description:
+ *	Match the udig against
+ *
+ *		[a-z][a-z0-9]{0,7}:([:graph:]&&[:ascii:]){32,128}
+ *
+ *	The short algorithm is scanned with a table.  The digest is scanned
+ *	for ascii graphics 16 or 32 bytes per step, via jmscott_span_range().
  *  Returns:
  *	- null string if udig is syntactically correct.
- *	- a static string describing the error.
- *  See:
- *	https://github.com/jmscott/blobio
+ *	- a static string describing the error, same as jmscott_frisk_udig()
  */
 char *
-jmscott_frisk_udig(char *udig)
+jmscott_frisk_udign(const char *udig, size_t len)
 {
+	const unsigned char *u = (const unsigned char *)udig;
+	size_t i;
+
 	if (!udig)
 		return "udig is null";
-	if (!*udig)
+	if (len == 0)
 		return "udig is zero length";
 
-	//  scan the algorithm matching [a-z][a-z]{0,7}:
-
-	char *u = udig, c;
+	//  scan the algorithm matching [a-z][a-z0-9]{0,7}:
 
-	c = *u++;
-	if (!isalpha(c) || !islower(c))
+	if ((unsigned char)(u[0] - 'a') > 'z' - 'a')
 		return "first char of algorithm not in [a-z]";
-
-	while ((c = *u++)) {
-		if (c == ':')
-			break;
-
-		if (u - udig > 8)
+	for (i = 1;  i < len && u[i] != ':';  i++) {
+		if (i >= 8)
 			return "algo > 8 chars";
-		if (!isascii(c))
-			return "char in algo is not ascii";
-		if (isalpha(c)) {
-			if (!islower(c))
+		if (!algo_char[u[i]]) {
+			if (u[i] >= 0x80)
+				return "char in algo is not ascii";
+			if ((unsigned char)(u[i] - 'A') <= 'Z' - 'A')
 				return "alpha char in algo is not lower";
-		} else if (!isdigit(c))
 			return "char in algo not in [a-z0-9]";
+		}
 	}
-	if (c != ':')
+	if (i == len)
 		return "algorithm not terminated with a colon";
 
 	//  scan the digest matching [[:graph:]]{32,128}
 
-	while ((c = *u++)) {
-		if (u - udig > 128)
-			return "digest > 128 character";
-		if (!isascii(c))
+	const char *digest = udig + i + 1;
+	size_t dlen = len - i - 1;
+
+	if (dlen > 128)
+		return "digest > 128 character";
+
+	size_t pos = jmscott_isgraph_len(digest, dlen);
+	if (pos > 0) {
+		if ((unsigned char)digest[pos - 1] >= 0x80)
 			return "character in digest is not ascii";
-		if (!isgraph(c))
-			return "character in digest is not graphable";
+		return "character in digest is not graphable";
 	}
-	if (u - udig < 32)
+	if (dlen < 32)
 		return "digest < 32 chars";
 	return (char *)0;
 }
+
+/*
+ *  Synopsis:
+ *	Frisk a null terminated udig, returning length of the udig.
+ *  Returns:
+ *	- null string if udig is syntactically correct, *len set to strlen()
+ *	- a static string describing the error.
+ *  Note:
+ *	The scan stops at the longest possible udig, 8 + 1 + 128 bytes, so a
+ *	long, unterminated string is not walked to the end.
+ */
+char *
+jmscott_frisk_udig_len(const char *udig, size_t *len)
+{
+	if (!udig)
+		return "udig is null";
+
+	size_t n = strnlen(udig, 8 + 1 + 128 + 1);
+	char *err = jmscott_frisk_udign(udig, n);
+
+	if (err)
+		return err;
+	if (len)
+		*len = n;
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Frisk a udig matching: [a-z][a-z0-9]{0,7}:([:graph:]&&[:ascii:]){32,128}
+ *  Returns:
+ *	- null string if udig is syntactically correct.
+ *	- a static string describing the error.
+ *  See:
+ *	https://github.com/jmscott/blobio
+ */
+char *
+jmscott_frisk_udig(char *udig)
+{
+	return jmscott_frisk_udig_len(udig, (size_t *)0);
+}
+
+/*
+ *  Synopsis:
+ *	Compute the udig of "len" bytes in memory.
+ *  Returns:
+ *	(char *)0	udig written to "udig"
+ *	(char *)	unknown algorithm or udig buffer too small
+ */
+char *
+jmscott_udig_buf(
+	const char *algo,
+	const void *src,
+	size_t len,
+	char *udig,
+	size_t udig_size
+){
+	struct jmscott_digest d;
+	char *err;
+
+	if ((err = jmscott_digest_init(&d, algo)))
+		return err;
+	jmscott_digest_update(&d, src, len);
+	return jmscott_digest_udig(&d, udig, udig_size);
+}
+
+/*
+ *  Synopsis:
+ *	Compute the udig of all bytes read() from a descriptor until eof.
+ *  Description:
+ *	Works for pipes and sockets.  The descriptor is read in 128KB chunks,
+ *	so the digest runs at about the speed of the page cache.  Regular
+ *	files are hinted as sequential.
+ *  Returns:
+ *	(char *)0	udig written, *nbytes set to bytes read, when not null
+ *	(char *)	error, read() errors are strerror(errno).
+ */
+char *
+jmscott_udig_fd(
+	const char *algo,
+	int fd,
+	char *udig,
+	size_t udig_size,
+	unsigned long long *nbytes
+){
+	struct jmscott_digest d;
+	char buf[READ_SIZE], *err;
+	unsigned long long total = 0;
+	ssize_t nr;
+
+	if ((err = jmscott_digest_init(&d, algo)))
+		return err;
+#ifdef POSIX_FADV_SEQUENTIAL
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	while ((nr = jmscott_read(fd, buf, sizeof buf)) > 0) {
+		jmscott_digest_update(&d, buf, nr);
+		total += nr;
+	}
+	if (nr < 0)
+		return strerror(errno);
+	if (nbytes)
+		*nbytes = total;
+	return jmscott_digest_udig(&d, udig, udig_size);
+}
+
+/*
+ *  Synopsis:
+ *	Compute the udig of a regular file by mmap() of the whole file.
+ *  Description:
+ *	The file is mapped read only and digested straight from the page
+ *	cache, avoiding the copy of read().  Files that can not be mapped,
+ *	like pipes or empty files, fall back to jmscott_udig_fd().
+ *  Returns:
+ *	(char *)0	udig written, *nbytes set to size of file, when not null
+ *	(char *)	error, system errors are strerror(errno).
+ *  Note:
+ *	A file truncated by another process while mapped raises SIGBUS.
+ *	Callers digesting files in flux should use jmscott_udig_fd().
+ */
+char *
+jmscott_udig_file(
+	const char *algo,
+	int fd,
+	char *udig,
+	size_t udig_size,
+	unsigned long long *nbytes
+){
+	struct jmscott_digest d;
+	struct stat st;
+	char *err;
+	void *p;
+
+	if (jmscott_fstat(fd, &st) < 0)
+		return strerror(errno);
+	if (!S_ISREG(st.st_mode) || st.st_size == 0)
+		return jmscott_udig_fd(algo, fd, udig, udig_size, nbytes);
+	if ((err = jmscott_digest_init(&d, algo)))
+		return err;
+
+	p = mmap((void *)0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		return jmscott_udig_fd(algo, fd, udig, udig_size, nbytes);
+#ifdef MADV_SEQUENTIAL
+	(void)madvise(p, st.st_size, MADV_SEQUENTIAL);
+#endif
+	jmscott_digest_update(&d, p, st.st_size);
+	if (munmap(p, st.st_size) < 0)
+		return strerror(errno);
+	if (nbytes)
+		*nbytes = st.st_size;
+	return jmscott_digest_udig(&d, udig, udig_size);
+}
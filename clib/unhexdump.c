@@ -0,0 +1,348 @@
+/*
+ *  Synopsis:
+ *	Decode hexdumps back into the original bytes.
+ *  Description:
+ *	Lines of text are decoded and the bytes written through a 64KB
+ *	buffer to a file descriptor.  Each line is recognized as one of
+ *
+ *		jmscott_hexdump() trace, 76 columns
+ *
+ *     0  >  67 65 74 20 70 69 6e 67 3a 61 62 63 64 65 66 0a  get ping:abcdef.
+ *
+ *		hexdump -C
+ *
+ *	00000000  67 65 74 20 70 69 6e 67  3a 61 62 63 64 65 66 0a  |get pi...|
+ *	*
+ *	00000040
+ *
+ *		xxd, any -c or -g
+ *
+ *	00000000: 6765 7420 7069 6e67 3a61 6263 6465 660a  get ping:abcdef.
+ *
+ *	The ascii column is never read.  Hex pairs are decoded with a 256
+ *	entry nibble table, which rejects non hex chars in the same lookup.
+ *
+ *	A squeezed "*" line repeats the previous line up to the offset of the
+ *	next line.  Offsets of hexdump -C and xxd lines must be in sequence.
+ *	Trace records restart at offset 0, so trace offsets are not checked.
+ *  Note:
+ *	xxd -s, which starts at a non-zero offset, is rejected as out of
+ *	sequence.
+ */
+#include <sys/errno.h>
+#include <string.h>
+
+#include "jmscott/libjmscott.h"
+
+extern int	errno;
+
+//  value of hex char plus 1, 0 for not hex
+static const unsigned char nibble1[256] =
+{
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+#define NIBBLE(c)	(nibble1[(unsigned char)(c)] - 1)
+
+/*
+ *  Decode the hex pair at "p", returning the byte or -1.
+ */
+static int
+pair(const char *p)
+{
+	int hi = NIBBLE(p[0]);
+	int lo = NIBBLE(p[1]);
+
+	if ((hi | lo) < 0)
+		return -1;
+	return hi << 4 | lo;
+}
+
+/*
+ *  Synopsis:
+ *	Start decoding hexdump text, writing bytes to file descriptor "fd".
+ *  Description:
+ *	Set u->direction to '<' or '>' to decode only the trace records of
+ *	that direction.
+ */
+void
+jmscott_unhexdump_init(struct jmscott_unhexdump *u, int fd)
+{
+	memset(u, 0, sizeof *u - sizeof u->out);
+	u->fd = fd;
+}
+
+/*
+ *  Synopsis:
+ *	Write the buffered bytes.
+ *  Returns:
+ *	(char *)0	bytes written
+ *	(char *)	write() failed, strerror(errno)
+ */
+char *
+jmscott_unhexdump_flush(struct jmscott_unhexdump *u)
+{
+	if (u->out_len > 0 && jmscott_write_all(u->fd, u->out, u->out_len) < 0)
+		return strerror(errno);
+	u->out_len = 0;
+	return (char *)0;
+}
+
+static char *
+put(struct jmscott_unhexdump *u, const unsigned char *src, size_t n)
+{
+	char *err;
+
+	if (u->out_len + n > sizeof u->out) {
+		if ((err = jmscott_unhexdump_flush(u)))
+			return err;
+	}
+	memcpy(u->out + u->out_len, src, n);
+	u->out_len += n;
+	return (char *)0;
+}
+
+/*
+ *  Parse a hexdump -C or xxd offset of "w" hex digits.
+ */
+static unsigned long long
+hex_offset(const char *line, int w)
+{
+	unsigned long long off = 0;
+	int i;
+
+	for (i = 0;  i < w;  i++)
+		off = off << 4 | NIBBLE(line[i]);
+	return off;
+}
+
+/*
+ *  A line with offset "off" follows.  Repeat the line before a "*" up to
+ *  that offset, then insist the offset is in sequence.
+ */
+static char *
+sequence(struct jmscott_unhexdump *u, unsigned long long off)
+{
+	char *err;
+
+	if (u->squeezing) {
+		if (u->nprev == 0)
+			return "\"*\" before first line";
+		if (off < u->offset || (off - u->offset) % u->nprev != 0)
+			return "offset after \"*\" not a multiple of line";
+		while (u->offset < off) {
+			if ((err = put(u, u->prev, u->nprev)))
+				return err;
+			u->offset += u->nprev;
+		}
+		u->squeezing = 0;
+	}
+	if (off != u->offset)
+		return "offset out of sequence";
+	return (char *)0;
+}
+
+/*
+ *  Bytes of one line decoded, remember for a following "*".
+ */
+static char *
+decoded(struct jmscott_unhexdump *u, unsigned char *b, int n)
+{
+	u->offset += n;
+	memcpy(u->prev, b, n);
+	u->nprev = n;
+	return put(u, b, n);
+}
+
+/*
+ *  Trace line: byte i at column 11 + 3 * i, preceded by a space.
+ */
+static char *
+trace_line(struct jmscott_unhexdump *u, const char *line, size_t len)
+{
+	unsigned char b[16];
+	int i, v;
+
+	if (u->direction && line[8] != u->direction)
+		return (char *)0;
+	for (i = 0;  i < 16;  i++) {
+		size_t p = 11 + 3 * i;
+
+		if (p + 1 >= len || line[p - 1] != ' ' || line[p] == ' ')
+			break;
+		if ((v = pair(line + p)) < 0)
+			return "bad hex pair in trace line";
+		b[i] = v;
+	}
+	if (i == 0)
+		return "no hex pairs in trace line";
+	return put(u, b, i);
+}
+
+/*
+ *  hexdump -C line: byte i at column w + 2 + 3 * i, plus 1 past byte 7.
+ */
+static char *
+canon_line(struct jmscott_unhexdump *u, const char *line, size_t len, int w)
+{
+	unsigned char b[16];
+	char *err;
+	int i, v;
+
+	if ((err = sequence(u, hex_offset(line, w))))
+		return err;
+	for (i = 0;  i < 16;  i++) {
+		size_t p = w + 2 + 3 * i + (i >= 8);
+
+		if (p + 1 >= len || line[p] == ' ')
+			break;
+		if ((v = pair(line + p)) < 0)
+			return "bad hex pair in hexdump -C line";
+		b[i] = v;
+	}
+	if (i == 0)
+		return "no hex pairs in hexdump -C line";
+	return decoded(u, b, i);
+}
+
+/*
+ *  xxd line: hex pairs in groups separated by single spaces, ending at two
+ *  spaces before the ascii column.
+ */
+static char *
+xxd_line(struct jmscott_unhexdump *u, const char *line, size_t len, int w)
+{
+	unsigned char b[sizeof u->prev];
+	const char *p = line + w + 1, *end = line + len;
+	char *err;
+	int n = 0, v;
+
+	if ((err = sequence(u, hex_offset(line, w))))
+		return err;
+	while (p < end && *p == ' ') {
+		if (++p == end || *p == ' ')
+			break;
+		while (p + 1 < end && (v = pair(p)) >= 0) {
+			if (n == (int)sizeof b)
+				return "xxd line > 256 bytes";
+			b[n++] = v;
+			p += 2;
+		}
+		if (p < end && *p != ' ')
+			return "bad hex pair in xxd line";
+	}
+	if (n == 0)
+		return "no hex pairs in xxd line";
+	return decoded(u, b, n);
+}
+
+/*
+ *  Synopsis:
+ *	Decode one line of hexdump text, no new line.
+ *  Description:
+ *	Empty lines are ignored.  u->line_no counts lines, for messages.
+ *  Returns:
+ *	(char *)0	line decoded, bytes buffered
+ *	(char *)	malformed line, or write() of full buffer failed
+ */
+char *
+jmscott_unhexdump_line(
+	struct jmscott_unhexdump *u,
+	const char *line,
+	size_t len
+){
+	size_t w;
+
+	u->line_no++;
+	if (len > 0 && line[len - 1] == '\r')
+		len--;
+	if (len == 0)
+		return (char *)0;
+	if (len == 1 && line[0] == '*') {
+		u->squeezing = 1;
+		return (char *)0;
+	}
+
+	//  trace: "%6lu  D " with direction D
+
+	if (len > 11 && line[6] == ' ' && line[7] == ' ' && line[9] == ' ' &&
+	    (unsigned char)(line[5] - '0') <= 9)
+		return trace_line(u, line, len);
+
+	for (w = 0;  w < len && w < 17 && NIBBLE(line[w]) >= 0;  w++)
+		;
+	if (w == 0 || w > 16)
+		return "unknown hexdump line";
+
+	//  final offset of hexdump -C, with nothing more
+
+	if (w == len)
+		return sequence(u, hex_offset(line, w));
+	if (line[w] == ':')
+		return xxd_line(u, line, len, w);
+	if (w >= 8 && w + 1 < len && line[w] == ' ' && line[w + 1] == ' ')
+		return canon_line(u, line, len, w);
+	return "unknown hexdump line";
+}
+
+/*
+ *  Synopsis:
+ *	Decode a chunk of hexdump text, lines may span calls.
+ *  Returns:
+ *	(char *)0	text decoded
+ *	(char *)	malformed line, or write() failed
+ */
+char *
+jmscott_unhexdump_write(
+	struct jmscott_unhexdump *u,
+	const char *src,
+	size_t len
+){
+	const char *end = src + len, *nl;
+	char *err;
+
+	while ((nl = memchr(src, '\n', end - src))) {
+		if (u->nin > 0) {
+			if (u->nin + (nl - src) > sizeof u->in)
+				return "line > 1024 chars";
+			memcpy(u->in + u->nin, src, nl - src);
+			err = jmscott_unhexdump_line(u, u->in, u->nin + (nl-src));
+			u->nin = 0;
+		} else
+			err = jmscott_unhexdump_line(u, src, nl - src);
+		if (err)
+			return err;
+		src = nl + 1;
+	}
+	if (u->nin + (end - src) > sizeof u->in)
+		return "line > 1024 chars";
+	memcpy(u->in + u->nin, src, end - src);
+	u->nin += end - src;
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Decode the final line with no new line, then flush all bytes.
+ *  Returns:
+ *	(char *)0	all bytes written
+ *	(char *)	malformed line, dangling "*", or write() failed
+ */
+char *
+jmscott_unhexdump_close(struct jmscott_unhexdump *u)
+{
+	char *err;
+
+	if (u->nin > 0) {
+		err = jmscott_unhexdump_line(u, u->in, u->nin);
+		u->nin = 0;
+		if (err)
+			return err;
+	}
+	if (u->squeezing)
+		return "\"*\" not followed by an offset";
+	return jmscott_unhexdump_flush(u);
+}
@@ -0,0 +1,880 @@
+/*
+ *  Synopsis:
+ *	Validate a stream of well formed (RFC3629) UTF-8 bytes.
+ *  Usage:
+ *	struct jmscott_utf8 u;
+ *
+ *	jmscott_utf8_init(&u);
+ *	while ((nr = read(fd, buf, sizeof buf)) > 0)
+ *		if (!jmscott_utf8_write(&u, buf, nr))
+ *			break;
+ *	if (!jmscott_utf8_close(&u))
+ *		printf("bad utf8 at byte %llu\n", u.bad_offset);
+ *  Description:
+ *	Bytes are checked by a vectorized kernel, chosen at run time as the
+ *	widest of avx512, avx2 or sse4 the cpu supports, falling back to a
+ *	byte at a time state machine, which is the reference implementation.
+ *
+ *	The kernel is the "lookup" algorithm of Keiser and Lemire, which
+ *	classifies each byte and the byte before it with three 16 entry
+ *	nibble tables, then checks the continuation bytes required by the
+ *	preceding 2 and 3 bytes.
+ *
+ *		https://arxiv.org/abs/2010.03090
+ *		https://github.com/lemire/fastvalidate-utf-8
+ *
+ *	A chunk is validated by the state machine up to the end of any
+ *	sequence split by the previous chunk, then by the kernel in 64KB
+ *	windows ending before the last lead byte, so each window starts and
+ *	ends at a character boundary.  The bytes of the final, possibly
+ *	partial sequence are carried in the state machine to the next chunk.
+ *
+ *	When the kernel rejects a window, the window is rescanned by the
+ *	state machine to find the offset of the first invalid sequence.
+ *
+ *	With u->count set, code points are tallied by length in u->ncode[],
+ *	from a second vector pass over each window counting lead bytes.
+ *  Note:
+ *	Code points above U+10FFFF, which RFC3629 excludes, are rejected.
+ *
+ *	Only x86_64 with gcc or clang have kernels.  Consider arm neon.
+ */
+#include <string.h>
+
+#include "jmscott/libjmscott.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define WINDOW_SIZE	(64 * 1024)
+
+/*
+ *  States of scanner.
+ */
+#define STATE_0BYTE1	0	/* goto byte1 of char code sequence */
+
+#define STATE_2BYTE2	1	/* goto second byte of 2 byte sequence */
+
+#define STATE_3BYTE2	2	/* goto second byte of 3 byte sequence */
+#define STATE_3BYTE3	3	/* goto third byte of 3 byte sequence */
+
+#define STATE_4BYTE2	4	/* goto second byte of 4 byte sequence */
+#define STATE_4BYTE3	5	/* goto third byte of 4 byte sequence */
+#define STATE_4BYTE4	6	/* goto fourth byte of 4 byte sequence */
+
+/*
+ *  Bit masks up to 4 bytes per character
+ */
+#define B00000000	0x0
+#define B10000000	0x80
+#define B11000000	0xC0
+#define B11100000	0xE0
+#define B11110000	0xF0
+#define B11111000	0xF8
+
+/*
+ *  Run the state machine over the bytes from "p" up to "p_end".
+ *
+ *  Returns 1 when all bytes are well formed, so far, or 0 after setting
+ *  u->bad and u->bad_offset.
+ */
+static int
+scalar(struct jmscott_utf8 *u, const unsigned char *p,
+       const unsigned char *p_end)
+{
+	const unsigned char *base = p;
+	int state = u->state;
+	unsigned int code_point = u->code_point;
+	unsigned long long n1 = 0, n2 = 0, n3 = 0, n4 = 0;
+
+	while (p < p_end) {
+
+	unsigned char c = *p++;
+
+	switch (state) {
+	case STATE_0BYTE1:
+		/*
+		 *  Single byte/7 bit ascii?
+		 *  Remain in STATE_0BYTE1.
+		 */
+		if ((c & B10000000) == B00000000) {
+			n1++;
+			break;
+		}
+
+		/*
+		 *  Mutibyte code point.
+		 */
+		u->start = u->offset + (p - 1 - base);
+		code_point = 0;
+		if ((c & B11100000) == B11000000) {
+			/*
+			 *  Start of 2 byte/11 bit sequence, so shift
+			 *  the lower 5 bits of the first byte left
+			 *  6 bits.
+			 */
+			code_point = (c & ~B11100000) << 6;
+			state = STATE_2BYTE2;
+		} else if ((c & B11110000) == B11100000) {
+			/*
+			 *  Start of 3 byte/16 bit sequence, so shift
+			 *  the lower 4 bits of the first byte left 12
+			 *  bits.
+			 */
+			code_point = (c & ~B11110000) << 12;
+			state = STATE_3BYTE2;
+		} else if ((c & B11111000) == B11110000) {
+			/*
+			 *  Start of 4 byte/21 bit sequence, so shift
+			 *  the lower 3 bits of the first byte left 18
+			 *  bits.
+			 */
+			code_point = (c & ~B11111000) << 18;
+			state = STATE_4BYTE2;
+		} else
+			goto BAD;
+		break;
+	/*
+	 *  Expect the second and final byte of two byte/11 bit
+	 *  code point.
+	 */
+	case STATE_2BYTE2:
+		/*
+		 *  No continuation byte implies malformed sequence.
+		 */
+		if ((c & B11000000) != B10000000)
+			goto BAD;
+		/*
+		 *  Or in the lower 6 bits of the second & final byte.
+		 */
+		code_point |= (c & ~B11000000);
+
+		/*
+		 *  Is an overlong representation.  Any value less than
+		 *  128 must be represented with a single byte/7 bits.
+		 */
+		if (code_point < 128)
+			goto BAD;
+
+		n2++;
+		state = STATE_0BYTE1;
+		break;
+	/*
+	 *  Expect the second byte of a three byte sequence.
+	 */
+	case STATE_3BYTE2:
+		/*
+		 *  No continuation byte implies malformed sequence.
+		 */
+		if ((c & B11000000) != B10000000)
+			goto BAD;
+		/*
+		 *  Or in the lower 6 bits of the second byte into
+		 *  bits 12 through 7 of the code point.
+		 */
+		code_point |= (c & ~B11000000) << 6;
+
+		state = STATE_3BYTE3;
+		break;
+
+	/*
+	 *  Third byte of three byte/16 bit sequence.
+	 */
+	case STATE_3BYTE3:
+		/*
+		 *  No continuation byte implies malformed sequence.
+		 */
+		if ((c & B11000000) != B10000000)
+			goto BAD;
+		/*
+		 *  Or in the lower 6 bits of the third & final byte
+		 *  into bits 6 through 1 of the code point.
+		 */
+		code_point |= c & ~B11000000;
+
+		/*
+		 *  Is an overlong representation?  Any value less than
+		 *  2048 must be represented with either a
+		 *  one byte/7 bit or two byte/11 bit sequence.
+		 *
+		 *  Second test is for UTF-16 surrogate pairs.
+		 */
+		if (code_point < 2048 ||
+		    (0xD800 <= code_point&&code_point <= 0xDFFF))
+			goto BAD;
+		n3++;
+		state = STATE_0BYTE1;
+		break;
+	/*
+	 *  Expect the second byte of four byte/21 bit sequence
+	 */
+	case STATE_4BYTE2:
+		/*
+		 *  No continuation byte implies malformed sequence.
+		 */
+		if ((c & B11000000) != B10000000)
+			goto BAD;
+		/*
+		 *  Or in the lower 6 bits of the second byte into
+		 *  bits 18 through 13 of the code point.
+		 */
+		code_point |= (c & ~B11000000) << 12;
+		state = STATE_4BYTE3;
+		break;
+	/*
+	 *  Expect the third byte of four byte/21 bit sequence
+	 */
+	case STATE_4BYTE3:
+		/*
+		 *  No continuation byte implies malformed sequence.
+		 */
+		if ((c & B11000000) != B10000000)
+			goto BAD;
+		/*
+		 *  Or in the lower 6 bits of the third byte into
+		 *  bits 12 through 7 of the code point.
+		 */
+		code_point |= (c & ~B11000000) << 6;
+		state = STATE_4BYTE4;
+		break;
+	/*
+	 *  Expect the fourth byte of four byte/21 bit sequence
+	 */
+	case STATE_4BYTE4:
+		/*
+		 *  No continuation byte implies malformed sequence.
+		 */
+		if ((c & B11000000) != B10000000)
+			goto BAD;
+		/*
+		 *  Or in the lower 6 bits of the fourth byte into
+		 *  bits 6 through 1 of the code point.
+		 */
+		code_point |= c & ~B11000000;
+		/*
+		 *  Is an overlong representation.  Any value less than
+		 *  65536 must be represented with either a
+		 *  one byte/7 bit, two byte/11 bit or three byte/16
+		 *  sequence.
+		 *
+		 *  Second test is for values beyond unicode.
+		 */
+		if (code_point < 65536 || code_point > 0x10FFFF)
+			goto BAD;
+		n4++;
+		state = STATE_0BYTE1;
+		break;
+	}}
+	u->offset += p - base;
+	u->state = state;
+	u->code_point = code_point;
+	u->ncode[0] += n1;
+	u->ncode[1] += n2;
+	u->ncode[2] += n3;
+	u->ncode[3] += n4;
+	return 1;
+BAD:
+	u->ncode[0] += n1;
+	u->ncode[1] += n2;
+	u->ncode[2] += n3;
+	u->ncode[3] += n4;
+
+	//  invalid lead byte is a sequence by itself
+
+	if (state == STATE_0BYTE1)
+		u->start = u->offset + (p - 1 - base);
+	u->bad = 1;
+	u->bad_offset = u->start;
+	return 0;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ *  Error bits classifying a byte and the byte before it, from
+ *  "Validating UTF-8 In Less Than One Instruction Per Byte", Keiser and
+ *  Lemire, 2021.
+ */
+#define TOO_SHORT	(1<<0)	//  11______ 0_______, 11______ 11______
+#define TOO_LONG	(1<<1)	//  0_______ 10______
+#define OVERLONG_3	(1<<2)	//  11100000 100_____
+#define TOO_LARGE	(1<<3)	//  11110100 1001____, 11110100 101_____
+#define SURROGATE	(1<<4)	//  11101101 101_____
+#define OVERLONG_2	(1<<5)	//  1100000_ 10______
+#define TOO_LARGE_1000	(1<<6)	//  11110101 1000____, 1111011_ 1000____
+#define OVERLONG_4	(1<<6)	//  11110000 1000____
+#define TWO_CONTS	(1<<7)	//  10______ 10______
+#define CARRY		(TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+//  high nibble of previous byte
+static const unsigned char byte_1_high[16] =
+{
+	//  0_______ ________, ascii
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+
+	//  10______ ________, continuation
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+
+	//  1100____ ________, two byte lead
+	TOO_SHORT | OVERLONG_2,
+
+	//  1101____ ________, two byte lead
+	TOO_SHORT,
+
+	//  1110____ ________, three byte lead
+	TOO_SHORT | OVERLONG_3 | SURROGATE,
+
+	//  1111____ ________, four byte lead
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+};
+
+//  low nibble of previous byte
+static const unsigned char byte_1_low[16] =
+{
+	CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,	//  ____0000
+	CARRY | OVERLONG_2,				//  ____0001
+	CARRY,						//  ____001_
+	CARRY,
+	CARRY | TOO_LARGE,				//  ____0100
+	CARRY | TOO_LARGE | TOO_LARGE_1000,		//  ____0101
+	CARRY | TOO_LARGE | TOO_LARGE_1000,		//  ____011_
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,		//  ____1___
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,	//  ____1101
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+};
+
+//  high nibble of current byte
+static const unsigned char byte_2_high[16] =
+{
+	//  ________ 0_______, ascii
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+
+	//  ________ 1000____
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+								OVERLONG_4,
+	//  ________ 1001____
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+
+	//  ________ 101_____
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+
+	//  ________ 11______
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+};
+
+/*
+ *  Greatest final bytes of a block not starting a sequence that continues
+ *  into the next block.  Load the last 16, 32 or 64.
+ */
+static const unsigned char max_value[64] =
+{
+	[0 ... 60] = 0xFF,
+	[61] = 0xF0 - 1,
+	[62] = 0xE0 - 1,
+	[63] = 0xC0 - 1,
+};
+
+__attribute__((target("ssse3,sse4.1")))
+static int
+sse4_kernel(const unsigned char *p, size_t len)
+{
+	const __m128i t1h = _mm_loadu_si128((const __m128i *)byte_1_high);
+	const __m128i t1l = _mm_loadu_si128((const __m128i *)byte_1_low);
+	const __m128i t2h = _mm_loadu_si128((const __m128i *)byte_2_high);
+	const __m128i max = _mm_loadu_si128((const __m128i *)(max_value + 48));
+	const __m128i nib = _mm_set1_epi8(0x0F);
+	const __m128i is3 = _mm_set1_epi8(0xE0 - 0x80);
+	const __m128i is4 = _mm_set1_epi8(0xF0 - 0x80);
+	const __m128i hi = _mm_set1_epi8((char)0x80);
+	__m128i prev = _mm_setzero_si128(), err = _mm_setzero_si128();
+	unsigned char tail[16];
+	const unsigned char *end = p + len;
+
+	while (p < end) {
+		__m128i in, prev1, sc, must;
+
+		if (end - p >= 16)
+			in = _mm_loadu_si128((const __m128i *)p);
+		else {
+			memset(tail, 0, sizeof tail);
+			memcpy(tail, p, end - p);
+			in = _mm_loadu_si128((const __m128i *)tail);
+		}
+		p += 16;
+
+		//  all ascii, so only a sequence cut at end of prev is bad
+
+		if (_mm_movemask_epi8(in) == 0) {
+			err = _mm_or_si128(err, _mm_subs_epu8(prev, max));
+			prev = in;
+			continue;
+		}
+		prev1 = _mm_alignr_epi8(in, prev, 15);
+		sc = _mm_and_si128(
+			_mm_and_si128(
+				_mm_shuffle_epi8(t1h,
+				     _mm_and_si128(_mm_srli_epi16(prev1, 4), nib)),
+				_mm_shuffle_epi8(t1l, _mm_and_si128(prev1, nib))
+			),
+			_mm_shuffle_epi8(t2h,
+					_mm_and_si128(_mm_srli_epi16(in, 4), nib))
+		);
+		must = _mm_and_si128(
+			_mm_or_si128(
+				_mm_subs_epu8(_mm_alignr_epi8(in, prev, 14), is3),
+				_mm_subs_epu8(_mm_alignr_epi8(in, prev, 13), is4)
+			),
+			hi
+		);
+		err = _mm_or_si128(err, _mm_xor_si128(must, sc));
+		prev = in;
+	}
+	err = _mm_or_si128(err, _mm_subs_epu8(prev, max));
+	return !_mm_testz_si128(err, err);
+}
+
+__attribute__((target("avx2")))
+static int
+avx2_kernel(const unsigned char *p, size_t len)
+{
+	const __m256i t1h = _mm256_broadcastsi128_si256(
+				_mm_loadu_si128((const __m128i *)byte_1_high));
+	const __m256i t1l = _mm256_broadcastsi128_si256(
+				_mm_loadu_si128((const __m128i *)byte_1_low));
+	const __m256i t2h = _mm256_broadcastsi128_si256(
+				_mm_loadu_si128((const __m128i *)byte_2_high));
+	const __m256i max = _mm256_loadu_si256(
+				(const __m256i *)(max_value + 32));
+	const __m256i nib = _mm256_set1_epi8(0x0F);
+	const __m256i is3 = _mm256_set1_epi8(0xE0 - 0x80);
+	const __m256i is4 = _mm256_set1_epi8(0xF0 - 0x80);
+	const __m256i hi = _mm256_set1_epi8((char)0x80);
+	__m256i prev = _mm256_setzero_si256(), err = _mm256_setzero_si256();
+	unsigned char tail[32];
+	const unsigned char *end = p + len;
+
+	while (p < end) {
+		__m256i in, shift, prev1, sc, must;
+
+		if (end - p >= 32)
+			in = _mm256_loadu_si256((const __m256i *)p);
+		else {
+			memset(tail, 0, sizeof tail);
+			memcpy(tail, p, end - p);
+			in = _mm256_loadu_si256((const __m256i *)tail);
+		}
+		p += 32;
+
+		if (_mm256_movemask_epi8(in) == 0) {
+			err = _mm256_or_si256(err, _mm256_subs_epu8(prev, max));
+			prev = in;
+			continue;
+		}
+
+		//  previous bytes across the 128 bit lanes
+
+		shift = _mm256_permute2x128_si256(prev, in, 0x21);
+		prev1 = _mm256_alignr_epi8(in, shift, 15);
+		sc = _mm256_and_si256(
+			_mm256_and_si256(
+				_mm256_shuffle_epi8(t1h, _mm256_and_si256(
+					_mm256_srli_epi16(prev1, 4), nib)),
+				_mm256_shuffle_epi8(t1l,
+						_mm256_and_si256(prev1, nib))
+			),
+			_mm256_shuffle_epi8(t2h,
+				_mm256_and_si256(_mm256_srli_epi16(in, 4), nib))
+		);
+		must = _mm256_and_si256(
+			_mm256_or_si256(
+				_mm256_subs_epu8(
+					_mm256_alignr_epi8(in, shift, 14), is3),
+				_mm256_subs_epu8(
+					_mm256_alignr_epi8(in, shift, 13), is4)
+			),
+			hi
+		);
+		err = _mm256_or_si256(err, _mm256_xor_si256(must, sc));
+		prev = in;
+	}
+	err = _mm256_or_si256(err, _mm256_subs_epu8(prev, max));
+	return !_mm256_testz_si256(err, err);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int
+avx512_kernel(const unsigned char *p, size_t len)
+{
+	const __m512i t1h = _mm512_broadcast_i32x4(
+				_mm_loadu_si128((const __m128i *)byte_1_high));
+	const __m512i t1l = _mm512_broadcast_i32x4(
+				_mm_loadu_si128((const __m128i *)byte_1_low));
+	const __m512i t2h = _mm512_broadcast_i32x4(
+				_mm_loadu_si128((const __m128i *)byte_2_high));
+	const __m512i max = _mm512_loadu_si512((const void *)max_value);
+	const __m512i nib = _mm512_set1_epi8(0x0F);
+	const __m512i is3 = _mm512_set1_epi8(0xE0 - 0x80);
+	const __m512i is4 = _mm512_set1_epi8(0xF0 - 0x80);
+	const __m512i hi = _mm512_set1_epi8((char)0x80);
+	__m512i prev = _mm512_setzero_si512(), err = _mm512_setzero_si512();
+	const unsigned char *end = p + len;
+
+	while (p < end) {
+		__m512i in, shift, prev1, sc, must;
+
+		//  masked load of the final partial block reads no further
+
+		if (end - p >= 64)
+			in = _mm512_loadu_si512((const void *)p);
+		else
+			in = _mm512_maskz_loadu_epi8(
+				(__mmask64)-1 >> (64 - (end - p)),
+				(const void *)p
+			);
+		p += 64;
+
+		if (_mm512_movepi8_mask(in) == 0) {
+			err = _mm512_or_si512(err, _mm512_subs_epu8(prev, max));
+			prev = in;
+			continue;
+		}
+
+		//  last 128 bits of prev then first 384 bits of in
+
+		shift = _mm512_alignr_epi64(in, prev, 6);
+		prev1 = _mm512_alignr_epi8(in, shift, 15);
+		sc = _mm512_and_si512(
+			_mm512_and_si512(
+				_mm512_shuffle_epi8(t1h, _mm512_and_si512(
+					_mm512_srli_epi16(prev1, 4), nib)),
+				_mm512_shuffle_epi8(t1l,
+						_mm512_and_si512(prev1, nib))
+			),
+			_mm512_shuffle_epi8(t2h,
+				_mm512_and_si512(_mm512_srli_epi16(in, 4), nib))
+		);
+		must = _mm512_and_si512(
+			_mm512_or_si512(
+				_mm512_subs_epu8(
+					_mm512_alignr_epi8(in, shift, 14), is3),
+				_mm512_subs_epu8(
+					_mm512_alignr_epi8(in, shift, 13), is4)
+			),
+			hi
+		);
+		err = _mm512_or_si512(err, _mm512_xor_si512(must, sc));
+		prev = in;
+	}
+	err = _mm512_or_si512(err, _mm512_subs_epu8(prev, max));
+	return _mm512_test_epi8_mask(err, err) != 0;
+}
+
+/*
+ *  Tally lead bytes of well formed chars: ascii, 110xxxxx, 1110xxxx and
+ *  11110xxx.  The final partial block is counted a byte at a time.
+ */
+static void
+count_tail(const unsigned char *p, const unsigned char *end,
+	   unsigned long long *ncode)
+{
+	while (p < end) {
+		unsigned char c = *p++;
+
+		if (c < 0x80)
+			ncode[0]++;
+		else if (c >= 0xF0)
+			ncode[3]++;
+		else if (c >= 0xE0)
+			ncode[2]++;
+		else if (c >= 0xC0)
+			ncode[1]++;
+	}
+}
+
+__attribute__((target("ssse3,sse4.1,popcnt")))
+static void
+sse4_count(const unsigned char *p, size_t len, unsigned long long *ncode)
+{
+	const __m128i c0 = _mm_set1_epi8((char)0xC0);
+	const __m128i e0 = _mm_set1_epi8((char)0xE0);
+	const __m128i f0 = _mm_set1_epi8((char)0xF0);
+	const unsigned char *end = p + len;
+	unsigned long long n1 = 0, ge_c0 = 0, ge_e0 = 0, ge_f0 = 0;
+
+	for (;  end - p >= 16;  p += 16) {
+		__m128i in = _mm_loadu_si128((const __m128i *)p);
+
+		n1 += 16 - __builtin_popcount(_mm_movemask_epi8(in));
+		ge_c0 += __builtin_popcount(_mm_movemask_epi8(
+				_mm_cmpeq_epi8(_mm_max_epu8(in, c0), in)));
+		ge_e0 += __builtin_popcount(_mm_movemask_epi8(
+				_mm_cmpeq_epi8(_mm_max_epu8(in, e0), in)));
+		ge_f0 += __builtin_popcount(_mm_movemask_epi8(
+				_mm_cmpeq_epi8(_mm_max_epu8(in, f0), in)));
+	}
+	ncode[0] += n1;
+	ncode[1] += ge_c0 - ge_e0;
+	ncode[2] += ge_e0 - ge_f0;
+	ncode[3] += ge_f0;
+	count_tail(p, end, ncode);
+}
+
+__attribute__((target("avx2,popcnt")))
+static void
+avx2_count(const unsigned char *p, size_t len, unsigned long long *ncode)
+{
+	const __m256i c0 = _mm256_set1_epi8((char)0xC0);
+	const __m256i e0 = _mm256_set1_epi8((char)0xE0);
+	const __m256i f0 = _mm256_set1_epi8((char)0xF0);
+	const unsigned char *end = p + len;
+	unsigned long long n1 = 0, ge_c0 = 0, ge_e0 = 0, ge_f0 = 0;
+
+	for (;  end - p >= 32;  p += 32) {
+		__m256i in = _mm256_loadu_si256((const __m256i *)p);
+		unsigned int hi = _mm256_movemask_epi8(in);
+
+		n1 += 32 - __builtin_popcount(hi);
+		if (hi == 0)
+			continue;
+		ge_c0 += __builtin_popcount(_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(_mm256_max_epu8(in, c0), in)));
+		ge_e0 += __builtin_popcount(_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(_mm256_max_epu8(in, e0), in)));
+		ge_f0 += __builtin_popcount(_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(_mm256_max_epu8(in, f0), in)));
+	}
+	ncode[0] += n1;
+	ncode[1] += ge_c0 - ge_e0;
+	ncode[2] += ge_e0 - ge_f0;
+	ncode[3] += ge_f0;
+	count_tail(p, end, ncode);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static void
+avx512_count(const unsigned char *p, size_t len, unsigned long long *ncode)
+{
+	const __m512i c0 = _mm512_set1_epi8((char)0xC0);
+	const __m512i e0 = _mm512_set1_epi8((char)0xE0);
+	const __m512i f0 = _mm512_set1_epi8((char)0xF0);
+	const unsigned char *end = p + len;
+	unsigned long long n1 = 0, ge_c0 = 0, ge_e0 = 0, ge_f0 = 0;
+
+	for (;  end - p >= 64;  p += 64) {
+		__m512i in = _mm512_loadu_si512((const void *)p);
+		unsigned long long hi = _mm512_movepi8_mask(in);
+
+		n1 += 64 - __builtin_popcountll(hi);
+		if (hi == 0)
+			continue;
+		ge_c0 += __builtin_popcountll(_mm512_cmpge_epu8_mask(in, c0));
+		ge_e0 += __builtin_popcountll(_mm512_cmpge_epu8_mask(in, e0));
+		ge_f0 += __builtin_popcountll(_mm512_cmpge_epu8_mask(in, f0));
+	}
+	ncode[0] += n1;
+	ncode[1] += ge_c0 - ge_e0;
+	ncode[2] += ge_e0 - ge_f0;
+	ncode[3] += ge_f0;
+	count_tail(p, end, ncode);
+}
+
+#endif
+
+/*
+ *  Synopsis:
+ *	Widest vector kernel supported by the cpu.
+ *  Returns:
+ *	JMSCOTT_UTF8_{AVX512,AVX2,SSE4,SCALAR}
+ */
+int
+jmscott_utf8_simd()
+{
+#ifdef HAVE_X86_SIMD
+	static int simd = -1;
+
+	if (simd < 0) {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f") &&
+		    __builtin_cpu_supports("avx512bw"))
+			simd = JMSCOTT_UTF8_AVX512;
+		else if (__builtin_cpu_supports("avx2"))
+			simd = JMSCOTT_UTF8_AVX2;
+		else if (__builtin_cpu_supports("sse4.1") &&
+			 __builtin_cpu_supports("ssse3") &&
+			 __builtin_cpu_supports("popcnt"))
+			simd = JMSCOTT_UTF8_SSE4;
+		else
+			simd = JMSCOTT_UTF8_SCALAR;
+	}
+	return simd;
+#else
+	return JMSCOTT_UTF8_SCALAR;
+#endif
+}
+
+char *
+jmscott_utf8_simd_name(int simd)
+{
+	switch (simd) {
+	case JMSCOTT_UTF8_AVX512:
+		return "avx512";
+	case JMSCOTT_UTF8_AVX2:
+		return "avx2";
+	case JMSCOTT_UTF8_SSE4:
+		return "sse4";
+	}
+	return "scalar";
+}
+
+/*
+ *  Synopsis:
+ *	Start validating a stream with the widest kernel of the cpu.
+ *  Description:
+ *	Set u->simd to a lesser JMSCOTT_UTF8_* to force a narrower kernel,
+ *	JMSCOTT_UTF8_SCALAR for the state machine only.  Set u->count to
+ *	tally code points by length in u->ncode[].
+ */
+void
+jmscott_utf8_init(struct jmscott_utf8 *u)
+{
+	memset(u, 0, sizeof *u);
+	u->simd = jmscott_utf8_simd();
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ *  Vector kernel over a window starting and ending at a char boundary.
+ *  Returns non-zero when some sequence is invalid.
+ */
+static int
+kernel(int simd, const unsigned char *p, size_t len)
+{
+	switch (simd) {
+	case JMSCOTT_UTF8_AVX512:
+		return avx512_kernel(p, len);
+	case JMSCOTT_UTF8_AVX2:
+		return avx2_kernel(p, len);
+	}
+	return sse4_kernel(p, len);
+}
+
+static void
+count(int simd, const unsigned char *p, size_t len, unsigned long long *ncode)
+{
+	switch (simd) {
+	case JMSCOTT_UTF8_AVX512:
+		avx512_count(p, len, ncode);
+		return;
+	case JMSCOTT_UTF8_AVX2:
+		avx2_count(p, len, ncode);
+		return;
+	}
+	sse4_count(p, len, ncode);
+}
+
+#endif
+
+/*
+ *  Synopsis:
+ *	Validate the next chunk of the stream.
+ *  Description:
+ *	Sequences may span chunks.  After an invalid sequence, the stream
+ *	stays bad and further chunks are ignored.
+ *  Returns:
+ *	1	all bytes so far well formed
+ *	0	invalid sequence starting at byte u->bad_offset of stream
+ */
+int
+jmscott_utf8_write(struct jmscott_utf8 *u, const void *src, size_t len)
+{
+	const unsigned char *p = src, *end = p + len;
+
+	if (u->bad)
+		return 0;
+
+#ifdef HAVE_X86_SIMD
+	if (u->simd > JMSCOTT_UTF8_SCALAR) {
+		//  finish the sequence split by the previous chunk
+
+		while (p < end && u->state != STATE_0BYTE1) {
+			if (!scalar(u, p, p + 1))
+				return 0;
+			p++;
+		}
+
+		while (end - p > 64) {
+			const unsigned char *w_end = p + WINDOW_SIZE;
+			int i;
+
+			if (w_end > end)
+				w_end = end;
+
+			//  end window at the last lead byte, if in last four
+
+			for (i = 1;  i <= 4;  i++)
+				if ((w_end[-i] & B11000000) != B10000000) {
+					w_end -= i;
+					break;
+				}
+			if (kernel(u->simd, p, w_end - p)) {
+				if (!scalar(u, p, w_end))
+					return 0;
+				p = w_end;
+				if (u->state != STATE_0BYTE1)
+					break;
+				continue;
+			}
+			if (u->count)
+				count(u->simd, p, w_end - p, u->ncode);
+			u->offset += w_end - p;
+			p = w_end;
+		}
+	}
+#endif
+	return scalar(u, p, end);
+}
+
+/*
+ *  Synopsis:
+ *	End of stream, insisting the final sequence is complete.
+ *  Returns:
+ *	1	stream well formed
+ *	0	invalid or truncated sequence at byte u->bad_offset of stream
+ */
+int
+jmscott_utf8_close(struct jmscott_utf8 *u)
+{
+	if (u->bad)
+		return 0;
+	if (u->state != STATE_0BYTE1) {
+		u->bad = 1;
+		u->bad_offset = u->start;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ *  Synopsis:
+ *	Is a buffer well formed UTF-8?
+ */
+int
+jmscott_isutf8_len(const void *src, size_t len)
+{
+	struct jmscott_utf8 u;
+
+	jmscott_utf8_init(&u);
+	return jmscott_utf8_write(&u, src, len) && jmscott_utf8_close(&u);
+}
@@ -1,6 +1,46 @@
 /*
  *  Synopsis:
  *	Remove duplicate lines on stdin and write to stdout.
+ *  Usage:
+ *	dedup [--count] [--hash [--verify]]
+ *	      [--memory-limit <size>[KMGT] [--keep-order]]
+ *  Options:
+ *	--count		write only the count of distinct lines
+ *	--hash		remember a 128 bit fingerprint per line, not the line
+ *	--verify	with --hash, compare bytes of lines with equal
+ *			fingerprints, storing distinct lines in a packed arena
+ *	--memory-limit	spill lines to temporary files when the table of
+ *			distinct lines would exceed the size in bytes
+ *	--keep-order	with --memory-limit, write spilled lines in order of
+ *			first occurrence
+ *  Description:
+ *	By default each distinct line is a key in a go map, so memory grows
+ *	with the total bytes of distinct lines plus map overhead per line.
+ *
+ *	With --hash only 16 bytes per distinct line are stored, in an open
+ *	addressed table kept under 3/4 full, so memory is independent of
+ *	line length.  Two lines are considered equal when both 64 bit
+ *	runtime hashes, seeded per process, are equal.  The odds of any
+ *	false duplicate among n distinct lines are about n^2 / 2^129,
+ *	roughly 1 in 10^19 for ten billion lines.
+ *
+ *	--verify removes even that risk, at the cost of storing the distinct
+ *	lines, though without the per string overhead of the go map.
+ *
+ *	--memory-limit uses the table of --hash, verified unless --hash is
+ *	given without --verify, and streams distinct lines while the table
+ *	fits in the limit.  Past the limit, the table is frozen and each
+ *	line not in the table is appended to one of 64 spill files chosen
+ *	by hash.  At end of input the table is freed and each spill file is
+ *	deduped in turn the same way, spilling again if still too large, so
+ *	memory stays near the limit however many distinct lines arrive.
+ *	Spill files are created in $TMPDIR and unlinked while open.
+ *
+ *	Without --keep-order lines from later spill files may precede lines
+ *	first seen earlier in the input.  --keep-order records the line
+ *	number with each spilled line, writes the distinct lines of each
+ *	spill file to another temporary file and merges those by line
+ *	number, at the cost of twice the disk i/o.
  *  Note:
  *	dedup seems to be about twice as fast as "sort -u", when
  *	LANG=en_US.UTF-8;  otherwise, "sort -u" about 4 time fast.
@@ -13,48 +53,544 @@ package main
 
 import (
 	"bufio"
+	"bytes"
+	"container/heap"
+	"encoding/binary"
 	"fmt"
+	"hash/maphash"
+	"io"
 	"os"
+	"runtime/debug"
+	"strconv"
 )
 
+//  initial slots in the fingerprint table, a power of two
+const min_slots = 1024
+
+//  sizes of blocks in the --verify arena, doubling from min to max
+const min_arena_block = 64 * 1024
+const max_arena_block = 64 * 1024 * 1024
+
+//  spill files per partitioning, and deepest repartitioning of a spill file
+const spill_count = 64
+const max_spill_depth = 8
+
+var memory_limit int64
+var keep_order bool
+
+type fingerprint struct {
+	lo, hi	uint64
+}
+
+/*
+ *  Open addressed, linear probed set of line fingerprints.  The zero
+ *  fingerprint marks an empty slot.
+ */
+type hash_set struct {
+	slot	[]fingerprint
+	count	int
+
+	//  --verify: arena block and offset of the line in each slot
+	verify	bool
+	offset	[]uint64
+	arena	[][]byte
+	arena_size	int64
+}
+
+var seed_lo, seed_hi = maphash.MakeSeed(), maphash.MakeSeed()
+
+func line_fingerprint(line []byte) fingerprint {
+
+	fp := fingerprint{
+		lo:	maphash.Bytes(seed_lo, line),
+		hi:	maphash.Bytes(seed_hi, line),
+	}
+	if fp == (fingerprint{}) {
+		fp.hi = 1
+	}
+	return fp
+}
+
+func new_hash_set(verify bool) *hash_set {
+
+	set := &hash_set{
+		slot:	make([]fingerprint, min_slots),
+		verify:	verify,
+	}
+	if verify {
+		set.offset = make([]uint64, min_slots)
+	}
+	return set
+}
+
+/*
+ *  Append the length prefixed line to the last arena block, starting a new
+ *  block when full, and return the block index in the high 32 bits and
+ *  offset in the low.  Blocks are never copied, so the arena grows without
+ *  doubling the resident size.
+ */
+func (set *hash_set) store(line []byte) uint64 {
+
+	need := binary.MaxVarintLen64 + len(line)
+	n := len(set.arena)
+	if n == 0 || len(set.arena[n - 1]) + need > cap(set.arena[n - 1]) {
+		size := min_arena_block
+		if n > 0 {
+			size = 2 * cap(set.arena[n - 1])
+			if size > max_arena_block {
+				size = max_arena_block
+			}
+		}
+		if size < need {
+			size = need
+		}
+		set.arena = append(set.arena, make([]byte, 0, size))
+		n++
+	}
+	block := set.arena[n - 1]
+	off := uint64(n - 1) << 32 | uint64(len(block))
+	block = binary.AppendUvarint(block, uint64(len(line)))
+	set.arena[n - 1] = append(block, line...)
+	set.arena_size += int64(len(set.arena[n - 1]) - len(block))
+	return off
+}
+
+func (set *hash_set) line(off uint64) []byte {
+
+	block := set.arena[off >> 32][off & 0xffffffff:]
+	size, n := binary.Uvarint(block)
+	return block[n:n + int(size)]
+}
+
+//  double the slots, reinserting by the stored fingerprints
+func (set *hash_set) grow() {
+
+	old_slot, old_offset := set.slot, set.offset
+	set.slot = make([]fingerprint, 2 * len(old_slot))
+	if set.verify {
+		set.offset = make([]uint64, len(set.slot))
+	}
+	mask := uint64(len(set.slot) - 1)
+	for i, fp := range old_slot {
+		if fp == (fingerprint{}) {
+			continue
+		}
+		j := fp.lo & mask
+		for set.slot[j] != (fingerprint{}) {
+			j = (j + 1) & mask
+		}
+		set.slot[j] = fp
+		if set.verify {
+			set.offset[j] = old_offset[i]
+		}
+	}
+}
+
+/*
+ *  Find the slot of the line, returning true, or the empty slot ending the
+ *  probe, returning false.
+ */
+func (set *hash_set) lookup(fp fingerprint, line []byte) (uint64, bool) {
+
+	mask := uint64(len(set.slot) - 1)
+	for i := fp.lo & mask;  ;  i = (i + 1) & mask {
+		s := set.slot[i]
+		if s == (fingerprint{}) {
+			return i, false
+		}
+		if s == fp {
+			if !set.verify || bytes.Equal(
+				set.line(set.offset[i]),
+				line,
+			) {
+				return i, true
+			}
+		}
+	}
+}
+
+func (set *hash_set) has(line []byte) bool {
+
+	_, found := set.lookup(line_fingerprint(line), line)
+	return found
+}
+
+//  add the line to the set, returning false if already seen
+func (set *hash_set) add(line []byte) bool {
+
+	if (set.count + 1) * 4 > len(set.slot) * 3 {
+		set.grow()
+	}
+	fp := line_fingerprint(line)
+	i, found := set.lookup(fp, line)
+	if found {
+		return false
+	}
+	set.slot[i] = fp
+	if set.verify {
+		set.offset[i] = set.store(line)
+	}
+	set.count++
+	return true
+}
+
+//  bytes of the slots, plus the arena for --verify
+func (set *hash_set) size() int64 {
+
+	slot_size := int64(16)
+	if set.verify {
+		slot_size += 8
+	}
+	return int64(len(set.slot)) * slot_size + set.arena_size
+}
+
+/*
+ *  Would adding a new line of "line_len" bytes exceed the memory limit,
+ *  counting both old and new slots while growing?
+ */
+func (set *hash_set) over_limit(line_len int) bool {
+
+	need := set.size() + int64(binary.MaxVarintLen64 + line_len)
+	if (set.count + 1) * 4 > len(set.slot) * 3 {
+		need += 2 * (set.size() - set.arena_size)
+	}
+	return need > memory_limit
+}
+
+//  unlinked temporary file of records of an optional line number then line
+type spill struct {
+	file	*os.File
+	out	*bufio.Writer
+}
+
+func new_spill() *spill {
+
+	file, err := os.CreateTemp("", "dedup-spill-")
+	if err != nil {
+		fatal("os.CreateTemp(spill) failed: %s", err)
+	}
+	if err = os.Remove(file.Name()); err != nil {
+		fatal("os.Remove(spill) failed: %s", err)
+	}
+	return &spill{
+		file:	file,
+		out:	bufio.NewWriterSize(file, 64 * 1024),
+	}
+}
+
+func (s *spill) put(seq uint64, line []byte) {
+
+	var head [2 * binary.MaxVarintLen64]byte
+
+	n := 0
+	if keep_order {
+		n = binary.PutUvarint(head[:], seq)
+	}
+	n += binary.PutUvarint(head[n:], uint64(len(line)))
+	s.out.Write(head[:n])
+	s.out.Write(line)
+}
+
+/*
+ *  Flush the records and return a function reading them back in order.
+ *  The line returned is only valid until the next call.
+ */
+func (s *spill) reader() func() (uint64, []byte, bool) {
+
+	if err := s.out.Flush(); err != nil {
+		fatal("write(spill) failed: %s", err)
+	}
+	s.out = nil
+	if _, err := s.file.Seek(0, io.SeekStart); err != nil {
+		fatal("seek(spill) failed: %s", err)
+	}
+	in := bufio.NewReaderSize(s.file, 256 * 1024)
+	var buf []byte
+
+	return func() (uint64, []byte, bool) {
+
+		var seq uint64
+		var err error
+
+		if keep_order {
+			seq, err = binary.ReadUvarint(in)
+			if err == io.EOF {
+				return 0, nil, false
+			}
+			if err != nil {
+				fatal("read(spill seq) failed: %s", err)
+			}
+		}
+		size, err := binary.ReadUvarint(in)
+		if err == io.EOF && !keep_order {
+			return 0, nil, false
+		}
+		if err != nil {
+			fatal("read(spill size) failed: %s", err)
+		}
+		if uint64(cap(buf)) < size {
+			buf = make([]byte, size)
+		}
+		buf = buf[:size]
+		if _, err = io.ReadFull(in, buf); err != nil {
+			fatal("read(spill line) failed: %s", err)
+		}
+		return seq, buf, true
+	}
+}
+
+func (s *spill) close() {
+
+	s.file.Close()
+	s.file = nil
+}
+
+//  head of a spill file of distinct lines, merged by line number
+type merge_head struct {
+	seq	uint64
+	line	[]byte
+	next	func() (uint64, []byte, bool)
+}
+
+type merge_heap []*merge_head
+
+func (h merge_heap) Len() int		{ return len(h) }
+func (h merge_heap) Less(i, j int) bool	{ return h[i].seq < h[j].seq }
+func (h merge_heap) Swap(i, j int)	{ h[i], h[j] = h[j], h[i] }
+
+func (h *merge_heap) Push(x interface{}) {
+	*h = append(*h, x.(*merge_head))
+}
+
+func (h *merge_heap) Pop() interface{} {
+	old := *h
+	x := old[len(old) - 1]
+	*h = old[:len(old) - 1]
+	return x
+}
+
+/*
+ *  Emit the first occurrence of each line read by "next", in order, while
+ *  the table fits in the memory limit, then spill the lines not in the
+ *  table to files partitioned by hash, and dedup each file in turn.
+ */
+func dedup_limit(
+	next func() (uint64, []byte, bool),
+	emit func(uint64, []byte),
+	verify bool,
+	depth int,
+) {
+	var part []*spill
+	var seed maphash.Seed
+
+	set := new_hash_set(verify)
+	for {
+		seq, line, ok := next()
+		if !ok {
+			break
+		}
+		if part == nil {
+			if set.count < 2 || depth >= max_spill_depth ||
+			   !set.over_limit(len(line)) {
+				if set.add(line) {
+					emit(seq, line)
+				}
+				continue
+			}
+			seed = maphash.MakeSeed()
+			part = make([]*spill, spill_count)
+			for i := range part {
+				part[i] = new_spill()
+			}
+		}
+		if !set.has(line) {
+			part[maphash.Bytes(seed, line) % spill_count].put(seq, line)
+		}
+	}
+	if part == nil {
+		return
+	}
+	set = nil
+	debug.FreeOSMemory()
+
+	if !keep_order {
+		for _, s := range part {
+			dedup_limit(s.reader(), emit, verify, depth + 1)
+			s.close()
+		}
+		return
+	}
+
+	//  distinct lines of each spill file, merged by line number
+
+	var merge merge_heap
+	for _, s := range part {
+		distinct := new_spill()
+		dedup_limit(s.reader(), distinct.put, verify, depth + 1)
+		s.close()
+
+		h := &merge_head{next: distinct.reader()}
+		var ok bool
+		if h.seq, h.line, ok = h.next(); ok {
+			merge = append(merge, h)
+		}
+	}
+	heap.Init(&merge)
+	for len(merge) > 0 {
+		h := merge[0]
+		emit(h.seq, h.line)
+		var ok bool
+		if h.seq, h.line, ok = h.next(); ok {
+			heap.Fix(&merge, 0)
+		} else {
+			heap.Pop(&merge)
+		}
+	}
+}
+
+/*
+ *  Parse a count of bytes with an optional K, M, G or T suffix, in powers
+ *  of 1024.
+ */
+func parse_size(arg string) (int64, error) {
+
+	shift := uint(0)
+	if n := len(arg);  n > 0 {
+		switch arg[n - 1] {
+		case 'K', 'k':
+			shift = 10
+		case 'M', 'm':
+			shift = 20
+		case 'G', 'g':
+			shift = 30
+		case 'T', 't':
+			shift = 40
+		}
+		if shift > 0 {
+			arg = arg[:n - 1]
+		}
+	}
+	size, err := strconv.ParseInt(arg, 10, 64)
+	if err != nil {
+		return 0, err
+	}
+	if size < 0 || size > (1 << 62) >> shift {
+		return 0, fmt.Errorf("out of range")
+	}
+	return size << shift, nil
+}
+
 func die(format string, args ...interface{}) {
-	
+
 	fmt.Fprintf(os.Stderr, "dedup: ERROR: " + format + "\n", args...)
 	fmt.Fprintf(
 		os.Stderr,
-		"usage: dedup [--count]",
+		"usage: dedup [--count] [--hash [--verify]] " +
+			"[--memory-limit <size>[KMGT] [--keep-order]]\n",
 	)
 	os.Exit(1)
 }
 
+func fatal(format string, args ...interface{}) {
+
+	fmt.Fprintf(os.Stderr, "dedup: ERROR: " + format + "\n", args...)
+	os.Exit(1)
+}
+
 func main() {
-	
+
 	var seen map[string]bool
+	var set *hash_set
 	var buf[4096 * 4096]byte
+	var count int
 
 	put_count := false
+	hash := false
+	verify := false
 
 	argv := os.Args[1:]
-	argc := len(argv)
-	if argc == 1 {
-		if argv[0] != "--count" {
-			die("unknown option: %s", argv[0])
+	for i := 0;  i < len(argv);  i++ {
+		switch argv[i] {
+		case "--count":
+			put_count = true
+		case "--hash":
+			hash = true
+		case "--verify":
+			verify = true
+		case "--memory-limit":
+			i++
+			if i == len(argv) {
+				die("option --memory-limit: missing size")
+			}
+			size, err := parse_size(argv[i])
+			if err != nil {
+				die("option --memory-limit: %s: %s", argv[i], err)
+			}
+			if size < 1024 * 1024 {
+				die("option --memory-limit: less than 1M: %s", argv[i])
+			}
+			memory_limit = size
+		case "--keep-order":
+			keep_order = true
+		default:
+			die("unknown option: %s", argv[i])
 		}
-		put_count = true
-	} else if argc != 0 {
-		die("bad cli arg count: got %d, need 1 or 0", argc)
+	}
+	if verify && !hash {
+		die("option --verify requires --hash")
+	}
+	if keep_order && memory_limit == 0 {
+		die("option --keep-order requires --memory-limit")
 	}
 
 	in := bufio.NewScanner(os.Stdin)
 	in.Buffer(buf[:], len(buf))
-	seen = make(map[string]bool, 4096 * 4096)
-	for in.Scan() {
-		txt := in.Text()
-		if !seen[txt] {
-			seen[txt] = true
+	out := bufio.NewWriterSize(os.Stdout, 64 * 1024)
+
+	if memory_limit > 0 {
+
+		//  collect garbage before the heap outgrows the limit, allowing
+		//  for the line and spill buffers
+
+		debug.SetMemoryLimit(memory_limit + memory_limit / 4 + 64 << 20)
+
+		var seq uint64
+		next := func() (uint64, []byte, bool) {
+			if !in.Scan() {
+				return 0, nil, false
+			}
+			seq++
+			return seq, in.Bytes(), true
+		}
+		emit := func(seq uint64, line []byte) {
+			count++
 			if put_count == false {
-				fmt.Println(txt)
+				out.Write(line)
+				out.WriteByte('\n')
+			}
+		}
+		dedup_limit(next, emit, !hash || verify, 0)
+	} else if hash {
+		set = new_hash_set(verify)
+	} else {
+		seen = make(map[string]bool)
+	}
+	for memory_limit == 0 && in.Scan() {
+		line := in.Bytes()
+		if hash {
+			if !set.add(line) {
+				continue
 			}
+		} else {
+			if seen[string(line)] {
+				continue
+			}
+			seen[string(line)] = true
+		}
+		count++
+		if put_count == false {
+			out.Write(line)
+			out.WriteByte('\n')
 		}
 	}
 	if err := in.Err(); err != nil {
@@ -62,7 +598,11 @@ func main() {
 		os.Exit(1)
 	}
 	if put_count {
-		fmt.Printf("%d\n", len(seen))
+		fmt.Fprintf(out, "%d\n", count)
+	}
+	if err := out.Flush(); err != nil {
+		fmt.Fprintf(os.Stderr, "ERROR: %s\n", err)
+		os.Exit(1)
 	}
 	os.Exit(0)
 }
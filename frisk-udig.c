@@ -0,0 +1,130 @@
+/*
+ *  Synopsis:
+ *	Frisk the syntax of new line separated udigs read on standard input.
+ *  Usage:
+ *	psql --command 'select blob from blob' | frisk-udig >bad-udig.tsv
+ *  Description:
+ *	Each line of standard input is frisked with jmscott_frisk_udign().
+ *	Only bad udigs are written to standard output, as tab separated
+ *
+ *		<line number>	<error>	<udig>
+ *
+ *	Input is read in 1MB blocks and matched lines written in 64KB
+ *	blocks, so tens of millions of udigs frisk in a few seconds.
+ *  Exit Status:
+ *	0	all udigs are syntactically correct (or stdin empty)
+ *	1	some udigs are bad
+ *	2	unexpected error
+ *  See:
+ *	https://github.com/jmscott/blobio
+ */
+#include <sys/errno.h>
+#include <string.h>
+
+#include "jmscott/libjmscott.h"
+
+extern int	errno;
+
+char *jmscott_progname = "frisk-udig";
+static char *usage = "frisk-udig <udig-set";
+
+#define EXIT_OK		0
+#define EXIT_BAD	1
+#define EXIT_FAULT	2
+
+#define IN_SIZE		(1024 * 1024)
+#define OUT_SIZE	(64 * 1024)
+
+static char	in[IN_SIZE];
+static char	out[OUT_SIZE];
+static size_t	out_len = 0;
+
+static void
+die(char *msg)
+{
+	jmscott_die(EXIT_FAULT, msg);
+}
+
+static void
+die2(char *msg1, char *msg2)
+{
+	jmscott_die2(EXIT_FAULT, msg1, msg2);
+}
+
+static void
+flush()
+{
+	if (out_len > 0 && jmscott_write_all(1, out, out_len) < 0)
+		die2("write(stdout) failed", strerror(errno));
+	out_len = 0;
+}
+
+static void
+put(const char *src, size_t n)
+{
+	if (out_len + n > sizeof out)
+		flush();
+	memcpy(out + out_len, src, n);
+	out_len += n;
+}
+
+/*
+ *  Write "<line>\t<error>\t<udig>\n".  Bad udigs are truncated to 1024
+ *  bytes, since a bad line may be arbitrarily long.
+ */
+static void
+bad(unsigned long long line_no, char *err, const char *udig, size_t len)
+{
+	char num[21];
+
+	put(num, jmscott_ulltoa(line_no, num) - num);
+	put("\t", 1);
+	put(err, strlen(err));
+	put("\t", 1);
+	put(udig, len > 1024 ? 1024 : len);
+	put("\n", 1);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned long long line_no = 0, bad_count = 0;
+	size_t have = 0;
+	ssize_t nr;
+	char *err;
+
+	errno = 0;
+	if (--argc != 0)
+		jmscott_die_argc(EXIT_FAULT, argc, 0, usage);
+	(void)argv;
+
+	while ((nr = jmscott_read(0, in + have, sizeof in - have)) > 0) {
+		char *p = in, *end = in + have + nr, *nl;
+
+		while ((nl = memchr(p, '\n', end - p))) {
+			line_no++;
+			if ((err = jmscott_frisk_udign(p, nl - p))) {
+				bad(line_no, err, p, nl - p);
+				bad_count++;
+			}
+			p = nl + 1;
+		}
+		have = end - p;
+		if (have == sizeof in)
+			die("line > 1MB");
+		memmove(in, p, have);
+	}
+	if (nr < 0)
+		die2("read(stdin) failed", strerror(errno));
+
+	//  final line with no new line
+	if (have > 0) {
+		line_no++;
+		if ((err = jmscott_frisk_udign(in, have))) {
+			bad(line_no, err, in, have);
+			bad_count++;
+		}
+	}
+	flush();
+	_exit(bad_count > 0 ? EXIT_BAD : EXIT_OK);
+}
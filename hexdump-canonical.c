@@ -0,0 +1,100 @@
+/*
+ *  Synopsis:
+ *	Dump files or standard input, same output as "hexdump -C".
+ *  Usage:
+ *	hexdump-canonical blob.bin
+ *	tcpdump -w - | hexdump-canonical -v >trace.txt
+ *  Description:
+ *	Write the canonical hex+ascii dump of the concatenated files, or of
+ *	standard input when no files are given:
+ *
+ *	    00000000  67 65 74 20 70 69 6e 67  3a 61 62 63 64 65 66 0a  |get...|
+ *	    00000010
+ *
+ *	Repeated lines are written once, followed by "*", unless option -v.
+ *
+ *	Lines are formatted 16 bytes per step by jmscott_hexdump_write() in
+ *	libjmscott, without stdio, so dumps of high volume traffic run at
+ *	several hundred megabytes per second.
+ *  Exit Status:
+ *	0	dump written
+ *	1	error
+ *  Note:
+ *	No other hexdump options, like -n or -s, are supported.
+ */
+#include <sys/errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include "jmscott/libjmscott.h"
+
+extern int	errno;
+
+char *jmscott_progname = "hexdump-canonical";
+static char *usage = "hexdump-canonical [-v] [file ...]";
+
+#define IN_SIZE		(256 * 1024)
+
+static char			in[IN_SIZE];
+static struct jmscott_hexdump	dump;
+
+static void
+die2(char *msg1, char *msg2)
+{
+	jmscott_die2(1, msg1, msg2);
+}
+
+static void
+die3(char *msg1, char *msg2, char *msg3)
+{
+	jmscott_die3(1, msg1, msg2, msg3);
+}
+
+static void
+dump_fd(int fd, char *path)
+{
+	ssize_t nr;
+	char *err;
+
+	while ((nr = jmscott_read(fd, in, sizeof in)) > 0)
+		if ((err = jmscott_hexdump_write(&dump, in, nr)))
+			die2("write(stdout) failed", err);
+	if (nr < 0)
+		die3("read() failed", path, strerror(errno));
+}
+
+int
+main(int argc, char **argv)
+{
+	int i;
+	char *err;
+
+	errno = 0;
+	jmscott_hexdump_init(&dump, 1);
+	for (i = 1;  i < argc;  i++) {
+		if (strcmp("-v", argv[i]) == 0)
+			dump.squeeze = 0;
+		else if (strcmp("--", argv[i]) == 0) {
+			i++;
+			break;
+		} else if (argv[i][0] == '-' && argv[i][1])
+			jmscott_die3(1, "unknown option", argv[i], usage);
+		else
+			break;
+	}
+
+	if (i == argc)
+		dump_fd(0, "stdin");
+	for (;  i < argc;  i++) {
+		int fd = jmscott_open(argv[i], O_RDONLY, 0);
+
+		if (fd < 0)
+			die3("open() failed", argv[i], strerror(errno));
+		dump_fd(fd, argv[i]);
+		if (jmscott_close(fd) < 0)
+			die3("close() failed", argv[i], strerror(errno));
+	}
+	if ((err = jmscott_hexdump_close(&dump)))
+		die2("write(stdout) failed", err);
+	_exit(0);
+}
@@ -1,198 +1,427 @@
 /*
  *  Synopsis:
- *	Is a file all ascii text - deprecated by is-utf8wf.c
+ *	List paths of files that are well formed UTF-8 text, with no nulls.
  *  Usage:
- *	istext [-vEl] [file1 [file2 ...]]
- *	find . -type f -print | istext
- *  See:
- *	https://github.com/jmscott/work/istext.c
- *  Note:
- *	This program is no longer compilable and is replaced by is-utf8wf.c
+ *	istext -v /etc/passwd /etc/localtime
+ *	find / -xdev -type f | istext | xargs fgrep -l PATTERN
+ *	find /srv -type f -print0 | istext --null --threads 16 | xargs -0 ...
+ *  Description:
+ *	Classify each file as text when all bytes sampled are well formed
+ *	UTF-8 (RFC3629) with no null byte, writing the paths of text files.
+ *	Paths are read from the arguments or, when none, new line terminated
+ *	on standard input, or null terminated with --null, which also null
+ *	terminates the paths written.
+ *
+ *	By default, 4KB samples are read from the start, middle and end of
+ *	a file via pread(); files up to 12KB are read whole.  Option --full
+ *	reads every byte.  Bytes are checked by jmscott_utf8_write() in
+ *	libjmscott, vectorized for sse4, avx2 or avx512, and memchr() for
+ *	nulls.  Sequences split at a sample edge are ignored.  Directories
+ *	and other files that are not regular are skipped, listed by neither
+ *	mode, as in the old bash istext.
  *
- *	This program should have been named "isascii".
- *	Another program called isutf8 should exist.
+ *	Files are classified in parallel, --threads at a time, default online
+ *	cpus, each thread taking batches of 64 consecutive paths.  A thread
+ *	stats and opens a file with fstatat() and openat() relative to the
+ *	parent directory of the previous path, so paths grouped by directory,
+ *	as written by find, resolve only the final component.
+ *
+ *	Options:
+ *		-v	list files that are not text
+ *		-e	empty files are text
+ *		-L	follow symbolic links, the default, as "[ -f ]" did
+ *			in the old bash istext
+ *		-P	do not follow symbolic links, which are then skipped
+ *  Exit Status:
+ *	0	some path listed
+ *	1	no path listed
+ *	2	unexpected error
+ *  Note:
+ *	Paths are written in order of completion, unless --threads 1.
  *
- *	A true "istext" would consult the locale and use icu, rendering a quite
- *	complex piece of code.
+ *	This program should have been named "isutf8".  A true "istext" would
+ *	consult the locale and use icu, rendering a quite complex piece of
+ *	code.
  */
+#ifdef __linux__
+#define _GNU_SOURCE		//  O_PATH
+#endif
 
-#include <sys/types.h>
+#include <sys/errno.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <ctype.h>
-#include <unistd.h>
-#include <stdio.h>
-#include <string.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
-extern void	*malloc();
-char		*program;
+#include "jmscott/libjmscott.h"
 
-static int	chunk_size	= 1024;
-static char	*chunk = 0;
-static int	sense = 1;
-static int	empty_is_text = 0;
+extern int	errno;
 
-extern int	stat();
-#ifdef NO_LSTAT
-static int	(*statfunc)() = stat;
-#else
-extern int	lstat();
-static int	(*statfunc)() = lstat;
+char *jmscott_progname = "istext";
+static char *usage =
+	"istext [-v] [-e] [-L | -P] [--null] [--full] [--threads <n>] [file ...]"
+;
+
+#define EXIT_OK		0
+#define EXIT_NONE	1
+#define EXIT_FAULT	2
+
+#define MAX_THREADS	256
+#define BATCH		64
+#define SAMPLE_SIZE	4096
+#define FULL_SIZE	(256 * 1024)
+#define OUT_SIZE	(64 * 1024)
+
+#ifndef O_PATH
+#define O_PATH		O_RDONLY
 #endif
 
+struct worker
+{
+	pthread_t	thread;
+
+	int		dir_fd;		//  parent of previous path
+	size_t		dir_len;
+	char		dir[JMSCOTT_PATH_MAX + 1];
+
+	size_t		len;
+	char		out[OUT_SIZE];
+	unsigned char	in[FULL_SIZE];
+};
+
+static char		**paths;
+static size_t		npath;
+static size_t		next_path = 0;
+
+static int		sense = 1;
+static int		empty_is_text = 0;
+static int		stat_flags = 0;
+static int		null_term = 0;
+static int		full = 0;
+
+static unsigned long long	nlisted = 0;
+
+static pthread_mutex_t	write_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+die(char *msg)
+{
+	jmscott_die(EXIT_FAULT, msg);
+}
+
+static void
+die2(char *msg1, char *msg2)
+{
+	jmscott_die2(EXIT_FAULT, msg1, msg2);
+}
+
+static void
+flush(struct worker *w)
+{
+	if (w->len == 0)
+		return;
+	pthread_mutex_lock(&write_mutex);
+	if (jmscott_write_all(1, w->out, w->len) < 0)
+		die2("write(stdout) failed", strerror(errno));
+	pthread_mutex_unlock(&write_mutex);
+	w->len = 0;
+}
+
 /*
-**  Read and check a check of bytes for "textness"
-*/
+ *  Report an unreadable file on stderr, in a single write(), and go on.
+ */
+static void
+file_error(char *path, char *what, int err)
+{
+	jmscott_stderr3(path, what, strerror(err));
+}
+
+/*
+ *  Directory fd and final component of a path, reusing the directory of
+ *  the previous path of this thread.  Returns -1 when the directory can
+ *  not be opened, with errno set.
+ */
 static int
-check_chunk(fd, pos, file_name)
-int fd;
-long pos;
-char *file_name;
+dir_at(struct worker *w, char *path, char **name)
 {
-int nread;
-register char c, *p;
+	char *slash = strrchr(path, '/');
+	size_t len;
 
-	if (lseek(fd, pos, SEEK_SET) < 0)
-	{
-		perror(file_name);
-		return 0;
+	//  no directory, or a trailing slash
+
+	if (!slash || slash[1] == 0) {
+		*name = path;
+		return AT_FDCWD;
 	}
-	if ((nread = read(fd, chunk, chunk_size)) < 0)
-	{
-		perror(file_name);
-		return 0;
+	*name = slash + 1;
+	len = slash == path ? 1 : (size_t)(slash - path);
+	if (len > JMSCOTT_PATH_MAX) {
+		*name = path;
+		return AT_FDCWD;
 	}
+	if (w->dir_fd >= 0 && len == w->dir_len &&
+	    memcmp(w->dir, path, len) == 0)
+		return w->dir_fd;
 
-	/*
-	**  Scan for non-ascii or null char
-	*/
-	for (p = chunk, c = *p;  nread > 0;  c = *p++, nread--)
-		if (c == 0 || !isascii(c))
-			return 0;
-	return 1;
+	if (w->dir_fd >= 0 && jmscott_close(w->dir_fd) < 0)
+		die2("close(dir) failed", strerror(errno));
+	memcpy(w->dir, path, len);
+	w->dir[len] = 0;
+	w->dir_len = 0;
+	w->dir_fd = jmscott_open(w->dir, O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+	if (w->dir_fd < 0)
+		return -1;
+	w->dir_len = len;
+	return w->dir_fd;
 }
 
 /*
-**  Is a file text ?
-**
-**	1	if text
-**	0	if unknown
-**	-1	if not text
-*/
+ *  pread() up to "size" bytes at "off", restarting partial reads.
+ */
+static ssize_t
+pread_all(int fd, unsigned char *buf, size_t size, off_t off)
+{
+	size_t n = 0;
+
+	while (n < size) {
+		ssize_t nr = pread(fd, buf + n, size - n, off + n);
+
+		if (nr < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		if (nr == 0)
+			break;
+		n += nr;
+	}
+	return (ssize_t)n;
+}
+
+/*
+ *  Is a sample text?  Leading continuation bytes of a sequence begun
+ *  before the sample are skipped, and a sequence cut by the end of the
+ *  sample is accepted, unless the sample ends the file.
+ */
 static int
-istext(file_name)
-char *file_name;
+sample_is_text(unsigned char *p, size_t len, int at_start, int at_end)
 {
-static int fd = -1;
-struct stat stat_buf;
+	struct jmscott_utf8 u;
+	int i;
 
-	if (fd > -1)
-		close(fd);
+	if (memchr(p, 0, len))
+		return 0;
+	if (!at_start)
+		for (i = 0;  i < 3 && len > 0 && (*p & 0xC0) == 0x80;  i++) {
+			p++;
+			len--;
+		}
+	jmscott_utf8_init(&u);
+	if (!jmscott_utf8_write(&u, p, len))
+		return 0;
+	return at_end ? jmscott_utf8_close(&u) : 1;
+}
 
-	if ((*statfunc)(file_name, &stat_buf) != 0)
-	{
-		perror(file_name);
+/*
+ *  Read every byte.  Returns 1 text, 0 not text, -1 read error.
+ */
+static int
+full_is_text(struct worker *w, int fd)
+{
+	struct jmscott_utf8 u;
+	ssize_t nr;
+
+	jmscott_utf8_init(&u);
+	while ((nr = jmscott_read(fd, w->in, sizeof w->in)) > 0)
+		if (memchr(w->in, 0, nr) || !jmscott_utf8_write(&u, w->in, nr))
+			return 0;
+	if (nr < 0)
+		return -1;
+	return jmscott_utf8_close(&u);
+}
+
+/*
+ *  Is a file text?
+ *
+ *	1	if text
+ *	0	if unknown, error reported, or not a regular file
+ *	-1	if not text
+ */
+static int
+istext(struct worker *w, char *path)
+{
+	struct stat st;
+	char *name;
+	int at_fd, fd, text;
+	off_t size;
+
+	if ((at_fd = dir_at(w, path, &name)) == -1) {
+		file_error(path, "open(dir) failed", errno);
 		return 0;
 	}
-	if (!S_ISREG(stat_buf.st_mode))
-		return -1;
-	if (stat_buf.st_size == 0)
+	if (fstatat(at_fd, name, &st, stat_flags) < 0) {
+		file_error(path, "fstatat() failed", errno);
+		return 0;
+	}
+	if (!S_ISREG(st.st_mode))
+		return 0;
+	if (st.st_size == 0)
 		return empty_is_text ? 1 : -1;
 
-	if ((fd = open(file_name, O_RDONLY)) < 0)
-	{
-		perror(file_name);
+	//  non-blocking, should a fifo replace the file
+
+	fd = jmscott_openat(at_fd, name,
+			O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		file_error(path, "openat() failed", errno);
 		return 0;
 	}
+	size = st.st_size;
+	if (full)
+		text = full_is_text(w, fd);
+	else if (size <= 3 * SAMPLE_SIZE) {
+		ssize_t nr = pread_all(fd, w->in, size, 0);
 
-	/*
-	**  Check chunk_size bytes at start of file.
-	*/
-	if (!check_chunk(fd, (long)0, file_name))
-		return -1;
-	if (stat_buf.st_size < chunk_size)
-		return 1;
-	
-	/*
-	**  Check middle chunk_size bytes
-	*/
-	if (!check_chunk(fd, (long)(stat_buf.st_size / 2), file_name))
-		return -1;
-	if (stat_buf.st_size < chunk_size * 2)
-		return 1;
+		text = nr < 0 ? -1 : sample_is_text(w->in, nr, 1, 1);
+	} else {
+		off_t off[3];
+		int i;
 
-	/*
-	**  Check final chunk_size bytes
-	*/
-	if (!check_chunk(fd, (long)(stat_buf.st_size - chunk_size), file_name))
-		return -1;
-	close(fd);
-	fd = -1;
-	return 1;
+		off[0] = 0;
+		off[1] = (size / 2) & ~(off_t)(SAMPLE_SIZE - 1);
+		off[2] = size - SAMPLE_SIZE;
+		text = 1;
+		for (i = 0;  i < 3 && text == 1;  i++) {
+			ssize_t nr = pread_all(fd, w->in, SAMPLE_SIZE, off[i]);
+
+			if (nr < 0)
+				text = -1;
+			else
+				text = sample_is_text(w->in, nr, i==0, i==2);
+		}
+	}
+	if (text < 0)
+		file_error(path, "read() failed", errno);
+	if (jmscott_close(fd) < 0)
+		die2("close() failed", strerror(errno));
+	if (text < 0)
+		return 0;
+	return text ? 1 : -1;
+}
+
+static void
+put_path(struct worker *w, char *path)
+{
+	size_t len = strlen(path);
+
+	if (w->len + len + 1 > sizeof w->out)
+		flush(w);
+	if (len + 1 > sizeof w->out) {
+		file_error(path, "path", ENAMETOOLONG);
+		return;
+	}
+	memcpy(w->out + w->len, path, len);
+	w->len += len;
+	w->out[w->len++] = null_term ? 0 : '\n';
+	__atomic_fetch_add(&nlisted, 1, __ATOMIC_RELAXED);
+}
+
+static void *
+worker(void *arg)
+{
+	struct worker *w = arg;
+	size_t i, end;
+
+	while ((i = __atomic_fetch_add(&next_path, BATCH, __ATOMIC_RELAXED)) <
+									npath) {
+		end = i + BATCH < npath ? i + BATCH : npath;
+		for (;  i < end;  i++)
+			if (istext(w, paths[i]) * sense > 0)
+				put_path(w, paths[i]);
+	}
+	flush(w);
+	if (w->dir_fd >= 0)
+		(void)jmscott_close(w->dir_fd);
+	return (void *)0;
 }
 
 static int
-options(argc, argv)
-int argc;
-char **argv;
+option_int(char *option, char *value, int max)
 {
-int i;
+	unsigned long long ull;
+	char *err;
 
-	for (i = 1;  i < argc;  i++)
-		if (strcmp("-v", argv[i]) == 0)
-			sense = -1;
-		else if (strcmp("-e", argv[i]) == 0)
-			empty_is_text = 1;
-		else if (strcmp("-L", argv[i]) == 0)
-			statfunc = stat;
-		else if (strcmp("-help", argv[i]) == 0)
-		{
-			fprintf(stderr, "Usage: %s [-e][-v][-L] [file ...]\n",
-						program);
-			exit(0);
-		}
-		else
-			break;
-	return i;
+	if ((err = jmscott_a2ui63(value, &ull)))
+		jmscott_die3(EXIT_FAULT, option, value, err);
+	if (ull == 0 || ull > (unsigned long long)max)
+		jmscott_die3(EXIT_FAULT, option, value, "out of range");
+	return (int)ull;
 }
 
 int
 main(int argc, char **argv)
 {
-	int count = 0, i;
-	char file_name[BUFSIZ];
+	struct worker *workers;
+	int i, t, nthread = 0, status;
+	char *err;
 
 	errno = 0;
-	if ((program = strrchr(argv[0], '/')))
-		program++;
-	else
-		program = argv[0];
-	i = options(argc, argv);
-	if ((chunk = malloc(chunk_size)) == NULL)
-	{
-		fprintf(stderr, "malloc(%d) failed", chunk_size);
-		exit(2);
+	for (i = 1;  i < argc;  i++) {
+		char *a = argv[i];
+
+		if (strcmp("-v", a) == 0)
+			sense = -1;
+		else if (strcmp("-e", a) == 0)
+			empty_is_text = 1;
+		else if (strcmp("-L", a) == 0)
+			stat_flags = 0;
+		else if (strcmp("-P", a) == 0)
+			stat_flags = AT_SYMLINK_NOFOLLOW;
+		else if (strcmp("--null", a) == 0)
+			null_term = 1;
+		else if (strcmp("--full", a) == 0)
+			full = 1;
+		else if (strcmp("--threads", a) == 0) {
+			if (++i == argc)
+				die("option --threads: missing count");
+			nthread = option_int(a, argv[i], MAX_THREADS);
+		} else if (strcmp("--", a) == 0) {
+			i++;
+			break;
+		} else if (a[0] == '-' && a[1])
+			jmscott_die3(EXIT_FAULT, "unknown option", a, usage);
+		else
+			break;
 	}
-	if (i == argc)		/* file names on stdin */
-		while (fgets(file_name, sizeof file_name, stdin))
-		{
-		int len;
-
-			len = strlen(file_name);
-			if (len > 0 && file_name[len - 1] == '\n')
-				file_name[len - 1] = 0;
-			if (istext(file_name) * sense > 0)
-			{
-				count++;
-				puts(file_name);
-			}
-		}
-	else while (i < argc)				/* Arguments */
-		if (istext(argv[i++]) * sense > 0)
-		{
-			count++;
-			puts(argv[i - 1]);
-		}
-	exit(count > 0 ? 0 : 1);
+	if (i < argc) {
+		paths = argv + i;
+		npath = argc - i;
+	} else if ((err = jmscott_read_paths(0, null_term ? 0 : '\n', &paths,
+								&npath)))
+		die2("read(stdin paths) failed", err);
+	if (npath == 0)
+		_exit(EXIT_NONE);
+
+	if (nthread == 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nthread = ncpu < 1 ? 1 : ncpu > MAX_THREADS ?
+						MAX_THREADS : (int)ncpu;
+	}
+	if ((size_t)nthread > (npath + BATCH - 1) / BATCH)
+		nthread = (npath + BATCH - 1) / BATCH;
+	if (!(workers = calloc(nthread, sizeof *workers)))
+		die("calloc(workers) failed: out of memory");
+	for (t = 0;  t < nthread;  t++) {
+		workers[t].dir_fd = -1;
+		status = pthread_create(&workers[t].thread, (pthread_attr_t *)0,
+					worker, &workers[t]);
+		if (status)
+			die2("pthread_create() failed", strerror(status));
+	}
+	for (t = 0;  t < nthread;  t++)
+		if ((status = pthread_join(workers[t].thread, (void **)0)))
+			die2("pthread_join() failed", strerror(status));
+	_exit(nlisted > 0 ? EXIT_OK : EXIT_NONE);
 }
@@ -9,6 +9,9 @@
  *	with a fast shutdown using SIGINT after receiving a SIGTERM from
  *	launchd.  The time to pause before Also, the pid file is forcibly
  *	removed.
+ *
+ *	Messages are logged to standard error via jmscott_info(), etc., in
+ *	libjmscott, which are safe in the TERM signal handler.
  *  Usage:
  *	pg_launchd							\
  *		--SIGINT-pause 5					\
@@ -35,8 +38,6 @@
  *	2	unexpected error
  *	3	unexpected exit of postmaster process
  *  Note:
- *	Convert to libjmscott.a
- *
  *	A simpler method must exist to send a SIGINT to a process started
  *	by launchd.
  */
@@ -53,143 +54,58 @@
 
 extern int	errno;
 
+char		*jmscott_progname = "pg_launchd";
+
 static char	*pid_path = 0;
 static int	SIGINT_pause = 0;
 static pid_t	postmaster_pid = 0;
 static int	exit_status = -1;
 
-/*
- * Synopsis:
- *  	Fast, safe and simple string concatenator
- *  Usage:
- *  	buf[0] = 0
- *  	_strcat(buf, sizeof buf, "hello, world");
- *  	_strcat(buf, sizeof buf, ": ");
- *  	_strcat(buf, sizeof buf, "good bye, cruel world");
- */
-static void
-_strcat(char *tgt, int tgtsize, char *src)
-{
-	//  find null terminated end of target buffer
-	while (*tgt++)
-		--tgtsize;
-	--tgt;
-
-	//  copy non-null src bytes, leaving room for trailing null
-	while (--tgtsize > 0 && *src)
-		*tgt++ = *src++;
-
-	// target always null terminated
-	*tgt = 0;
-}
-
-/*
- *  Write info messages to standard error.
- */
-static void
-info(char *msg1)
-{
-	char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
-	static char nl[] = "\n";
-
-	msg[0] = 0;
-
-	snprintf(msg, sizeof msg, "pg_launchd: #%d: ", getpid());
-	_strcat(msg, sizeof msg, msg1);
-	_strcat(msg, sizeof msg, nl);
-
-again:
-	if (write(2, msg, strlen(msg)) < 0 && errno == EINTR)
-		goto again;
-}
-
-static void
-info2(char *msg1, char *msg2)
-{
-	char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
-
-	msg[0] = 0;
-	_strcat(msg, sizeof msg, msg1);
-	_strcat(msg, sizeof msg, ": ");
-	_strcat(msg, sizeof msg, msg2);
-	info(msg);
-}
-
-static void	die2(char *msg1, char *msg2);
-
 static void
 leave(int status)
 {
 	if (pid_path) {
 		char *path = pid_path;
 		pid_path = 0;
-		info2("unlinking pid file", path);
-		if (unlink(path) && errno != ENOENT)
-			die2("unlink(pid path) failed", strerror(errno));
+		jmscott_info("unlinking pid file", path);
+		if (unlink(path) && errno != ENOENT) {
+			jmscott_error("unlink(pid path) failed", strerror(errno));
+			status = 1;
+		}
 	}
 	if (postmaster_pid > 0)
-		info("good bye, cruel world");
+		jmscott_info("good bye, cruel world");
 	exit(status);
 }
 
-static void
-ERROR(char *msg)
-{
-	info2("ERROR", msg);
-}
-
-static void
-ERROR2(char *msg1, char *msg2)
-{
-	char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
-
-	msg[0] = 0;
-	_strcat(msg, sizeof msg, msg1);
-	_strcat(msg, sizeof msg, ": ");
-	_strcat(msg, sizeof msg, msg2);
-	ERROR(msg);
-}
-
 /*
- *  Write error message to standard error and exit process with status code.
+ *  Log error message to standard error and exit process with status code.
  */
 static void
 die(char *msg)
 {
-	ERROR(msg);
+	jmscott_error(msg);
 	leave(1);
 }
 
 static void
 die2(char *msg1, char *msg2)
 {
-	char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
-
-	msg[0] = 0;
-	_strcat(msg, sizeof msg, msg1);
-	_strcat(msg, sizeof msg, ": ");
-	_strcat(msg, sizeof msg, msg2);
-
-	die(msg);
+	jmscott_error(msg1, msg2);
+	leave(1);
 }
 
 static void
 die3(char *msg1, char *msg2, char *msg3)
 {
-	char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
-
-	msg[0] = 0;
-	_strcat(msg, sizeof msg, msg1);
-	_strcat(msg, sizeof msg, ": ");
-	_strcat(msg, sizeof msg, msg2);
-
-	die2(msg, msg3);
+	jmscott_error(msg1, msg2, msg3);
+	leave(1);
 }
 
 static void
 info_wait_status(int status)
 {
-	info("postmaster has stopped");
+	jmscott_info("postmaster has stopped");
 
 	/*
 	 *  Unexpected exit of postmaster
@@ -210,13 +126,7 @@ info_wait_status(int status)
 		snprintf(what, sizeof what, "stopped: #%d", status);
 	else
 		snprintf(what, sizeof what, "unknown exit status: %d", status);
-	info2("postmaster process terminated", what);
-}
-
-static void
-WARN(char *msg)
-{
-	info2("WARN", msg);
+	jmscott_info("postmaster process terminated", what);
 }
 
 static void
@@ -224,28 +134,28 @@ catch_TERM(int sig)
 {
 	(void)sig;
 
-	info("signal TERM caught");
+	jmscott_info("signal TERM caught");
 
 	if (!postmaster_pid) {
-		WARN("postmaster not running");
+		jmscott_warn("postmaster not running");
 		exit_status = 0;
 		return;
 	}
 
 	//  fast shutdown with SIGINT to postmaster
 
-	info("sending fast shutdown signal INT to postmaster ...");
+	jmscott_info("sending fast shutdown signal INT to postmaster ...");
 	if (kill(postmaster_pid, SIGINT) != 0) {
 		exit_status = 2;
-		ERROR2("kill(postmaster, INT) failed", strerror(errno));
+		jmscott_error("kill(postmaster, INT) failed", strerror(errno));
 		return;
 	}
-	info("postmaster got signal");
+	jmscott_info("postmaster got signal");
 
 	int pause = SIGINT_pause;
 	SIGINT_pause = 0;
 	while (pause > 1) {
-		info("pausing 1 second as postmaster stops gracefully");
+		jmscott_info("pausing 1 second as postmaster stops gracefully");
 		sleep(1);
 		--pause;
 
@@ -253,7 +163,7 @@ catch_TERM(int sig)
 		pid_t pid = waitpid(postmaster_pid, &status, WNOHANG);
 		if (pid < 0) {
 			exit_status = 2;
-			ERROR2(
+			jmscott_error(
 				"waitpid(postmaster TERM) failed",
 				strerror(errno)
 			);
@@ -265,7 +175,7 @@ catch_TERM(int sig)
 			//  cheap sanity test
 			if (pid != postmaster_pid) {
 				exit_status = 2;
-				ERROR("non postmaster process exited");
+				jmscott_error("non postmaster process exited");
 				return;
 			}
 			info_wait_status(status);
@@ -276,10 +186,10 @@ catch_TERM(int sig)
 
 	//  nuke the postmaster
 
-	WARN("postmaster will not stop");
-	WARN("sending KILL signal to postmaster to force stop");
+	jmscott_warn("postmaster will not stop");
+	jmscott_warn("sending KILL signal to postmaster to force stop");
 	if (kill(postmaster_pid, SIGKILL) && errno != ESRCH) {
-		ERROR2("kill(postmaster, KILL) failed", strerror(errno));
+		jmscott_error("kill(postmaster, KILL) failed", strerror(errno));
 		exit_status = 2;
 		return;
 	}
@@ -313,16 +223,16 @@ postmaster(int pargc, char **pargv)
 		die2("fork() failed", strerror(errno));
 
 	if (postmaster_pid == 0) {
-		info2("execv postmaster", pargv[0]);
+		jmscott_info("execv postmaster", pargv[0]);
 		execv(pargv[0], pargv);
 		die2("execv(postmaster) failed", strerror(errno));
 	}
 	signal(SIGTERM, catch_TERM);
 
-	char buf[JMSCOTT_ATOMIC_WRITE_SIZE];
+	char buf[32] = "#";
 
-	snprintf(buf, sizeof buf, "postmaster pid: #%d", postmaster_pid);
-	info(buf);
+	*jmscott_ulltoa(postmaster_pid, buf + 1) = 0;
+	jmscott_info("postmaster pid", buf);
 }
 
 int
@@ -374,7 +284,7 @@ main(int argc, char **argv)
 	if (!pid_path)
 		epid("missing required option");
 
-	info("hello, world");
+	jmscott_info("hello, world");
 
 	postmaster(pargc, pargv);
 
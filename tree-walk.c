@@ -0,0 +1,313 @@
+/*
+ *  Synopsis:
+ *	Walk directory trees in parallel, writing paths or json per entry.
+ *  Usage:
+ *	tree-walk --null /srv/spool | xargs -0 ...
+ *	tree-walk --type f --json --xdev /home >home.jsonl
+ *	tree-walk --threads 32 --dont-sync --json /mnt/nfs
+ *  Description:
+ *	Walk each root with jmscott_walk() in libjmscott, a work stealing
+ *	pool of --threads threads (default online cpus) reading directories
+ *	via getdents64() and openat() relative to the parent directory.
+ *	Entries are written in no particular order, as found, each path on a
+ *	new line, or null terminated with --null, or with --json one object
+ *	per line:
+ *
+ *		{"path":"a/b.c","type":"f","mode":"0644","size":1291,
+ *		 "mtime":"2024-05-01T14:02:11.123456789+00:00"}
+ *
+ *	The "type" is the same as find -printf %y.  --json stats via statx()
+ *	of only the fields written, and --dont-sync lets NFS answer from
+ *	cached attributes.
+ *
+ *	Unreadable directories are reported on standard error and skipped.
+ *  Exit Status:
+ *	0	all trees walked
+ *	1	some entries not read, see standard error
+ *	2	unexpected error
+ *  Note:
+ *	Symbolic links are never followed.
+ *
+ *	Non UTF-8 file names produce invalid json strings.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE		//  STATX_*
+#endif
+
+#include <sys/errno.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jmscott/libjmscott.h"
+
+extern int	errno;
+
+char *jmscott_progname = "tree-walk";
+static char *usage =
+	"tree-walk [--null | --json] [--type f|d|l] [--max-depth <n>] "
+	"[--xdev] [--dont-sync] [--threads <n>] <root> ..."
+;
+
+#define EXIT_OK		0
+#define EXIT_BAD	1
+#define EXIT_FAULT	2
+
+#define MAX_THREADS	256
+#define OUT_SIZE	(64 * 1024)
+
+struct out
+{
+	size_t	len;
+	char	buf[OUT_SIZE];
+};
+
+static struct out	*outs;			//  one per thread
+static pthread_mutex_t	write_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int		null_term = 0;
+static int		json = 0;
+static char		only_type = 0;
+
+static void
+die(char *msg)
+{
+	jmscott_die(EXIT_FAULT, msg);
+}
+
+static void
+die2(char *msg1, char *msg2)
+{
+	jmscott_die2(EXIT_FAULT, msg1, msg2);
+}
+
+static void
+flush(struct out *o)
+{
+	if (o->len == 0)
+		return;
+	pthread_mutex_lock(&write_mutex);
+	if (jmscott_write_all(1, o->buf, o->len) < 0)
+		die2("write(stdout) failed", strerror(errno));
+	pthread_mutex_unlock(&write_mutex);
+	o->len = 0;
+}
+
+static char
+type_char(unsigned char type)
+{
+	switch (type) {
+	case DT_REG:	return 'f';
+	case DT_DIR:	return 'd';
+	case DT_LNK:	return 'l';
+	case DT_FIFO:	return 'p';
+	case DT_SOCK:	return 's';
+	case DT_CHR:	return 'c';
+	case DT_BLK:	return 'b';
+	}
+	return 'U';
+}
+
+/*
+ *  Append a json string, escaping quote, backslash and control chars.
+ */
+static char *
+put_json_string(char *p, const char *s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t i;
+
+	*p++ = '"';
+	for (i = 0;  i < len;  i++) {
+		unsigned char c = s[i];
+
+		if (c == '"' || c == '\\') {
+			*p++ = '\\';
+			*p++ = c;
+		} else if (c < 0x20) {
+			memcpy(p, "\\u00", 4);
+			p[4] = hex[c >> 4];
+			p[5] = hex[c & 0xf];
+			p += 6;
+		} else
+			*p++ = c;
+	}
+	*p++ = '"';
+	return p;
+}
+
+static char *
+put(char *p, const char *s)
+{
+	size_t len = strlen(s);
+
+	memcpy(p, s, len);
+	return p + len;
+}
+
+static int
+callback(struct jmscott_walk_entry *e, void *private)
+{
+	struct out *o = &outs[e->thread];
+	char *p;
+
+	(void)private;
+	if (only_type && type_char(e->type) != only_type)
+		return 0;
+
+	//  worst case json escapes every byte as \u00XX
+
+	if (o->len + e->path_len * 6 + 256 > sizeof o->buf)
+		flush(o);
+	p = o->buf + o->len;
+	if (json) {
+		p = put(p, "{\"path\":");
+		p = put_json_string(p, e->path, e->path_len);
+		p = put(p, ",\"type\":\"");
+		*p++ = type_char(e->type);
+		*p++ = '"';
+		if (e->have_stat) {
+			struct timespec ts;
+			char *err;
+			int i;
+
+			p = put(p, ",\"mode\":\"");
+			for (i = 9;  i >= 0;  i -= 3)
+				*p++ = '0' + ((e->st.st_mode >> i) & 07);
+			p = put(p, "\",\"size\":");
+			p = jmscott_lltoa(e->st.st_size, p);
+			p = put(p, ",\"mtime\":\"");
+			ts.tv_sec = e->st.st_mtim.tv_sec;
+			ts.tv_nsec = e->st.st_mtim.tv_nsec;
+			err = jmscott_RFC3339Nano_timespec(p, 36, &ts);
+			if (err)
+				die2("RFC3339Nano_timespec() failed", err);
+			p += JMSCOTT_RFC3339NANO_SIZE;
+			*p++ = '"';
+		}
+		*p++ = '}';
+		*p++ = '\n';
+	} else {
+		memcpy(p, e->path, e->path_len);
+		p += e->path_len;
+		*p++ = null_term ? 0 : '\n';
+	}
+	o->len = p - o->buf;
+	return 0;
+}
+
+/*
+ *  Report an unreadable entry on stderr, in a single write(), and go on.
+ */
+static int
+on_error(const char *path, char *err, void *private)
+{
+	char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
+	struct jmscott_strbuf sb;
+
+	(void)private;
+	jmscott_strbuf_init(&sb, msg, sizeof msg - 1);
+	jmscott_strbuf_append4(&sb, jmscott_progname, ": ERROR: ", path, ": ");
+	jmscott_strbuf_append(&sb, err);
+	msg[sb.len++] = '\n';
+
+	pthread_mutex_lock(&write_mutex);
+	(void)jmscott_write_all(2, msg, sb.len);
+	pthread_mutex_unlock(&write_mutex);
+	return 0;
+}
+
+static int
+option_int(char *option, char *value, int max)
+{
+	unsigned long long ull;
+	char *err;
+
+	if ((err = jmscott_a2ui63(value, &ull)))
+		jmscott_die3(EXIT_FAULT, option, value, err);
+	if (ull == 0 || ull > (unsigned long long)max)
+		jmscott_die3(EXIT_FAULT, option, value, "out of range");
+	return (int)ull;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct jmscott_walk w;
+	unsigned long long nerror = 0;
+	int i;
+	char *err;
+
+	errno = 0;
+	memset(&w, 0, sizeof w);
+	for (i = 1;  i < argc;  i++) {
+		char *a = argv[i];
+
+		if (strncmp("--", a, 2) != 0)
+			break;
+		if (strcmp("--", a) == 0) {
+			i++;
+			break;
+		}
+		if (strcmp("--null", a) == 0)
+			null_term = 1;
+		else if (strcmp("--json", a) == 0)
+			json = 1;
+		else if (strcmp("--xdev", a) == 0)
+			w.one_file_system = 1;
+		else if (strcmp("--dont-sync", a) == 0)
+			w.statx_dont_sync = 1;
+		else if (strcmp("--type", a) == 0) {
+			if (++i == argc)
+				die("option --type: missing f, d or l");
+			if (strlen(argv[i]) != 1 || !strchr("fdlpscb", argv[i][0]))
+				die2("option --type: unknown type", argv[i]);
+			only_type = argv[i][0];
+		} else if (strcmp("--max-depth", a) == 0) {
+			if (++i == argc)
+				die("option --max-depth: missing depth");
+			w.max_depth = option_int(a, argv[i], 65535);
+		} else if (strcmp("--threads", a) == 0) {
+			if (++i == argc)
+				die("option --threads: missing count");
+			w.nthread = option_int(a, argv[i], MAX_THREADS);
+		} else
+			jmscott_die3(EXIT_FAULT, "unknown option", a, usage);
+	}
+	if (i == argc)
+		jmscott_die2(EXIT_FAULT, "missing root directory", usage);
+	if (null_term && json)
+		die("options --null and --json are exclusive");
+
+	if (w.nthread == 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+		w.nthread = ncpu < 1 ? 1 : ncpu > MAX_THREADS ?
+						MAX_THREADS : (int)ncpu;
+	}
+	if (!(outs = calloc(w.nthread, sizeof *outs)))
+		die("calloc(outs) failed: out of memory");
+
+	if (json) {
+#if defined(__linux__) && defined(STATX_TYPE)
+		w.statx_mask = STATX_TYPE | STATX_MODE | STATX_SIZE |
+								STATX_MTIME;
+#else
+		w.stat = 1;
+#endif
+	}
+	w.callback = callback;
+	w.on_error = on_error;
+
+	for (;  i < argc;  i++) {
+		int t;
+
+		if ((err = jmscott_walk(&w, argv[i])))
+			die2(argv[i], err);
+		nerror += w.nerror;
+		for (t = 0;  t < w.nthread;  t++)
+			flush(&outs[t]);
+	}
+	_exit(nerror > 0 ? EXIT_BAD : EXIT_OK);
+}
@@ -0,0 +1,259 @@
+/*
+ *  Synopsis:
+ *	Digest files in parallel, writing "<udig>\t<path>" per file.
+ *  Usage:
+ *	udig-files /var/backup/2023.tar /var/backup/2024.tar
+ *	find . -type f | udig-files --algo blake2b --jobs 4 >udig.tsv
+ *  Description:
+ *	Compute the udig of each file named on the command line or, with no
+ *	file arguments, each new line separated path read on standard input.
+ *	Each file is digested by one of --jobs threads (default is the number
+ *	of online cpus), so output order is not input order.  Output lines
+ *	look like
+ *
+ *		sha256:9f86d0...0f00a08	/var/backup/2023.tar
+ *
+ *	Regular files are mmap()ed and digested straight from the page cache,
+ *	using the SHA-NI instructions, when available.  See jmscott_udig_file()
+ *	in libjmscott.
+ *
+ *	Files that can not be opened or read are reported on standard error
+ *	and skipped.
+ *  Exit Status:
+ *	0	all files digested
+ *	1	some files not digested, see standard error
+ *	2	unexpected error
+ *  Note:
+ *	Paths containing a new line can not be read on standard input.
+ *	Consider option --null.
+ */
+#include <sys/errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jmscott/libjmscott.h"
+
+extern int	errno;
+
+char *jmscott_progname = "udig-files";
+static char *usage =
+	"udig-files [--algo sha256|blake2b] [--jobs <n>] [path ...]";
+
+#define EXIT_OK		0
+#define EXIT_BAD	1
+#define EXIT_FAULT	2
+
+#define MAX_JOBS	256
+#define OUT_SIZE	(64 * 1024)
+
+static const char	*algo = "sha256";
+
+//  next path from argv[] or, when null, stdin
+static char		**next_arg = (char **)0;
+static pthread_mutex_t	in_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static char		out[OUT_SIZE];
+static size_t		out_len = 0;
+static pthread_mutex_t	out_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int		bad_count = 0;
+
+static void
+die(char *msg)
+{
+	jmscott_die(EXIT_FAULT, msg);
+}
+
+static void
+die2(char *msg1, char *msg2)
+{
+	jmscott_die2(EXIT_FAULT, msg1, msg2);
+}
+
+static void
+flush()
+{
+	if (out_len > 0 && jmscott_write_all(1, out, out_len) < 0)
+		die2("write(stdout) failed", strerror(errno));
+	out_len = 0;
+}
+
+/*
+ *  Write "<udig>\t<path>\n", holding the output lock.
+ */
+static void
+put_udig(char *udig, char *path)
+{
+	size_t ulen = strlen(udig), plen = strlen(path);
+	size_t n = ulen + 1 + plen + 1;
+
+	pthread_mutex_lock(&out_mutex);
+	if (out_len + n > sizeof out)
+		flush();
+	if (n > sizeof out)
+		die2("path too long", path);
+	memcpy(out + out_len, udig, ulen);
+	out[out_len + ulen] = '\t';
+	memcpy(out + out_len + ulen + 1, path, plen);
+	out[out_len + n - 1] = '\n';
+	out_len += n;
+	pthread_mutex_unlock(&out_mutex);
+}
+
+/*
+ *  Report an undigested file on stderr, in a single write().
+ */
+static void
+bad(char *path, char *err)
+{
+	char msg[JMSCOTT_ATOMIC_WRITE_SIZE];
+	struct jmscott_strbuf sb;
+
+	jmscott_strbuf_init(&sb, msg, sizeof msg - 1);
+	jmscott_strbuf_append4(&sb, jmscott_progname, ": ERROR: ", path, ": ");
+	jmscott_strbuf_append(&sb, err);
+	msg[sb.len++] = '\n';
+
+	pthread_mutex_lock(&out_mutex);
+	bad_count++;
+	(void)jmscott_write_all(2, msg, sb.len);
+	pthread_mutex_unlock(&out_mutex);
+}
+
+/*
+ *  Fetch the next path to digest, or null when done.  Paths from stdin are
+ *  malloc()ed and must be freed.
+ */
+static char *
+next_path(int *must_free)
+{
+	char *path = (char *)0;
+
+	pthread_mutex_lock(&in_mutex);
+	if (next_arg) {
+		if (*next_arg)
+			path = *next_arg++;
+		*must_free = 0;
+	} else {
+		size_t size = 0;
+		ssize_t len;
+
+		while ((len = getline(&path, &size, stdin)) > 0) {
+			if (path[len - 1] == '\n')
+				path[--len] = 0;
+			if (len > 0)
+				break;
+		}
+		if (len < 0) {
+			if (ferror(stdin))
+				die2("getline(stdin) failed", strerror(errno));
+			free(path);
+			path = (char *)0;
+		}
+		*must_free = 1;
+	}
+	pthread_mutex_unlock(&in_mutex);
+	return path;
+}
+
+static void *
+digest_paths(void *arg)
+{
+	char udig[JMSCOTT_UDIG_SIZE], *path, *err;
+	int must_free;
+
+	(void)arg;
+	while ((path = next_path(&must_free))) {
+		int fd = jmscott_open(path, O_RDONLY, 0);
+
+		if (fd < 0)
+			bad(path, strerror(errno));
+		else {
+			err = jmscott_udig_file(
+				algo,
+				fd,
+				udig,
+				sizeof udig,
+				(unsigned long long *)0
+			);
+			if (err)
+				bad(path, err);
+			else
+				put_udig(udig, path);
+			if (jmscott_close(fd) < 0)
+				die2("close(file) failed", strerror(errno));
+		}
+		if (must_free)
+			free(path);
+	}
+	return (void *)0;
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t threads[MAX_JOBS];
+	int i, jobs = 0;
+	char *err;
+
+	errno = 0;
+	for (i = 1;  i < argc;  i++) {
+		if (strcmp("--algo", argv[i]) == 0) {
+			struct jmscott_digest d;
+
+			if (++i == argc)
+				die("option --algo: missing algorithm");
+			if ((err = jmscott_digest_init(&d, argv[i])))
+				die2(err, argv[i]);
+			algo = argv[i];
+		} else if (strcmp("--jobs", argv[i]) == 0) {
+			unsigned long long ull;
+
+			if (++i == argc)
+				die("option --jobs: missing count");
+			if ((err = jmscott_a2ui63(argv[i], &ull)))
+				die2("option --jobs", err);
+			if (ull == 0 || ull > MAX_JOBS)
+				die("option --jobs: not in [1, 256]");
+			jobs = (int)ull;
+		} else if (strcmp("--", argv[i]) == 0) {
+			i++;
+			break;
+		} else if (strncmp("--", argv[i], 2) == 0)
+			jmscott_die3(EXIT_FAULT, "unknown option", argv[i], usage);
+		else
+			break;
+	}
+	if (i < argc)
+		next_arg = argv + i;
+
+	if (jobs == 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+		jobs = ncpu < 1 ? 1 : ncpu > MAX_JOBS ? MAX_JOBS : (int)ncpu;
+	}
+	if (next_arg && argc - i < jobs)
+		jobs = argc - i;
+
+	for (i = 0;  i < jobs;  i++) {
+		int status = pthread_create(
+				&threads[i],
+				(pthread_attr_t *)0,
+				digest_paths,
+				(void *)0
+		);
+		if (status != 0)
+			die2("pthread_create() failed", strerror(status));
+	}
+	for (i = 0;  i < jobs;  i++) {
+		int status = pthread_join(threads[i], (void **)0);
+
+		if (status != 0)
+			die2("pthread_join() failed", strerror(status));
+	}
+	flush();
+	_exit(bad_count > 0 ? EXIT_BAD : EXIT_OK);
+}
@@ -0,0 +1,132 @@
+/*
+ *  Synopsis:
+ *	Decode a hexdump back into bytes: trace, "hexdump -C" or xxd format.
+ *  Usage:
+ *	unhexdump <blob.hex >blob
+ *
+ *	#  replay only the requests written to a traced socket
+ *	unhexdump --direction '>' trace.log | nc localhost 1797
+ *  Description:
+ *	Read hexdump text from the files, or standard input when no files are
+ *	given, and write the decoded bytes to standard output.  The format
+ *	of each line is recognized independently:
+ *
+ *		jmscott_hexdump() trace, 76 columns, see libjmscott
+ *		hexdump -C, including squeezed "*" lines
+ *		xxd, any line width or byte grouping
+ *
+ *	Option --direction selects trace records of a single direction,
+ *	typically '>' for write or '<' for read.
+ *
+ *	Text is read in 1MB blocks and decoded via jmscott_unhexdump_write(),
+ *	a table lookup per hex pair.
+ *  Exit Status:
+ *	0	all text decoded
+ *	1	malformed line, line number on stderr
+ *	2	unexpected error
+ */
+#include <sys/errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include "jmscott/libjmscott.h"
+
+extern int	errno;
+
+char *jmscott_progname = "unhexdump";
+static char *usage = "unhexdump [--direction '<'|'>'] [file ...]";
+
+#define EXIT_OK		0
+#define EXIT_BAD	1
+#define EXIT_FAULT	2
+
+#define IN_SIZE		(1024 * 1024)
+
+static char				in[IN_SIZE];
+static struct jmscott_unhexdump		undump;
+
+static void
+die(char *msg)
+{
+	jmscott_die(EXIT_FAULT, msg);
+}
+
+static void
+die3(char *msg1, char *msg2, char *msg3)
+{
+	jmscott_die3(EXIT_FAULT, msg1, msg2, msg3);
+}
+
+/*
+ *  Malformed line or failed write.  Decoded bytes are written first.
+ */
+static void
+die_line(char *path, char *err)
+{
+	char num[32] = "line #";
+
+	(void)jmscott_unhexdump_flush(&undump);
+	*jmscott_ulltoa(undump.line_no, num + 6) = 0;
+	jmscott_die4(EXIT_BAD, path, num, "unhexdump failed", err);
+}
+
+static void
+undump_fd(int fd, char *path)
+{
+	ssize_t nr;
+	char *err;
+
+	while ((nr = jmscott_read(fd, in, sizeof in)) > 0)
+		if ((err = jmscott_unhexdump_write(&undump, in, nr)))
+			die_line(path, err);
+	if (nr < 0)
+		die3("read() failed", path, strerror(errno));
+}
+
+int
+main(int argc, char **argv)
+{
+	int i;
+	char *err;
+
+	errno = 0;
+	jmscott_unhexdump_init(&undump, 1);
+	for (i = 1;  i < argc;  i++) {
+		if (strcmp("--direction", argv[i]) == 0) {
+			if (++i == argc)
+				die("option --direction: missing char");
+			if (strlen(argv[i]) != 1 || argv[i][0] == ' ')
+				die("option --direction: not a single char");
+			undump.direction = argv[i][0];
+		} else if (strcmp("--", argv[i]) == 0) {
+			i++;
+			break;
+		} else if (argv[i][0] == '-' && argv[i][1])
+			jmscott_die3(EXIT_FAULT, "unknown option", argv[i], usage);
+		else
+			break;
+	}
+
+	if (i == argc) {
+		undump_fd(0, "stdin");
+		if ((err = jmscott_unhexdump_close(&undump)))
+			die_line("stdin", err);
+	}
+	for (;  i < argc;  i++) {
+		int fd = jmscott_open(argv[i], O_RDONLY, 0);
+
+		if (fd < 0)
+			die3("open() failed", argv[i], strerror(errno));
+		undump_fd(fd, argv[i]);
+		if (jmscott_close(fd) < 0)
+			die3("close() failed", argv[i], strerror(errno));
+
+		//  each file is a separate dump, offsets start at 0
+
+		if ((err = jmscott_unhexdump_close(&undump)))
+			die_line(argv[i], err);
+		undump.line_no = undump.offset = 0;
+		undump.nprev = 0;
+	}
+	_exit(EXIT_OK);
+}